@@ -0,0 +1,164 @@
+/*
+ * Benchmark of archetype storage against separate component tables.
+ *
+ * Runs the transformation and model workload of the sample game (matrices of entities that have both components)
+ *  headlessly over both storage designs, and reports the time taken by iteration and by adding and removing
+ *  components.
+ *
+ * Author: Filip Smola (smola.filip@hotmail.com)
+ */
+
+#include <open-sea/Entity.h>
+#include <open-sea/Components.h>
+#include <open-sea/Query.h>
+#include <open-sea/Archetype.h>
+namespace ecs = open_sea::ecs;
+namespace data = open_sea::data;
+
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+#include <string>
+#include <cstdlib>
+
+typedef ecs::ModelTable::Data ModelData;
+typedef ecs::TransformationTable::Data TransformationData;
+typedef ecs::ComponentTable<ModelData> ModelComponents;
+typedef ecs::ComponentTable<TransformationData> TransformationComponents;
+typedef data::ArchetypeStorage<ecs::Entity, data::SparseKeyMap<ecs::Entity>, ModelData, TransformationData> Archetypes;
+
+//! Sum of model indices, kept so that the work is not optimised out
+size_t checksum = 0;
+
+/**
+ * Time the function, reporting the mean time of a repetition
+ *
+ * \param label Label of the measurement
+ * \param repetitions Number of repetitions
+ * \param f Function to time
+ */
+template<typename F>
+void measure(const std::string &label, int repetitions, F f) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repetitions; i++) {
+        f();
+    }
+    const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << std::left << std::setw(40) << label << std::right << std::setw(10) << std::fixed
+              << std::setprecision(3) << elapsed.count() / repetitions << " ms" << std::endl;
+}
+
+/**
+ * Compute the world matrix of a root transformation, and add the model index to the checksum
+ *
+ * \param m Model component
+ * \param t Transformation component
+ */
+void update(const ModelData::Ptr &m, const TransformationData::Ptr &t) {
+    *t.matrix = glm::scale(glm::translate(glm::mat4(1.0f), *t.position) * glm::mat4_cast(*t.orientation), *t.scale);
+    checksum += *m.model;
+}
+
+/**
+ * Create a root transformation record
+ *
+ * \param g Random generator
+ * \return Transformation record
+ */
+TransformationData transformation(std::mt19937 &g) {
+    std::uniform_real_distribution<float> d(-100.0f, 100.0f);
+    TransformationData t{};
+    t.position = glm::vec3(d(g), d(g), d(g));
+    t.orientation = glm::angleAxis(d(g), glm::vec3(0.0f, 1.0f, 0.0f));
+    t.scale = glm::vec3(1.0f);
+    return t;
+}
+
+/**
+ * Entry point of the benchmark
+ *
+ * \param argc Number of arguments
+ * \param argv Arguments (optionally the number of entities)
+ * \return Exit code
+ */
+int main(int argc, char **argv) {
+    const unsigned n = argc > 1 ? static_cast<unsigned>(std::strtoul(argv[1], nullptr, 10)) : 100000;
+    const int repetitions = 20;
+    std::mt19937 g(42);
+
+    // Every entity has a transformation, three in four also have a model
+    std::vector<ecs::Entity> entities;
+    std::vector<TransformationData> transformations;
+    entities.reserve(n);
+    transformations.reserve(n);
+    for (unsigned i = 0; i < n; i++) {
+        entities.emplace_back(i, 0);
+        transformations.push_back(transformation(g));
+    }
+    // Entities whose model is removed and added back during churn (one in ten)
+    std::vector<ecs::Entity> churned;
+    for (unsigned i = 0; i < n; i += 10) {
+        churned.push_back(entities[i]);
+    }
+
+    // Fill both designs
+    ModelComponents models;
+    TransformationComponents transforms;
+    Archetypes archetypes;
+    for (unsigned i = 0; i < n; i++) {
+        transforms.add(entities[i], transformations[i]);
+        archetypes.add(entities[i], transformations[i]);
+        if (i % 4 != 3) {
+            models.add(entities[i], ModelData{i % 3});
+            archetypes.add(entities[i], ModelData{i % 3});
+        }
+    }
+
+    std::cout << "Entities: " << n << ", with a model: " << models.size() << ", archetypes: "
+              << archetypes.archetype_count() << std::endl;
+
+    // Iteration
+    measure("Tables, key lookup", repetitions, [&]() {
+        const std::vector<ecs::Entity> &keys = models.keys();
+        auto m = models.get_reference();
+        for (const ecs::Entity &e : keys) {
+            update(m, transforms.get_reference(e));
+            models.increment_reference(m);
+        }
+    });
+    data::Query<ModelComponents, TransformationComponents> query(models, transforms);
+    measure("Tables, query", repetitions, [&]() {
+        query.for_each([](const ecs::Entity &, const ModelData::Ptr &m, const TransformationData::Ptr &t) {
+            update(m, t);
+        });
+    });
+    measure("Archetypes", repetitions, [&]() {
+        archetypes.for_each<ModelData, TransformationData>([](const ecs::Entity &, const ModelData::Ptr &m, const TransformationData::Ptr &t) {
+            update(m, t);
+        });
+    });
+
+    // Churn
+    measure("Tables, remove and add models", repetitions, [&]() {
+        for (const ecs::Entity &e : churned) {
+            if (models.remove(e).is_set()) {
+                models.add(e, ModelData{0});
+            }
+        }
+    });
+    measure("Archetypes, remove and add models", repetitions, [&]() {
+        for (const ecs::Entity &e : churned) {
+            if (archetypes.remove<ModelData>(e)) {
+                archetypes.add(e, ModelData{0});
+            }
+        }
+    });
+
+    std::cout << "Checksum: " << checksum << std::endl;
+    return 0;
+}
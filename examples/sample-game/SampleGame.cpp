@@ -164,7 +164,7 @@ int main() {
         model_comp_manager->model_to_index(model);
         std::vector<size_t> models(n);   // modelIdx == 0, because it is the first model
 
-        model_comp_manager->table->add(entities.data(), {models.data()}, n);
+        model_comp_manager->add(entities.data(), models.data(), n);
     }
     debug::add_component_manager(model_comp_manager, "Model");
 
@@ -208,6 +208,9 @@ int main() {
     }
     debug::add_component_manager(trans_comp_manager, "Transformation");
 
+    // Group the components used by the renderer, keeping their records together
+    std::shared_ptr<ecs::OwningGroup> render_group = std::make_shared<ecs::OwningGroup>(model_comp_manager, trans_comp_manager);
+
     // Prepare renderer
     std::shared_ptr<render::UntexturedRenderer> renderer = std::make_shared<render::UntexturedRenderer>(model_comp_manager, trans_comp_manager);
     debug::add_system(renderer, "Untextured Renderer");
@@ -361,13 +364,15 @@ int main() {
         std::shared_ptr<gl::Camera> camera = (use_per_camera) ? test_camera_per : test_camera_ort;
 
         // Draw the entities
-        renderer->render(camera, entities.data(), n);
+        renderer->render(camera);
         profiler::pop();
 
         // Maintain components
         profiler::push("Maintain Components");
         model_comp_manager->gc(*test_manager);
         trans_comp_manager->gc(*test_manager);
+        model_comp_manager->count_stats();
+        trans_comp_manager->count_stats();
         profiler::pop();
 
         // ImGui debug GUI
@@ -434,6 +439,7 @@ int main() {
     os_log::log(lg, os_log::info, "Main loop ended");
 
     // Clean up OpenGL objects before termination of the context
+    render_group.reset();
     model_comp_manager.reset();
     renderer.reset();
     debug::clean_up();
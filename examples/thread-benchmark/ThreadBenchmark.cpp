@@ -0,0 +1,150 @@
+/*
+ * Benchmark of the parallel loops and of entity creation by number of threads.
+ *
+ * Computes the world matrices of root transformations headlessly over thread pools of increasing size, and reports the
+ *  time taken and the speed-up over a single thread.
+ * Then creates entities from increasing numbers of threads at once, and reports the entities created per second.
+ *
+ * Author: Filip Smola (smola.filip@hotmail.com)
+ */
+
+#include <open-sea/Entity.h>
+#include <open-sea/Components.h>
+#include <open-sea/Systems.h>
+namespace ecs = open_sea::ecs;
+
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+#include <string>
+#include <thread>
+#include <cstdlib>
+
+typedef ecs::TransformationTable::Data TransformationData;
+typedef ecs::ComponentTable<TransformationData> TransformationComponents;
+
+/**
+ * Time the function, reporting the mean time of a repetition
+ *
+ * \param label Label of the measurement
+ * \param repetitions Number of repetitions
+ * \param f Function to time
+ * \return Mean time of a repetition in milliseconds
+ */
+template<typename F>
+double measure(const std::string &label, int repetitions, F f) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repetitions; i++) {
+        f();
+    }
+    const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    const double mean = elapsed.count() / repetitions;
+    std::cout << std::left << std::setw(40) << label << std::right << std::setw(10) << std::fixed
+              << std::setprecision(3) << mean << " ms";
+    return mean;
+}
+
+/**
+ * Create a root transformation record
+ *
+ * \param g Random generator
+ * \return Transformation record
+ */
+TransformationData transformation(std::mt19937 &g) {
+    std::uniform_real_distribution<float> d(-100.0f, 100.0f);
+    TransformationData t{};
+    t.position = glm::vec3(d(g), d(g), d(g));
+    t.orientation = glm::angleAxis(d(g), glm::vec3(0.0f, 1.0f, 0.0f));
+    t.scale = glm::vec3(1.0f);
+    return t;
+}
+
+/**
+ * Create entities from several threads at once, reporting the entities created per second
+ *
+ * \param label Label of the measurement
+ * \param threads Number of threads
+ * \param per_thread Number of entities created by each thread
+ * \param create Function creating an entity from the manager (or a cache of it)
+ */
+template<typename F>
+void measure_creation(const std::string &label, unsigned threads, unsigned per_thread, F create) {
+    ecs::EntityManager manager;
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back([&manager, per_thread, &create]() {
+            ecs::EntityManager::Cache cache(manager);
+            for (unsigned i = 0; i < per_thread; i++) {
+                create(manager, cache);
+            }
+        });
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << std::left << std::setw(40) << label << std::right << std::setw(10) << std::fixed
+              << std::setprecision(2) << threads * per_thread / elapsed.count() / 1e6 << " M/s" << std::endl;
+}
+
+/**
+ * Entry point of the benchmark
+ *
+ * \param argc Number of arguments
+ * \param argv Arguments (optionally the number of entities)
+ * \return Exit code
+ */
+int main(int argc, char **argv) {
+    const unsigned n = argc > 1 ? static_cast<unsigned>(std::strtoul(argv[1], nullptr, 10)) : 1000000;
+    const int repetitions = 20;
+    std::mt19937 g(42);
+
+    TransformationComponents transforms;
+    for (unsigned i = 0; i < n; i++) {
+        transforms.add(ecs::Entity(i, 0), transformation(g));
+    }
+
+    // Thread counts doubling from one, ending with the number of hardware threads
+    const unsigned hardware = std::max(std::thread::hardware_concurrency(), 1u);
+    std::vector<unsigned> counts;
+    for (unsigned t = 1; t < hardware; t *= 2) {
+        counts.push_back(t);
+    }
+    counts.push_back(hardware);
+
+    std::cout << "Entities: " << n << ", hardware threads: " << hardware << std::endl;
+
+    double single = 0.0;
+    for (unsigned threads : counts) {
+        ecs::ThreadPool pool(threads - 1);
+        const double time = measure("parallel_for, " + std::to_string(threads) + " threads", repetitions, [&]() {
+            ecs::parallel_for<0, 1, 2, 3>(pool, transforms, [](const glm::vec3 &p, const glm::quat &o, const glm::vec3 &s, glm::mat4 &m) {
+                m = glm::scale(glm::translate(glm::mat4(1.0f), p) * glm::mat4_cast(o), s);
+            });
+        });
+        if (threads == 1) {
+            single = time;
+        }
+        std::cout << std::setw(10) << std::setprecision(2) << single / time << "x" << std::endl;
+    }
+
+    // Entity creation, with the same number of entities split across the threads
+    for (unsigned threads : counts) {
+        const unsigned per_thread = n / threads;
+        measure_creation("create, " + std::to_string(threads) + " threads", threads, per_thread,
+                         [](ecs::EntityManager &manager, ecs::EntityManager::Cache &) { manager.create(); });
+        measure_creation("create through cache, " + std::to_string(threads) + " threads", threads, per_thread,
+                         [](ecs::EntityManager &, ecs::EntityManager::Cache &cache) { cache.create(); });
+    }
+
+    // Read back a matrix so that the work is not optimised out
+    std::cout << "Checksum: " << transforms.get_copy(ecs::Entity(0, 0)).matrix[3][0] << std::endl;
+    return 0;
+}
@@ -0,0 +1,431 @@
+/** \file Archetype.h
+ * Storage grouping keys by their set of components, keeping all of a key's records at the same index.
+ *
+ * \author Filip Smola
+ */
+#ifndef OPEN_SEA_ARCHETYPE_H
+#define OPEN_SEA_ARCHETYPE_H
+
+#include <open-sea/Table.h>
+
+#include <memory>
+#include <tuple>
+#include <vector>
+#include <unordered_map>
+#include <type_traits>
+#include <utility>
+#include <stdexcept>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+
+namespace open_sea::data {
+    /**
+     * \addtogroup Data
+     *
+     * @{
+     */
+
+    //! Index of type T in the type list Ts (T has to occur in Ts)
+    template<typename T, typename... Ts>
+    struct TypeIndex;
+    template<typename T, typename... Ts>
+    struct TypeIndex<T, T, Ts...> : std::integral_constant<size_t, 0> {};
+    template<typename T, typename U, typename... Ts>
+    struct TypeIndex<T, U, Ts...> : std::integral_constant<size_t, 1 + TypeIndex<T, Ts...>::value> {};
+
+    /** \class ArchetypeStorage
+     * Storage of records of several component types, grouping keys by the set of components they have.
+     *
+     * Keys with the same set of components (an archetype) share one key map and one array of keys, and have a column
+     *  storage per component (see \ref StorageSoA), with each key's records at the same index in all of the columns.
+     * Adding or removing a component moves all of the key's records to the archetype of its new set of components.
+     * Iterating the keys that have some components is then a linear scan over the columns of each matching archetype,
+     *  without looking any keys up.
+     * Compared to a separate table per component (e.g. \ref ecs::ModelTable and \ref ecs::TransformationTable), this
+     *  makes iterating several components at once faster, and adding or removing components slower.
+     *
+     * Example:
+     * ```
+     * ArchetypeStorage<Entity, SparseKeyMap<Entity>, ModelTable::Data, TransformationTable::Data> storage;
+     * storage.add(e, TransformationTable::Data{...});
+     * storage.add(e, ModelTable::Data{3});
+     * storage.for_each<ModelTable::Data, TransformationTable::Data>([](const Entity &e, const ModelTable::Data::Ptr &m, const TransformationTable::Data::Ptr &t){ ... });
+     * ```
+     *
+     * \tparam K Key type
+     * \tparam M Key-index map type
+     * \tparam C Component record types (distinct, at most 64)
+     */
+    template<typename K, typename M, typename... C>
+    class ArchetypeStorage {
+        public:
+            //! Key type
+            typedef K key_t;
+            //! Set of components, with bit `i` set iff the `i`th component type is present
+            typedef uint64_t mask_t;
+            //! Number of component types
+            static constexpr size_t count = sizeof...(C);
+
+            static_assert(count > 0 && count <= 64, "Archetype storage has to have between 1 and 64 component types.");
+
+            //! Storage type holding the records of a component within an archetype
+            template<typename T>
+            using column_t = StorageSoA<T>;
+
+            //! Index of the component type
+            template<typename T>
+            static constexpr size_t index_of = TypeIndex<T, C...>::value;
+
+            //! Set of components holding only the component type
+            template<typename T>
+            static constexpr mask_t component = static_cast<mask_t>(1) << index_of<T>;
+
+            /** \class Archetype
+             * Records of the keys that have exactly the same set of components
+             */
+            class Archetype {
+                private:
+                    //! Set of components
+                    mask_t set;
+                    //! Map of keys to indices to the records
+                    M map{};
+                    //! Keys of the records (i.e. key of the records at index `i` is at index `i`)
+                    std::vector<K> dense_keys{};
+                    //! Columns of the records of each component (left empty for components not in the set)
+                    std::tuple<column_t<C>...> columns{};
+                    //! Number of keys that fit into all of the columns
+                    size_t capacity = 0;
+
+                    //! Apply the function to each column of the archetype
+                    template<typename F, size_t... I>
+                    void visit(F &f, std::index_sequence<I...>) {
+                        (((set >> I) & 1u ? f(std::get<I>(columns)) : void()), ...);
+                    }
+
+                public:
+                    //! Construct an empty archetype of the set of components
+                    explicit Archetype(mask_t set) : set(set) {}
+                    Archetype(const Archetype &other) = delete;
+                    Archetype &operator=(const Archetype &other) = delete;
+
+                    //! Get the set of components
+                    mask_t mask() const { return set; }
+
+                    //! Check whether the archetype has all of the components in the set
+                    bool has(mask_t components) const { return (set & components) == components; }
+
+                    /**
+                     * Get the column of the component
+                     *
+                     * \tparam T Component type (has to be in the set)
+                     * \return Column
+                     */
+                    template<typename T>
+                    column_t<T> &column() { return std::get<index_of<T>>(columns); }
+
+                    /**
+                     * Apply the function to each column of the archetype
+                     *
+                     * \tparam F Function type
+                     * \param f Function taking a reference to a column (of any of the component types)
+                     */
+                    template<typename F>
+                    void for_each_column(F f) { visit(f, std::index_sequence_for<C...>{}); }
+
+                    //! Get the number of keys
+                    size_t size() const { return dense_keys.size(); }
+
+                    //! Get the keys (in the order of the records)
+                    const std::vector<K> &keys() const { return dense_keys; }
+
+                    //! Get the index of the key's records (unset if not present)
+                    opt_index lookup(const K &key) const { return map.find(key); }
+
+                    //! Get the index of the records of a different key that inserting this one would displace
+                    opt_index conflict(const K &key) const { return map.conflict(key); }
+
+                    /**
+                     * Add the key after the current ones, leaving its records to be written into the columns
+                     *
+                     * \param key Key (not present, and not displacing any other key)
+                     * \return Index of the key's records
+                     */
+                    size_t append(const K &key) {
+                        const size_t i = dense_keys.size();
+                        if (i == capacity) {
+                            capacity = std::numeric_limits<size_t>::max();
+                            for_each_column([this, i](auto &c) {
+                                c.grow(i + 1, i);
+                                capacity = std::min(capacity, c.allocated());
+                            });
+                        }
+                        map.insert(key, i);
+                        dense_keys.push_back(key);
+                        return i;
+                    }
+
+                    /**
+                     * Remove the key and its records, moving the last key's records into their place
+                     *
+                     * \param i Index of the key's records
+                     */
+                    void erase(size_t i) {
+                        const K removed = dense_keys[i];
+                        const size_t last = dense_keys.size() - 1;
+                        if (i != last) {
+                            for_each_column([i, last](auto &c) { c.move_record(i, last); });
+                            dense_keys[i] = dense_keys[last];
+                            map.insert(dense_keys[i], i);
+                        }
+                        map.erase(removed);
+                        dense_keys.pop_back();
+                    }
+            };
+
+        private:
+            //! Archetypes (never removed, so indices stay valid)
+            std::vector<std::unique_ptr<Archetype>> archetypes{};
+            //! Map of sets of components to the indices of their archetypes
+            std::unordered_map<mask_t, size_t> by_set{};
+            //! Map of keys to the indices of their archetypes
+            M locations{};
+            //! Number of keys
+            size_t n = 0;
+
+        public:
+            /**
+             * Add the component's record to the key, moving its other records to the archetype of the new set
+             *
+             * \tparam T Component type
+             * \param key Key
+             * \param record Record
+             * \return `true` iff the record was added (i.e. the key didn't have the component yet)
+             */
+            template<typename T>
+            bool add(const K &key, const T &record) {
+                evict_conflict(key);
+
+                opt_index from = locations.find(key);
+                const mask_t set = from.is_set() ? archetypes[from.get()]->mask() : 0;
+                if (set & component<T>) {
+                    return false;
+                }
+
+                const size_t to = archetype(set | component<T>);
+                const size_t i = move(key, from, to);
+                archetypes[to]->template column<T>().write(i, record);
+                return true;
+            }
+
+            /**
+             * Remove the component's record from the key, moving its other records to the archetype of the new set
+             *
+             * \tparam T Component type
+             * \param key Key
+             * \return `true` iff the record was removed (i.e. the key had the component)
+             */
+            template<typename T>
+            bool remove(const K &key) {
+                opt_index from = locations.find(key);
+                if (!from.is_set() || !(archetypes[from.get()]->mask() & component<T>)) {
+                    return false;
+                }
+
+                const mask_t set = archetypes[from.get()]->mask() & ~component<T>;
+                if (set == 0) {
+                    remove(key);
+                } else {
+                    move(key, from, archetype(set));
+                }
+                return true;
+            }
+
+            /**
+             * Remove all of the key's records
+             *
+             * \param key Key
+             * \return `true` iff the key had any records
+             */
+            bool remove(const K &key) {
+                opt_index from = locations.find(key);
+                if (!from.is_set()) {
+                    return false;
+                }
+
+                Archetype &src = *archetypes[from.get()];
+                src.erase(src.lookup(key).get());
+                locations.erase(key);
+                n--;
+                return true;
+            }
+
+            /**
+             * Check whether the key has the component
+             *
+             * \tparam T Component type
+             * \param key Key
+             * \return `true` iff the key has the component
+             */
+            template<typename T>
+            bool has(const K &key) {
+                opt_index at = locations.find(key);
+                return at.is_set() && (archetypes[at.get()]->mask() & component<T>);
+            }
+
+            /**
+             * Get the set of components the key has
+             *
+             * \param key Key
+             * \return Set of components (empty if none)
+             */
+            mask_t components(const K &key) {
+                opt_index at = locations.find(key);
+                return at.is_set() ? archetypes[at.get()]->mask() : 0;
+            }
+
+            /**
+             * Get a reference to the key's record of the component
+             * Invalidated by any change to the key's components (or those of other keys with the same set).
+             *
+             * \tparam T Component type
+             * \param key Key
+             * \return Reference to the record
+             *
+             * \throws std::out_of_range When the key doesn't have the component
+             */
+            template<typename T>
+            typename T::Ptr get(const K &key) {
+                if (!has<T>(key)) {
+                    throw std::out_of_range("No record found for the provided key.");
+                }
+                Archetype &a = *archetypes[locations.find(key).get()];
+                return a.template column<T>().reference(a.lookup(key).get());
+            }
+
+            /**
+             * Apply the function to the records of each archetype that has all of the components, in batches
+             * The references in each batch point to the first record of the archetype, and the other records follow
+             *  contiguously in each member's column (see \ref StorageSoA::increment_reference).
+             *
+             * \tparam T Component types
+             * \tparam F Function type
+             * \param f Function taking a pointer to the batch's keys, the number of records in the batch, and for each
+             *  component a reference to the batch's first record
+             */
+            template<typename... T, typename F>
+            void for_each_batch(F f) {
+                constexpr mask_t set = (component<T> | ... | 0);
+                for (auto &a : archetypes) {
+                    const size_t size = a->size();
+                    if (!a->has(set) || size == 0) {
+                        continue;
+                    }
+                    f(a->keys().data(), size, a->template column<T>().reference(0)...);
+                }
+            }
+
+            /**
+             * Apply the function to the records of each key that has all of the components
+             *
+             * \tparam T Component types
+             * \tparam F Function type
+             * \param f Function taking the key and for each component a reference to its record
+             */
+            template<typename... T, typename F>
+            void for_each(F f) {
+                constexpr mask_t set = (component<T> | ... | 0);
+                for (auto &a : archetypes) {
+                    const size_t size = a->size();
+                    if (!a->has(set) || size == 0) {
+                        continue;
+                    }
+                    for_each_in(f, a->keys().data(), size, std::make_tuple(&a->template column<T>()...),
+                            std::make_tuple(a->template column<T>().reference(0)...), std::index_sequence_for<T...>{});
+                }
+            }
+
+            //! Get the number of keys
+            size_t size() const { return n; }
+
+            //! Get the number of archetypes (including empty ones)
+            size_t archetype_count() const { return archetypes.size(); }
+
+            //! Get the archetype at the index (see \ref archetype_count)
+            Archetype &get_archetype(size_t i) { return *archetypes[i]; }
+
+        private:
+            /**
+             * Get the index of the set's archetype, creating it if necessary
+             *
+             * \param set Set of components (not empty)
+             * \return Index of the archetype
+             */
+            size_t archetype(mask_t set) {
+                auto found = by_set.find(set);
+                if (found != by_set.end()) {
+                    return found->second;
+                }
+                archetypes.push_back(std::make_unique<Archetype>(set));
+                by_set.emplace(set, archetypes.size() - 1);
+                return archetypes.size() - 1;
+            }
+
+            /**
+             * Move the key's records of the destination's components to the destination archetype
+             * Records of components the destination doesn't have are dropped.
+             *
+             * \param key Key
+             * \param from Index of the key's archetype (unset if it has none yet)
+             * \param to Index of the destination archetype
+             * \return Index of the key's records in the destination archetype
+             */
+            size_t move(const K &key, opt_index from, size_t to) {
+                Archetype &dst = *archetypes[to];
+                const size_t i = dst.append(key);
+                if (from.is_set()) {
+                    Archetype &src = *archetypes[from.get()];
+                    const size_t j = src.lookup(key).get();
+                    move_records(src, j, dst, i, std::index_sequence_for<C...>{});
+                    src.erase(j);
+                } else {
+                    n++;
+                }
+                locations.insert(key, to);
+                return i;
+            }
+
+            //! Copy the record at the index of each component in both archetypes
+            template<size_t... I>
+            void move_records(Archetype &src, size_t j, Archetype &dst, size_t i, std::index_sequence<I...>) {
+                ((((src.mask() & dst.mask()) >> I) & 1u ?
+                        dst.template column<C>().write(i, src.template column<C>().read(j)) : void()), ...);
+            }
+
+            //! Apply the function to each of the records, advancing the references through the columns
+            template<typename F, typename Columns, typename Refs, size_t... I>
+            static void for_each_in(F &f, const K *keys, size_t size, Columns columns, Refs refs, std::index_sequence<I...>) {
+                for (size_t i = 0; i < size; i++) {
+                    f(keys[i], std::get<I>(refs)...);
+                    (std::get<I>(columns)->increment_reference(std::get<I>(refs)), ...);
+                }
+            }
+
+            //! Remove the records of any key that inserting this one would displace from the map
+            void evict_conflict(const K &key) {
+                opt_index stale = locations.conflict(key);
+                if (stale.is_set()) {
+                    // Note: copy, because the key's storage gets overwritten by the removal
+                    Archetype &a = *archetypes[stale.get()];
+                    const K stale_key = a.keys()[a.conflict(key).get()];
+                    remove(stale_key);
+                }
+            }
+    };
+
+    /**
+     * @}
+     */
+}
+
+#endif //OPEN_SEA_ARCHETYPE_H
@@ -0,0 +1,152 @@
+/** \file Commands.h
+ * Entity Component System module - Deferred structural commands
+ *
+ * \author Filip Smola
+ */
+#ifndef OPEN_SEA_COMMANDS_H
+#define OPEN_SEA_COMMANDS_H
+
+#include <open-sea/Entity.h>
+#include <open-sea/Log.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <memory>
+#include <vector>
+#include <array>
+#include <mutex>
+#include <atomic>
+
+namespace open_sea::ecs {
+    class ModelTable;
+    class TransformationTable;
+
+    /**
+     * \addtogroup Commands
+     * \brief Deferred structural changes of component managers
+     *
+     * Deferred structural changes of component managers.
+     * Adding or removing records moves other records, which is unsafe while the tables are being iterated (and throws
+     *  while their structure is locked, e.g. during a parallel loop).
+     * Such changes are instead recorded into a command buffer and applied together once the iteration is done.
+     *
+     * @{
+     */
+
+    /** \class CommandBuffer
+     * \brief Records adding and removing components, and applies the changes at once at a sync point
+     *
+     * Commands can be recorded from several threads at the same time.
+     * Each thread records into one of a few shards, so threads rarely wait for each other.
+     *
+     * Flushing applies the commands in batches, in this order:
+     *  1. Transformation removals (with the subtrees, see \ref TransformationTable::remove), then model removals
+     *  2. Transformation additions, in rounds of records whose parents are present, each in batches of siblings
+     *  3. Model additions in a single batch
+     *  4. Adoptions (see \ref TransformationTable::adopt)
+     *
+     * The commands of each kind are sorted by entity, and only the last recorded command of each kind for each entity
+     *  is kept.
+     * Additions and removals of the same component of the same entity are resolved by the order they were recorded in:
+     *  an addition followed by a removal leaves the entity without the component, while a removal followed by an
+     *  addition replaces the component.
+     * Likewise, a transformation addition followed by the removal of its parent (or any further ancestor) is dropped with
+     *  the ancestor's subtree.
+     * Adding a component an entity already has is skipped.
+     * Transformation additions whose parent is not present (even after the other additions) are kept for the next
+     *  flush, and reported with a warning.
+     * They are kept only once: if the parent is still not present after that flush, and its own addition is not kept
+     *  for the next one either, they are dropped with a warning.
+     *
+     * The managers must outlive the buffer.
+     */
+    class CommandBuffer {
+        private:
+            //! Model addition
+            struct ModelAdd {
+                Entity entity;
+                size_t model;
+                uint64_t seq;
+            };
+            //! Transformation addition
+            struct TransformationAdd {
+                Entity entity;
+                glm::vec3 position;
+                glm::quat orientation;
+                glm::vec3 scale;
+                Entity parent;
+                bool has_parent;
+                uint64_t seq;
+                //! Whether the addition was already kept for a flush, waiting for its parent
+                bool retried = false;
+            };
+            //! Removal
+            struct Remove {
+                Entity entity;
+                uint64_t seq;
+            };
+            //! Adoption
+            struct Adopt {
+                Entity entity;
+                Entity parent;
+                bool has_parent;
+                uint64_t seq;
+            };
+
+            /** \struct Shard
+             * \brief Commands recorded by a subset of the threads
+             */
+            struct Shard {
+                //! Mutex guarding the commands
+                std::mutex mutex;
+
+                std::vector<ModelAdd> model_adds;
+                std::vector<Remove> model_removes;
+                std::vector<TransformationAdd> transformation_adds;
+                std::vector<Remove> transformation_removes;
+                std::vector<Adopt> adopts;
+            };
+
+            //! Number of shards (threads are assigned shards by hashing their ID)
+            static constexpr size_t shard_count = 16;
+            //! Shards of recorded commands
+            std::array<Shard, shard_count> shards{};
+            //! Sequence number of the next command (orders commands across shards)
+            std::atomic<uint64_t> next_seq{0};
+            //! Logger for this buffer
+            log::severity_logger lg = log::get_logger("Command Buffer");
+
+            //! Model component manager
+            std::shared_ptr<ModelTable> models;
+            //! Transformation component manager
+            std::shared_ptr<TransformationTable> transformations;
+
+            Shard &shard();
+
+        public:
+            CommandBuffer(std::shared_ptr<ModelTable> models, std::shared_ptr<TransformationTable> transformations);
+            CommandBuffer(const CommandBuffer &other) = delete;
+            CommandBuffer &operator=(const CommandBuffer &other) = delete;
+
+            // Recording
+            void add_model(const Entity &e, size_t model);
+            void remove_model(const Entity &e);
+            void add_transformation(const Entity &e, const glm::vec3 &position, const glm::quat &orientation, const glm::vec3 &scale);
+            void add_transformation(const Entity &e, const glm::vec3 &position, const glm::quat &orientation, const glm::vec3 &scale, const Entity &parent);
+            void remove_transformation(const Entity &e);
+            void adopt(const Entity &e);
+            void adopt(const Entity &e, const Entity &parent);
+
+            size_t size();
+            void clear();
+
+            void flush();
+    };
+
+    /**
+     * @}
+     */
+}
+
+#endif //OPEN_SEA_COMMANDS_H
@@ -16,6 +16,7 @@
 
 #include <memory>
 #include <unordered_map>
+#include <vector>
 
 // Forward declarations
 namespace open_sea::model {
@@ -33,6 +34,26 @@ namespace open_sea::ecs {
     //! Default starting size of component managers
     constexpr unsigned default_size = 1;
 
+    //! Default number of records checked by each garbage collection of a component manager (see \ref ModelTable::gc)
+    constexpr size_t gc_sweep_budget = 256;
+
+    //! Layout policy of component manager tables (one of \ref data::AoSLayout, \ref data::SoALayout, ...)
+    // Note: adaptive, so that each table switches between AoS and SoA depending on how the game accesses it
+    typedef data::AdaptiveLayout component_layout;
+
+    //! Allocation policy of component manager tables (mapped, so growing tables remap instead of copying)
+    typedef data::MappedAllocation component_allocation;
+
+    //! Key map type of component manager tables (dense or sparse, chosen by each manager at construction)
+    typedef data::SelectKeyMap<Entity> component_key_map;
+
+    //! Table type used by component managers to store records of type R under entities
+    // Note: concrete type selected at compile time, so that calls on the table can be inlined
+    template<typename R>
+    using ComponentTable = component_layout::table<Entity, R, component_key_map, component_allocation>;
+
+    class OwningGroup;
+
     /** \class ModelTable
      * \brief Associates a model with the entity
      *
@@ -58,19 +79,44 @@ namespace open_sea::ecs {
             log::severity_logger lg = log::get_logger("Model Component Manager (Table)");
             //! Models used by components in this manager
             std::vector<std::shared_ptr<model::Model>> models;
+            //! Counts of the table's operations when last recorded with the profiler
+            data::TableStats counted_stats{};
+            //! Position in the entity manager's destroyed stream up to which dead records were removed
+            uint64_t destroyed_cursor = 0;
+            //! Number of records before the next one to be checked by the garbage collection sweep
+            size_t sweep_cursor = 0;
+            //! Entities whose records are being removed by garbage collection (kept to reuse its memory)
+            std::vector<Entity> dead;
+            //! Flags of the records being removed by compacting the table (kept to reuse its memory)
+            std::vector<bool> marked;
+            //! Entities being added, without those that already have a record (kept to reuse its memory)
+            std::vector<Entity> added_keys;
+            //! Records being added, parallel to the entities (kept to reuse its memory)
+            std::vector<Data> added_records;
+            //! Entities whose records are evicted by an addition (kept to reuse its memory)
+            std::vector<Entity> evicted;
         public:
+            //! Type of the table holding the components
+            typedef ComponentTable<Data> table_t;
             //! Table holding the components
-            std::unique_ptr<data::Table<Entity, Data>> table;
+            std::unique_ptr<table_t> table;
+            //! Group owning the table's records (if any, set by the group)
+            OwningGroup *group = nullptr;
 
             ModelTable() : ModelTable(default_size) {}
-            explicit ModelTable(unsigned size);
+            explicit ModelTable(unsigned size, data::KeyDensity density = data::KeyDensity::dense);
+
+            bool add(const Entity &key, size_t model);
+            bool add(const Entity *keys, const size_t *models, size_t count);
+            size_t remove(const Entity *keys, size_t count);
 
             size_t model_to_index(const std::shared_ptr<model::Model>& model);
             std::shared_ptr<model::Model> get_model(size_t i) const;
             std::shared_ptr<model::Model> get_model(Entity e) const;
             bool remove_model(size_t i);
 
-            void gc(const EntityManager &manager);
+            void gc(const EntityManager &manager, size_t budget = gc_sweep_budget);
+            void count_stats();
 
             void show_debug() override;
             int query_idx_gen[2] {0, 0};
@@ -91,8 +137,14 @@ namespace open_sea::ecs {
      * Caches the transformation matrix relative to global origin.
      * Any transformation recomputes the matrix of the transformed entity and recursively all its descendants.
      */
-    // Note: only time when indices can change is on removal of a record (last item gets moved), so using opt_index for
-    //          the tree structure fields is safe as long as the affected ones get adjusted on removal
+    // Note: indices of records change on:
+    //          - removal (single removals move the last record into the hole, batches compact the table), including
+    //             the removal of stale records evicted by adds (reused entity indices) and by garbage collection,
+    //          - swap, permute and sort_by_depth,
+    //          - OwningGroup maintenance (swaps on added and removing, a permutation on rebuild, so also whenever a
+    //             group is created or records enter or leave it).
+    //       Switching the table's layout keeps them. Using opt_index for the tree structure fields is therefore only
+    //          safe as long as each of these adjusts the links of the affected records (see swap and remap_links).
     //TODO a lot of the structure-preserving algorithms could probably be done better
     class TransformationTable : public debug::Debuggable {
         public:
@@ -101,6 +153,8 @@ namespace open_sea::ecs {
              */
             struct Data {
                 static constexpr size_t count = 8;
+                //! Members kept together in blocks by \ref data::AoSoALayout (transformations and matrix, not tree links)
+                static constexpr uint64_t simd_members = 0b1111u;
                 struct Ptr {
                     glm::vec3 *position = nullptr;
                     glm::quat *orientation = nullptr;
@@ -132,12 +186,34 @@ namespace open_sea::ecs {
         private:
             //! Logger for this manager
             log::severity_logger lg = log::get_logger("Transformation Component Manager (Table)");
+            //! Counts of the table's operations when last recorded with the profiler
+            data::TableStats counted_stats{};
+            //! Position in the entity manager's destroyed stream up to which dead records were removed
+            uint64_t destroyed_cursor = 0;
+            //! Number of records before the next one to be checked by the garbage collection sweep
+            size_t sweep_cursor = 0;
+            //! Entities whose records are being removed by garbage collection (kept to reuse its memory)
+            std::vector<Entity> dead;
+            //! Entities of the subtrees being removed (kept to reuse its memory)
+            std::vector<Entity> subtree;
+            //! Indices of the records whose links are being updated by a swap (kept to reuse its memory)
+            std::vector<size_t> affected;
+            //! Flags of the records being removed by compacting the table (kept to reuse its memory)
+            std::vector<bool> marked;
+            //! Indices of the marked records whose children are still to be marked (kept to reuse its memory)
+            std::vector<size_t> pending;
+            //! New index of each record after compacting the table (kept to reuse its memory)
+            std::vector<size_t> remap;
         public:
+            //! Type of the table holding the components
+            typedef ComponentTable<Data> table_t;
             //! Table holding the components
-            std::unique_ptr<data::Table<Entity, Data>> table;
+            std::unique_ptr<table_t> table;
+            //! Group owning the table's records (if any, set by the group)
+            OwningGroup *group = nullptr;
 
             TransformationTable() : TransformationTable(default_size) {}
-            explicit TransformationTable(unsigned size);
+            explicit TransformationTable(unsigned size, data::KeyDensity density = data::KeyDensity::dense);
 
 
             // Structure preserving table modifiers
@@ -145,12 +221,16 @@ namespace open_sea::ecs {
             bool add(const Entity *keys, const glm::vec3 *position, const glm::quat *orientation, const glm::vec3 *scale, data::opt_index parent, size_t count);
             bool remove(data::opt_index idx);
             bool remove(const Entity &key);
+            size_t remove(const Entity *keys, size_t count);
             void adopt(const Entity &e, data::opt_index parent = {});
             void update_matrix(data::opt_index idx, bool siblings = false);
             void update_matrix(Entity e, bool siblings = false);
+            void sort_by_depth();
+            void permute(const std::vector<size_t> &order);
+            void swap(data::opt_index a, data::opt_index b);
 
             // Transformations
-            // Note: these each update both the relevant value and the matrix
+            // Note: these each update both the relevant value and the matrix, and record the changes in the table
             void translate(Entity *e, glm::vec3 *delta, size_t count);
             void rotate(Entity *e, glm::quat *delta, size_t count);
             void scale(Entity *e, glm::vec3 *delta, size_t count);
@@ -172,8 +252,56 @@ namespace open_sea::ecs {
             glm::vec3 query_sca_fac{};
             void show_query();
 
-            void gc(const EntityManager &manager);
+            void gc(const EntityManager &manager, size_t budget = gc_sweep_budget);
+            void count_stats();
             ~TransformationTable() override = default;
+
+        private:
+            void unlink(size_t idx);
+            void take_subtree(size_t idx, std::vector<Entity> &dest);
+            bool erase(const Entity &key);
+            void mark_subtree(size_t idx);
+            size_t remove_marked();
+            size_t remove_ungrouped();
+            void remap_links(const std::vector<size_t> &new_index);
+            data::opt_index evict_conflicts(const Entity *keys, size_t count, data::opt_index keep);
+    };
+
+    /** \class OwningGroup
+     * \brief Keeps the records of entities with both a model and a transformation at the same index in both tables
+     *
+     * The records of such entities are packed at the front of both tables in the same order, so systems using both
+     *  components (e.g. rendering) can walk the two tables in lockstep without looking any keys up.
+     * The group registers itself with both managers, which then keep it up to date when adding and removing records.
+     * Therefore the tables must not be modified directly (bypassing the managers) while grouped.
+     */
+    class OwningGroup {
+        private:
+            //! Grouped model manager
+            std::shared_ptr<ModelTable> model_mgr;
+            //! Grouped transformation manager
+            std::shared_ptr<TransformationTable> transform_mgr;
+            //! Number of grouped entities
+            size_t n = 0;
+
+        public:
+            OwningGroup(std::shared_ptr<ModelTable> model_mgr, std::shared_ptr<TransformationTable> transform_mgr);
+            OwningGroup(const OwningGroup &other) = delete;
+            OwningGroup &operator=(const OwningGroup &other) = delete;
+
+            //! Get number of grouped entities
+            size_t size() const { return n; }
+            bool contains(const Entity &e) const;
+
+            // Maintenance (called by the managers)
+            void added(const Entity &e);
+            void removing(const Entity &e);
+            void rebuild();
+
+            template<typename F>
+            void for_each(F f);
+
+            ~OwningGroup();
     };
 
     /**
@@ -193,4 +321,30 @@ SOA_MEMBER(open_sea::ecs::TransformationTable::Data, 5, open_sea::data::opt_inde
 SOA_MEMBER(open_sea::ecs::TransformationTable::Data, 6, open_sea::data::opt_index, next_sibling)
 SOA_MEMBER(open_sea::ecs::TransformationTable::Data, 7, open_sea::data::opt_index, prev_sibling)
 
+namespace open_sea::ecs {
+    /**
+     * \brief Apply the function to each grouped entity's components
+     *
+     * Walks the front of both tables in lockstep.
+     * The function must not add or remove any records.
+     *
+     * \tparam F Function type
+     * \param f Function taking references to the entity's model and transformation records
+     */
+    template<typename F>
+    void OwningGroup::for_each(F f) {
+        if (n == 0) {
+            return;
+        }
+
+        ModelTable::Data::Ptr model = model_mgr->table->get_reference();
+        TransformationTable::Data::Ptr transform = transform_mgr->table->get_reference();
+        for (size_t i = 0; i < n; i++) {
+            f(model, transform);
+            model_mgr->table->increment_reference(model);
+            transform_mgr->table->increment_reference(transform);
+        }
+    }
+}
+
 #endif //OPEN_SEA_COMPONENTS_H
@@ -11,8 +11,10 @@
 #include <open-sea/Debuggable.h>
 
 #include <vector>
+#include <array>
+#include <atomic>
+#include <memory>
 #include <cstdint>
-#include <queue>
 
 //! %Entity Component System namespace
 namespace open_sea::ecs {
@@ -69,32 +71,122 @@ namespace open_sea::ecs {
      * Manages which entities are alive by keeping a record of the generation at each index.
      * Only reuses indices (incrementing the generation) when there is a certain number available, thus spreading the
      *  index use more evenly and making full handle reuse less likely.
+     *
+     * Creating, killing and checking entities is thread-safe and lock-free, so worker jobs can spawn entities directly.
+     * Fresh indices are reserved by incrementing an atomic counter, and freed indices wait in a lock-free queue.
+     * Generations and the queue are stored in pages allocated on first use, so that neither ever has to move.
+     * Threads creating many entities should do so through a \ref Cache, which reserves indices in batches.
+     * Creating or killing entities in bulk claims whole runs of the queue (and of fresh indices) at once.
+     *
+     * Killed entities are also appended to a stream of destroyed entities (a ring of the last
+     *  \ref destroyed_capacity), which component managers read at their own pace to remove the dead entities' records
+     *  (see \ref destroyed_since).
      */
     class EntityManager : public debug::Debuggable {
+        public:
+            //! Maximum number of indices
+            static constexpr size_t max_indices = static_cast<size_t>(1) << entity_index_bits;
+            //! Number of entries in a page of generations or of the free index queue
+            static constexpr size_t page_entries = 4096;
+            //! Number of pages covering all indices
+            static constexpr size_t page_count = max_indices / page_entries;
+            //! Number of most recently destroyed entities kept in the destroyed stream
+            static constexpr size_t destroyed_capacity = static_cast<size_t>(1) << 16;
+
         private:
-            //! Record of currently living (or the next one to live if none alive) generation in an index
-            std::vector<uint16_t> generation;
-            //! Queue of indices with latest generation dead
-            std::queue<unsigned> freeIndices;
+            /** \struct FreeSlot
+             * \brief Slot of the free index queue
+             */
+            struct FreeSlot {
+                //! Sequence number of the slot, less the slot's position in the queue (so that zero is the initial state)
+                std::atomic<uint64_t> sequence{0};
+                //! Freed index (only meaningful while the slot is filled)
+                unsigned index = 0;
+            };
+
+            //! Pages of the record of currently living (or the next one to live if none alive) generation in an index
+            std::array<std::atomic<std::atomic<uint16_t> *>, page_count> generation{};
+            //! Next index never used before
+            std::atomic<uint64_t> next_index{0};
+            //! Pages of the queue of indices with latest generation dead (bounded, holds every index at most once)
+            std::array<std::atomic<FreeSlot *>, page_count> free_slots{};
+            //! Position in the free index queue of the next index to reuse
+            std::atomic<uint64_t> free_head{0};
+            //! Position in the free index queue of the next index to free
+            std::atomic<uint64_t> free_tail{0};
+            //! Ring of destroyed entities, each slot holding the lower half of its stream position plus one (upper 32 bits) and the handle (lower 32 bits)
+            std::unique_ptr<std::atomic<uint64_t>[]> destroyed = std::make_unique<std::atomic<uint64_t>[]>(destroyed_capacity);
+            //! Number of entities ever appended to the destroyed stream
+            std::atomic<uint64_t> destroyed_tail{0};
             //! Logger for this manager
             log::severity_logger lg = log::get_logger("Entity Manager");
+
+            template<typename T>
+            static T *page(std::array<std::atomic<T *>, page_count> &pages, size_t i);
+            std::atomic<uint16_t> *generation_at(unsigned index) const;
+            FreeSlot &free_slot(uint64_t pos);
+            size_t free_size() const;
+            void push_free(const unsigned *indices, unsigned count);
+            unsigned pop_free(unsigned *dest, unsigned count);
+            template<typename F>
+            unsigned reserve(unsigned count, F emit);
+            Entity activate(unsigned index);
+            bool retire(Entity e);
+            void append_destroyed(const Entity *entities, unsigned count);
+
         public:
             // Debug info
             //! Number of entities alive
-            unsigned living_entities = 0;
+            std::atomic<unsigned> living_entities{0};
             //! Maximum current generation
-            uint16_t  max_generation = 0;
+            std::atomic<uint16_t> max_generation{0};
             //! Maximum current index
-            unsigned max_index = 0;
+            std::atomic<unsigned> max_index{0};
 
             //! Minimum number of free indices in the queue before reusing from the queue
             // This means reuse of indices will be much more spread out and IDs will reappear much more rarely
             static constexpr unsigned minimum_free_indices = 1024;
 
+            /** \class Cache
+             * \brief Per-thread cache of indices reserved for creating entities
+             *
+             * Reserves indices from the manager in batches, so that creating an entity usually touches no shared state
+             *  except the debug counters.
+             * Each thread creating entities should use its own cache (e.g. one per worker job).
+             * Indices left unused are returned to the manager when the cache is destroyed.
+             */
+            class Cache {
+                private:
+                    //! Manager the indices are reserved from
+                    EntityManager &manager;
+                    //! Reserved indices not used yet (used from the back)
+                    std::vector<unsigned> reserved{};
+
+                public:
+                    //! Number of indices reserved at once
+                    static constexpr unsigned batch = 64;
+
+                    explicit Cache(EntityManager &manager);
+                    Cache(const Cache &other) = delete;
+                    Cache &operator=(const Cache &other) = delete;
+                    ~Cache();
+
+                    Entity create();
+            };
+
+            EntityManager() = default;
+            EntityManager(const EntityManager &other) = delete;
+            EntityManager &operator=(const EntityManager &other) = delete;
+            ~EntityManager() override;
+
             Entity create();
             void create(Entity* dest, unsigned count);
             bool alive(Entity e) const;
             void kill(Entity e);
+            void kill(const Entity *entities, unsigned count);
+
+            uint64_t destroyed_position() const;
+            bool destroyed_since(uint64_t &cursor, std::vector<Entity> &dest) const;
 
             void show_debug() override;
     };
@@ -12,6 +12,7 @@
 #include <vector>
 #include <memory>
 #include <ostream>
+#include <cstdint>
 
 //! Runtime profiler
 namespace open_sea::profiler {
@@ -46,14 +47,29 @@ namespace open_sea::profiler {
     //! Frame track type
     typedef data::Track<Info> track;
 
+    /** \struct Count
+     * \brief Named count recorded during a frame
+     * Named count recorded during a frame (e.g. of operations on a table), kept alongside the frame's track.
+     */
+    struct Count {
+        //! Label
+        std::string label;
+        //! Counted value
+        uint64_t value;
+    };
+
     void start();
     void finish();
 
     void push(const std::string &label);
     void pop();
 
+    void count(const std::string &label, uint64_t value);
+
     std::shared_ptr<track> get_last();
     std::shared_ptr<track> get_maximum();
+    const std::vector<Count> &get_last_counts();
+    const std::vector<Count> &get_maximum_counts();
     void clear_maximum();
 
     void show_text();
@@ -0,0 +1,262 @@
+/** \file Query.h
+ * Queries matching records associated with the same keys across several tables.
+ *
+ * \author Filip Smola
+ */
+#ifndef OPEN_SEA_QUERY_H
+#define OPEN_SEA_QUERY_H
+
+#include <open-sea/Table.h>
+
+#include <array>
+#include <tuple>
+#include <vector>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <cstdint>
+
+namespace open_sea::data {
+    /**
+     * \addtogroup Data
+     *
+     * @{
+     */
+
+    /** \class Query
+     * Query of records associated with the same keys across several tables.
+     *
+     * Matches the keys that have a record in all of the included tables, and have no record in any of the excluded
+     *  tables (see \ref without).
+     * Matching goes through the keys of the smallest included table and looks each one up in the other tables, which
+     *  is cheap with \ref SparseKeyMap.
+     * The matched keys and their indices in each included table are cached, and matched again only once the structure
+     *  version (see \ref Table::version) of any of the tables changes.
+     * The tables have to outlive the query.
+     *
+     * Example:
+     * ```
+     * Query<ModelTable::table_t, TransformationTable::table_t> query(*model_mgr->table, *transform_mgr->table);
+     * query.for_each([](const Entity &e, const ModelTable::Data::Ptr &m, const TransformationTable::Data::Ptr &t){ ... });
+     * ```
+     *
+     * \tparam T Types of the included tables (each either \ref Table or an implementation, all with the same key type)
+     */
+    template<typename... T>
+    class Query {
+        public:
+            static_assert(sizeof...(T) > 0, "Query has to include at least one table.");
+
+            //! Key type
+            typedef typename std::tuple_element<0, std::tuple<T...>>::type::key_t key_t;
+            //! Number of included tables
+            static constexpr size_t count = sizeof...(T);
+
+            static_assert((std::is_same_v<key_t, typename T::key_t> && ...), "Queried tables have to share the key type.");
+
+        private:
+            //! Included tables
+            std::tuple<T *...> tables;
+
+            //! Excluded table (type-erased to presence check and structure version)
+            struct Excluded {
+                //! Check whether the table has a record associated with the key
+                std::function<bool(const key_t &)> contains;
+                //! Get the table's structure version
+                std::function<uint64_t()> version;
+            };
+            //! Excluded tables
+            std::vector<Excluded> excluded{};
+
+            //! Structure versions of the tables when last matched (included followed by excluded)
+            std::vector<uint64_t> versions{};
+            //! Whether the match has been computed at all
+            bool matched = false;
+            //! Matched keys
+            std::vector<key_t> matched_keys{};
+            //! Indices of the matched records in each included table (parallel to the matched keys)
+            std::array<std::vector<size_t>, count> matched_indices{};
+
+        public:
+            /**
+             * Construct a query over the included tables
+             *
+             * \param tables Included tables
+             */
+            explicit Query(T &... tables) : tables(&tables...) {}
+
+            /**
+             * Exclude keys that have a record in the table
+             *
+             * \tparam U Table type
+             * \param table Excluded table (has to outlive the query)
+             * \return This query
+             */
+            template<typename U>
+            Query &without(U &table) {
+                static_assert(std::is_same_v<key_t, typename U::key_t>, "Queried tables have to share the key type.");
+                excluded.push_back(Excluded{
+                        [&table](const key_t &key) { return table.lookup(key).is_set(); },
+                        [&table]() { return table.version(); }
+                });
+                matched = false;
+                return *this;
+            }
+
+            /**
+             * Get the matched keys, matching them again first if any table's structure changed
+             *
+             * \return Matched keys
+             */
+            const std::vector<key_t> &keys() {
+                refresh();
+                return matched_keys;
+            }
+
+            /**
+             * Get the number of matched keys, matching them again first if any table's structure changed
+             *
+             * \return Number of matched keys
+             */
+            size_t size() {
+                refresh();
+                return matched_keys.size();
+            }
+
+            /**
+             * Apply the function to the matched records in batches
+             * References are resolved from the cached indices, without looking the keys up again.
+             *
+             * \tparam F Function type
+             * \param f Function taking a pointer to the batch's keys, the number of records in the batch, and for each
+             *  included table a pointer to the batch's references to its records
+             */
+            template<typename F>
+            void for_each_batch(F f) {
+                refresh();
+                for_each_batch(f, std::index_sequence_for<T...>{});
+            }
+
+            /**
+             * Apply the function to each matched record
+             *
+             * \tparam F Function type
+             * \param f Function taking the key and for each included table a reference to its record
+             */
+            template<typename F>
+            void for_each(F f) {
+                for_each_batch([&f](const key_t *keys, size_t batch, const typename T::record_ptr_t *... refs) {
+                    for (size_t i = 0; i < batch; i++) {
+                        f(keys[i], refs[i]...);
+                    }
+                });
+            }
+
+        private:
+            //! Collect the current structure versions of all the tables
+            std::vector<uint64_t> current_versions() const {
+                std::vector<uint64_t> result;
+                result.reserve(count + excluded.size());
+                std::apply([&result](auto *... t) { (result.push_back(t->version()), ...); }, tables);
+                for (const auto &ex : excluded) {
+                    result.push_back(ex.version());
+                }
+                return result;
+            }
+
+            //! Match the keys again iff not matched yet or any table's structure changed
+            void refresh() {
+                std::vector<uint64_t> current = current_versions();
+                if (matched && current == versions) {
+                    return;
+                }
+                match();
+                versions = std::move(current);
+                matched = true;
+            }
+
+            //! Match the keys
+            void match() {
+                matched_keys.clear();
+                for (auto &indices : matched_indices) {
+                    indices.clear();
+                }
+
+                // Find the smallest included table
+                size_t sizes[count];
+                size_t j = 0;
+                std::apply([&sizes, &j](auto *... t) { ((sizes[j++] = t->size()), ...); }, tables);
+                const size_t smallest = std::min_element(sizes, sizes + count) - sizes;
+
+                // Go through its keys
+                const std::vector<key_t> &candidates = key_list(smallest, std::index_sequence_for<T...>{});
+                for (const key_t &key : candidates) {
+                    // Look the key up in the included tables
+                    opt_index found[count];
+                    if (!lookup_all(key, found, std::index_sequence_for<T...>{})) {
+                        continue;
+                    }
+
+                    // Check the key is absent from the excluded tables
+                    bool absent = true;
+                    for (const auto &ex : excluded) {
+                        if (ex.contains(key)) {
+                            absent = false;
+                            break;
+                        }
+                    }
+                    if (!absent) {
+                        continue;
+                    }
+
+                    // Record the match
+                    matched_keys.push_back(key);
+                    for (size_t i = 0; i < count; i++) {
+                        matched_indices[i].push_back(found[i].get());
+                    }
+                }
+            }
+
+            //! Get keys of the Ith included table
+            template<size_t... I>
+            const std::vector<key_t> &key_list(size_t index, std::index_sequence<I...>) const {
+                const std::vector<key_t> *result = nullptr;
+                ((I == index ? (result = &std::get<I>(tables)->keys(), 0) : 0), ...);
+                return *result;
+            }
+
+            //! Look the key up in all the included tables, returning `true` iff it is present in all of them
+            template<size_t... I>
+            bool lookup_all(const key_t &key, opt_index *found, std::index_sequence<I...>) const {
+                return ((found[I] = std::get<I>(tables)->lookup(key)).is_set() && ...);
+            }
+
+            //! Resolve references in batches and apply the function to each batch
+            template<typename F, size_t... I>
+            void for_each_batch(F &f, std::index_sequence<I...>) {
+                std::tuple<std::array<typename T::record_ptr_t, lookup_batch>...> refs;
+                const size_t n = matched_keys.size();
+                for (size_t done = 0; done < n; done += lookup_batch) {
+                    const size_t batch = std::min(lookup_batch, n - done);
+                    (resolve<I>(std::get<I>(refs).data(), done, batch), ...);
+                    f(matched_keys.data() + done, batch, std::get<I>(refs).data()...);
+                }
+            }
+
+            //! Resolve references to a batch of matched records in the Ith included table
+            template<size_t I>
+            void resolve(typename std::tuple_element<I, std::tuple<T...>>::type::record_ptr_t *dest, size_t offset, size_t batch) {
+                auto *table = std::get<I>(tables);
+                const size_t *indices = matched_indices[I].data() + offset;
+                for (size_t i = 0; i < batch; i++) {
+                    dest[i] = table->get_reference(opt_index(indices[i]));
+                }
+            }
+    };
+
+    /**
+     * @}
+     */
+}
+
+#endif //OPEN_SEA_QUERY_H
@@ -44,6 +44,12 @@ namespace open_sea::render {
      * \brief Renderer using untextured models
      */
     class UntexturedRenderer : public debug::Debuggable {
+        private:
+            //! Cached query of entities with both model and transformation components (defined in implementation)
+            struct Drawable;
+            //! Drawable entities
+            std::unique_ptr<Drawable> drawable;
+
         public:
             //! Model component manager
             std::shared_ptr<ecs::ModelTable> model_mgr{};
@@ -67,8 +73,10 @@ namespace open_sea::render {
                 unsigned vertex_count = 0;
             };
             void render(std::shared_ptr<gl::Camera> camera, ecs::Entity* e, unsigned count);
+            void render(std::shared_ptr<gl::Camera> camera);
 
             void show_debug() override;
+            ~UntexturedRenderer() override;
     };
 
     /**
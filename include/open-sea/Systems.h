@@ -7,8 +7,17 @@
 #define OPEN_SEA_SYSTEMS_H
 
 #include <open-sea/Debuggable.h>
+#include <open-sea/Table.h>
 
 #include <memory>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+#include <algorithm>
 
 namespace open_sea::ecs {
     /**
@@ -21,6 +30,136 @@ namespace open_sea::ecs {
      * @{
      */
 
+    /** \class ThreadPool
+     * \brief Pool of worker threads running batches of tasks
+     *
+     * Each batch of tasks is shared between the workers and the calling thread, which returns once all the tasks are
+     *  done.
+     * Tasks are handed out one at a time from a shared counter, so uneven tasks balance out across the threads.
+     * Running a batch from within a task runs it on the task's thread alone.
+     */
+    class ThreadPool {
+        private:
+            //! Worker threads
+            std::vector<std::thread> workers;
+
+            //! Mutex serialising batches run from different threads
+            std::mutex running;
+            //! Mutex guarding the batch state
+            std::mutex mutex;
+            //! Signalled when a batch starts or the pool stops
+            std::condition_variable wake;
+            //! Signalled when the last worker finishes its part of a batch
+            std::condition_variable done;
+
+            //! Task of the current batch
+            const std::function<void(size_t)> *task = nullptr;
+            //! Number of tasks in the current batch
+            size_t task_count = 0;
+            //! Index of the next task to hand out
+            std::atomic<size_t> next{0};
+            //! Number of workers still working on the current batch
+            size_t active = 0;
+            //! Number of the current batch (workers compare it to the last batch they worked on)
+            uint64_t batch = 0;
+            //! First exception thrown by a task of the current batch
+            std::exception_ptr error{};
+            //! Whether the workers should stop
+            bool stopping = false;
+
+            void work();
+            void drain();
+
+        public:
+            explicit ThreadPool(unsigned threads = std::max(std::thread::hardware_concurrency(), 1u) - 1);
+            ThreadPool(const ThreadPool &other) = delete;
+            ThreadPool &operator=(const ThreadPool &other) = delete;
+
+            //! Get number of threads running the tasks (the workers and the calling thread)
+            size_t size() const { return workers.size() + 1; }
+
+            void run(size_t count, const std::function<void(size_t)> &f);
+
+            ~ThreadPool();
+    };
+
+    ThreadPool &thread_pool();
+
+    //! Chunks of parallel loops hold a multiple of this many records (so chunks of aligned columns start on cache lines)
+    constexpr size_t chunk_granularity = data::column_alignment;
+
+    //! Number of chunks per thread in parallel loops (more chunks balance uneven work better)
+    constexpr size_t chunks_per_thread = 4;
+
+    /**
+     * \brief Run the kernel over chunks of the table's records on the thread pool
+     *
+     * The records are split into chunks (see \ref data::View::chunks) with sizes multiple of \ref chunk_granularity.
+     * The table's structure is locked for the duration (see \ref data::Table::lock_structure), so adding, removing or
+     *  moving records (from any thread) throws instead of invalidating the column pointers.
+     * The kernel runs concurrently on different chunks, so it may only write the members of its chunk's records.
+     *
+     * Example:
+     * ```
+     * parallel_for_chunks<0, 3>(thread_pool(), *table, [](size_t count, size_t stride, glm::vec3 *p, glm::mat4 *m){ ... });
+     * ```
+     *
+     * \tparam N Indices of the members passed to the kernel
+     * \tparam T Table type
+     * \tparam F Kernel type
+     * \param pool Thread pool
+     * \param table Table
+     * \param kernel Function taking the number of records in the chunk, the stride of the chunk (distance in bytes
+     *  between values of consecutive records, 0 when packed) and pointers to the selected members of its first record
+     *
+     * \throws std::logic_error When the table's structure is changed during the loop
+     */
+    template<size_t... N, typename T, typename F>
+    void parallel_for_chunks(ThreadPool &pool, T &table, F kernel) {
+        data::StructureLock<T> lock(table);
+
+        // Split into roughly equal chunks, a few for each thread
+        const size_t per_chunk = table.size() / (pool.size() * chunks_per_thread) + 1;
+        const auto chunks = data::View<T, N...>(table).chunks(data::align_up(per_chunk, chunk_granularity));
+
+        pool.run(chunks.size(), [&chunks, &kernel](size_t i) {
+            std::apply([&](auto *... firsts) { kernel(chunks[i].count, chunks[i].stride, firsts...); }, chunks[i].firsts);
+        });
+    }
+
+    /**
+     * \brief Apply the function to each record of the table on the thread pool
+     *
+     * Same as \ref parallel_for_chunks, but applies the function to the selected members of each record.
+     * The function runs concurrently on different records, so it may only write the members of its record.
+     *
+     * Example:
+     * ```
+     * parallel_for<0>(thread_pool(), *table, [](glm::vec3 &position){ ... });
+     * ```
+     *
+     * \tparam N Indices of the members passed to the function
+     * \tparam T Table type
+     * \tparam F Function type
+     * \param pool Thread pool
+     * \param table Table
+     * \param f Function taking references to the selected members (in the order of `N`)
+     *
+     * \throws std::logic_error When the table's structure is changed during the loop
+     */
+    template<size_t... N, typename T, typename F>
+    void parallel_for(ThreadPool &pool, T &table, F f) {
+        data::StructureLock<T> lock(table);
+
+        // Split into roughly equal chunks, a few for each thread
+        const size_t per_chunk = table.size() / (pool.size() * chunks_per_thread) + 1;
+        const auto chunks = data::View<T, N...>(table).chunks(data::align_up(per_chunk, chunk_granularity));
+
+        pool.run(chunks.size(), [&chunks, &f](size_t i) {
+            data::View<T, N...>::apply(chunks[i], f);
+        });
+    }
+
     /**
      * @}
      */
@@ -7,15 +7,29 @@
 #define OPEN_SEA_TABLE_H
 
 #include <open-sea/Util.h>
+#include <open-sea/config.h>
 
 #include <memory>
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <functional>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <stdlib.h>
 
-//TODO if performance degrades due to removing, can add inverse key-index map to speed up last's key lookup
-
 // Note: These currently don't support non-trivial data (e.g. shared_ptr) in records. This is because the space is
 //  uninitialised after allocation and modifications aren't too careful about objects being moved around. For example,
 //  with shared pointers this causes a segfault as the new pointer tries to interact with the uninitialised data in its
@@ -65,651 +79,968 @@ namespace open_sea::data {
             friend bool operator!=(const opt_index &lhs, const opt_index &rhs) { return !(rhs == lhs); }
     };
 
-    /** \class Table
-     * Stores records associated with keys.
+    //! Maximum number of keys resolved by a single batched key map lookup (one bit per key in the miss mask)
+    constexpr size_t lookup_batch = 64;
+
+    /** \class HashKeyMap
+     * \brief Key-index map backed by a hash map
+     *
+     * Maps keys to indices using `std::unordered_map`.
+     * Works with any hashable key type, but every access hashes the key and follows a heap-allocated node.
      *
      * \tparam K Key type
-     * \tparam R Record type
      */
-    template<typename K, typename R>
-    class Table {
-        public:
-            //! Key type
-            typedef K key_t;
-            //! Record type
-            typedef R record_t;
-            //! Record pointer type (struct of pointers to members of R)
-            typedef typename R::Ptr record_ptr_t;
+    template<typename K>
+    class HashKeyMap {
+        private:
+            //! Map of keys to indices
+            std::unordered_map<K, size_t> map{};
 
+        public:
             /**
-             * \brief Add record under the provided key
-             *
-             * Copies the values of the provided record and associates them with the key.
-             * Does nothing when the key already has a record associated with it.
+             * Find the index associated with the key
              *
-             * \param key Key to associate with the record
-             * \param record Record to add
-             * \return index of the record iff the structure was modified (i.e. the record was added), unset otherwise
+             * \param key Key to look up
+             * \return Associated index, or unset if the key is not present
              */
-            virtual opt_index add(const key_t &key, const record_t &record) = 0;
+            opt_index find(const K &key) const {
+                auto it = map.find(key);
+                return (it == map.end()) ? opt_index() : opt_index(it->second);
+            }
 
             /**
-             * \brief Add records under the provided keys
-             *
-             * Copies the values of the provided records and associates them with the keys.
-             * Does nothing (at all) when any of the keys already has a record associated with it.
-             * The records have to be provided as an array of record instances (AoS layout).
+             * Find the indices associated with a batch of keys
              *
-             * \param keys Keys to associate with the records
-             * \param records Records to add
-             * \param count Number of records to add
-             * \return `true` iff the structure was modified (i.e. the records were added)
+             * \param keys Keys to look up
+             * \param dest Destination for the indices (entries of missing keys are set to 0)
+             * \param count Number of keys (at most \ref lookup_batch)
+             * \return Miss mask, with bit `i` set iff `keys[i]` is not present
              */
-            virtual bool add(const key_t *keys, const record_t *records, size_t count) = 0;
+            uint64_t find(const K *keys, size_t *dest, size_t count) const {
+                assert(count <= lookup_batch);
+                uint64_t misses = 0;
+                for (size_t i = 0; i < count; i++) {
+                    auto it = map.find(keys[i]);
+                    const bool miss = (it == map.end());
+                    dest[i] = miss ? 0 : it->second;
+                    misses |= static_cast<uint64_t>(miss) << i;
+                }
+                return misses;
+            }
 
-            /**
-             * \brief Add records under the provided keys
-             *
-             * Copies the values of the provided records and associates them with the keys.
-             * Does nothing (at all) when any of the keys already has a record associated with it.
-             * The records have to be provided as a record pointer type (SoA layout).
-             *
-             * \param keys Keys to associate with the records
-             * \param records Records to add
-             * \param count Number of records to add
-             * \return `true` iff the structure was modified (i.e. the records were added)
-             */
-            virtual bool add(const key_t *keys, const record_ptr_t &records, size_t count) = 0;
+            //! Get the index associated with a different key that would be displaced by inserting this one (never any)
+            opt_index conflict(const K &/*key*/) const { return opt_index(); }
 
-            /**
-             * \brief Remove record at the provided index
-             *
-             * Does nothing when no record is at the index.
-             * Done by copying the last record over the one to be removed and decrementing size.
-             * Potentially reshuffles the data, and therefore invalidates any references to it.
-             *
-             * \param idx Index of record to remove
-             * \return index of the removed element (and where last element was moved) iff the structure was modified
-             *          (i.e. the key was present and associated record removed)
-             */
-            virtual opt_index remove(opt_index idx) = 0;
+            //! Associate the key with the index (overwriting any previous association)
+            void insert(const K &key, size_t index) { map[key] = index; }
 
-            /**
-             * \brief Remove record associated with the provided key
-             *
-             * Does nothing when no record is associated with the key.
-             * Done by copying the last record over the one to be removed and decrementing size.
-             * Potentially reshuffles the data, and therefore invalidates any references to it.
-             *
-             * \param key Key to remove
-             * \return index of the removed element (and where last element was moved) iff the structure was modified
-             *          (i.e. the key was present and associated record removed)
-             */
-            virtual opt_index remove(const key_t &key) = 0;
+            //! Remove the key's association (if any)
+            void erase(const K &key) { map.erase(key); }
+    };
+
+    /** \class SparseKeyMap
+     * \brief Key-index map backed by a sparse array
+     *
+     * Maps keys to indices using an array indexed directly by `K::index()`.
+     * The full key is stored alongside the index, so a key whose slot is occupied by a different key (e.g. an entity
+     *  of a different generation) is correctly reported as absent.
+     * Lookups are a bounds check, a load and a comparison, with no hashing and no per-key allocation.
+     * Memory use is proportional to the largest key index seen.
+     *
+     * \tparam K Key type (has to provide `index()` and `operator==`)
+     */
+    template<typename K>
+    class SparseKeyMap {
+        private:
+            //! Slot of the sparse array
+            struct Slot {
+                //! Key that owns the slot (only meaningful when `index` is set)
+                K key;
+                //! Index associated with the key (unset when the slot is empty)
+                opt_index index;
+            };
+
+            //! Sparse array of slots indexed by key index
+            std::vector<Slot> sparse{};
 
+        public:
             /**
-             * Get index of record under the provided key
+             * Find the index associated with the key
              *
              * \param key Key to look up
-             * \return Instance of `opt_index` with the index, or unset if no record associated with the provided key
+             * \return Associated index, or unset if the key is not present
              */
-            virtual opt_index lookup(const key_t &key) = 0;
+            opt_index find(const K &key) const {
+                const size_t i = key.index();
+                if (i < sparse.size() && sparse[i].index.is_set() && sparse[i].key == key) {
+                    return sparse[i].index;
+                }
+                return opt_index();
+            }
 
             /**
-             * Get key of record at the provided index
+             * Find the indices associated with a batch of keys
              *
-             * \param idx Index to look up
-             * \return Instance of `key_t` with which the index is associated
+             * All slots are prefetched before any is read, so the cache misses of the batch overlap.
              *
-             * \throws std::out_of_range When no record is at the provided index
+             * \param keys Keys to look up
+             * \param dest Destination for the indices (entries of missing keys are set to 0)
+             * \param count Number of keys (at most \ref lookup_batch)
+             * \return Miss mask, with bit `i` set iff `keys[i]` is not present
              */
-            virtual key_t lookup(const opt_index &idx) = 0;
+            uint64_t find(const K *keys, size_t *dest, size_t count) const {
+                assert(count <= lookup_batch);
+                const size_t slots = sparse.size();
+                const Slot *data = sparse.data();
+
+                // Prefetch the slots of all keys in range
+                for (size_t i = 0; i < count; i++) {
+                    const size_t k = keys[i].index();
+                    if (k < slots) {
+                        __builtin_prefetch(data + k);
+                    }
+                }
 
-            /**
-             * Get copy of record under the provided key
-             *
-             * \param key Key to look up
-             * \return Instance of R whose members are copies of values associated with the provided key
-             *
-             * \throws std::out_of_range When no record is associated with the provided key
-             */
-            virtual record_t get_copy(const key_t &key) = 0;
+                // Resolve the keys
+                uint64_t misses = 0;
+                for (size_t i = 0; i < count; i++) {
+                    const size_t k = keys[i].index();
+                    const bool hit = k < slots && data[k].index.is_set() && data[k].key == keys[i];
+                    dest[i] = hit ? data[k].index.get() : 0;
+                    misses |= static_cast<uint64_t>(!hit) << i;
+                }
+                return misses;
+            }
 
             /**
-             * Get copy of record at the provided index
+             * Get the index associated with a different key that would be displaced by inserting this one
              *
-             * \param i Index
-             * \return Instance of R whose members are copies of values at the provided index
-             *
-             * \throws std::out_of_range When no record is at the provided index
+             * \param key Key to be inserted
+             * \return Index associated with the key currently occupying the slot, or unset if none or the same key
              */
-            virtual record_t get_copy(const opt_index &i) = 0;
+            opt_index conflict(const K &key) const {
+                const size_t i = key.index();
+                if (i < sparse.size() && sparse[i].index.is_set() && !(sparse[i].key == key)) {
+                    return sparse[i].index;
+                }
+                return opt_index();
+            }
+
+            //! Associate the key with the index (overwriting any previous association in the key's slot)
+            void insert(const K &key, size_t index) {
+                const size_t i = key.index();
+                if (i >= sparse.size()) {
+                    sparse.resize(i + 1);
+                }
+                sparse[i].key = key;
+                sparse[i].index.set(index);
+            }
+
+            //! Remove the key's association (if any)
+            void erase(const K &key) {
+                const size_t i = key.index();
+                if (i < sparse.size() && sparse[i].index.is_set() && sparse[i].key == key) {
+                    sparse[i].index.unset();
+                }
+            }
+    };
+
+    /** \class OpenKeyMap
+     * \brief Key-index map backed by an open-addressing hash table
+     *
+     * Maps keys to indices using a flat array of slots, hashed by `K::index()` and probed linearly.
+     * Like \ref SparseKeyMap, there is at most one key per key index, and a key of a different generation in the same
+     *  slot is correctly reported as absent (and as a conflict).
+     * The array is grown to stay at most half full, and halved once less than an eighth full (but never below
+     *  \ref min_slots), so memory use is proportional to the number of keys rather than to the largest key index seen.
+     * The gap between the two bounds keeps a key inserted and erased repeatedly from rehashing the array each time.
+     * This suits keys that are few compared to their range, e.g. components attached to a small fraction of entities.
+     * Lookups hash the key index and usually read a single slot, with no per-key allocation.
+     *
+     * \tparam K Key type (has to provide `index()` and `operator==`)
+     */
+    template<typename K>
+    class OpenKeyMap {
+        public:
+            //! Minimum number of slots once any key is inserted
+            static constexpr size_t min_slots = 16;
+
+        private:
+            //! Slot of the hash table
+            struct Slot {
+                //! Key that owns the slot (only meaningful when `index` is set)
+                K key;
+                //! Index associated with the key (unset when the slot is empty)
+                opt_index index;
+            };
+
+            //! Slots (number is zero or a power of two)
+            std::vector<Slot> slots{};
+            //! Number of bits of slot index (i.e. `slots.size() == 1 << bits` when not empty)
+            unsigned bits = 0;
+            //! Number of keys
+            size_t n = 0;
+
+            //! Get the slot where probing for the key index starts (Fibonacci hashing)
+            size_t home(size_t key_index) const {
+                return static_cast<size_t>((static_cast<uint64_t>(key_index) * 0x9E3779B97F4A7C15ull) >> (64 - bits));
+            }
+
+            //! Get the slot holding a key with the key index, or the empty slot where it would be inserted
+            size_t probe(size_t key_index) const {
+                const size_t mask = slots.size() - 1;
+                size_t i = home(key_index);
+                while (slots[i].index.is_set() && slots[i].key.index() != key_index) {
+                    i = (i + 1) & mask;
+                }
+                return i;
+            }
+
+            //! Move all keys into a table with the number of slots (a power of two, more than twice the keys)
+            void rehash(size_t count) {
+                std::vector<Slot> old(count);
+                old.swap(slots);
+                bits = 0;
+                while ((static_cast<size_t>(1) << bits) < count) {
+                    bits++;
+                }
+                for (const Slot &s : old) {
+                    if (s.index.is_set()) {
+                        slots[probe(s.key.index())] = s;
+                    }
+                }
+            }
 
+        public:
             /**
-             * Get read-write reference to the record under the provided key
+             * Find the index associated with the key
              *
              * \param key Key to look up
-             * \return Instance of R::Ptr (struct of pointers to members of R) whose members point to the values
-             *  associated with the provided key
-             *
-             * \throws std::out_of_range When no record is associated with the provided key
+             * \return Associated index, or unset if the key is not present
              */
-            virtual record_ptr_t get_reference(const key_t &key) = 0;
+            opt_index find(const K &key) const {
+                if (n == 0) {
+                    return opt_index();
+                }
+                const Slot &s = slots[probe(key.index())];
+                return (s.index.is_set() && s.key == key) ? s.index : opt_index();
+            }
 
             /**
-             * Get read-write reference to the record at the provided index
-             *
-             * \param i Index
-             * \return Instance of R::Ptr (struct of pointers to members of R) whose members point to the values
-             *  at the provided index
+             * Find the indices associated with a batch of keys
              *
-             * \throws std::out_of_range When no record is at the provided index
-             */
-            virtual record_ptr_t get_reference(const opt_index &i) = 0;
-
-            /**
-             * Get read-write references to the records under the provided keys
-             * References are set to `nullptr` when no record is associated with that key
+             * The home slots of all keys are prefetched before any is read, so the cache misses of the batch overlap.
              *
              * \param keys Keys to look up
-             * \param dest Array of size `count` with R:Ptr instances to fill with the references
-             * \param count Number of records to look up
+             * \param dest Destination for the indices (entries of missing keys are set to 0)
+             * \param count Number of keys (at most \ref lookup_batch)
+             * \return Miss mask, with bit `i` set iff `keys[i]` is not present
              */
-            virtual void get_reference(const key_t *keys, record_ptr_t *dest, size_t count) = 0;
+            uint64_t find(const K *keys, size_t *dest, size_t count) const {
+                assert(count <= lookup_batch);
+                if (n == 0) {
+                    std::fill(dest, dest + count, 0);
+                    return (count == lookup_batch) ? ~static_cast<uint64_t>(0) : (static_cast<uint64_t>(1) << count) - 1;
+                }
 
-            /**
-             * Get read-write reference to the first record
-             * Undefined when empty
-             *
-             * \return Instance of R::Ptr (struct of pointers to members of R) whose members point to the values
-             *  associated with the first record
-             */
-            virtual record_ptr_t get_reference() = 0;
+                // Prefetch the home slots of all keys
+                const Slot *data = slots.data();
+                for (size_t i = 0; i < count; i++) {
+                    __builtin_prefetch(data + home(keys[i].index()));
+                }
+
+                // Resolve the keys
+                uint64_t misses = 0;
+                for (size_t i = 0; i < count; i++) {
+                    const Slot &s = data[probe(keys[i].index())];
+                    const bool hit = s.index.is_set() && s.key == keys[i];
+                    dest[i] = hit ? s.index.get() : 0;
+                    misses |= static_cast<uint64_t>(!hit) << i;
+                }
+                return misses;
+            }
 
             /**
-             * Increment reference to point to the next record
+             * Get the index associated with a different key that would be displaced by inserting this one
              *
-             * \param ref Reference to increment
+             * \param key Key to be inserted
+             * \return Index associated with the key currently occupying the slot, or unset if none or the same key
              */
-            virtual void increment_reference(record_ptr_t &ref) = 0;
-
-            //! Get number of records
-            virtual size_t size() = 0;
+            opt_index conflict(const K &key) const {
+                if (n == 0) {
+                    return opt_index();
+                }
+                const Slot &s = slots[probe(key.index())];
+                return (s.index.is_set() && !(s.key == key)) ? s.index : opt_index();
+            }
 
-            //! Get key set
-            virtual std::vector<key_t> keys() = 0;
+            //! Associate the key with the index (overwriting any previous association in the key's slot)
+            void insert(const K &key, size_t index) {
+                if (2 * (n + 1) > slots.size()) {
+                    rehash(std::max(min_slots, 2 * slots.size()));
+                }
+                Slot &s = slots[probe(key.index())];
+                if (!s.index.is_set()) {
+                    n++;
+                }
+                s.key = key;
+                s.index.set(index);
+            }
 
-            //! Get number of allocated records
-            virtual size_t allocated() = 0;
+            //! Remove the key's association (if any)
+            void erase(const K &key) {
+                if (n == 0) {
+                    return;
+                }
+                size_t i = probe(key.index());
+                if (!slots[i].index.is_set() || !(slots[i].key == key)) {
+                    return;
+                }
 
-            //! Get number of allocated pages
-            virtual size_t pages() = 0;
+                // Empty the slot, and shift back any following keys that can then be found earlier (no tombstones)
+                const size_t mask = slots.size() - 1;
+                slots[i].index.unset();
+                n--;
+                for (size_t j = (i + 1) & mask; slots[j].index.is_set(); j = (j + 1) & mask) {
+                    const size_t h = home(slots[j].key.index());
+                    if (((j - h) & mask) >= ((j - i) & mask)) {
+                        slots[i] = slots[j];
+                        slots[j].index.unset();
+                        i = j;
+                    }
+                }
 
-            //! Get name of the table type (ie the storage scheme)
-            virtual const char* type_name() = 0;
+                // Shrink once less than an eighth full
+                if (slots.size() > min_slots && 8 * n < slots.size()) {
+                    rehash(slots.size() / 2);
+                }
+            }
+    };
 
-            virtual ~Table() = default;
+    //! Key density a component's key map is tuned for
+    enum class KeyDensity {
+        //! Keys present for most of their range (see \ref SparseKeyMap)
+        dense,
+        //! Keys present for a small fraction of their range (see \ref OpenKeyMap)
+        sparse
     };
 
-    /** \class TableAoS
-     * Table that stores its records as an array of structs
+    /** \class SelectKeyMap
+     * \brief Key-index map that is either a \ref SparseKeyMap or an \ref OpenKeyMap, chosen at construction
      *
-     * \tparam K Key type
-     * \tparam R Record type
+     * Lets the same table type use either map, so that the choice can be made per table at run time (e.g. by a
+     *  component manager depending on how many entities the component is expected on).
+     * Every access branches on the choice, which is always taken the same way and so predicted well.
+     *
+     * \tparam K Key type (has to provide `index()` and `operator==`)
      */
-    template<typename K, typename R>
-    class TableAoS : public Table<K, R> {
-        public:
-            //! Key type
-            typedef K key_t;
-            //! Record type
-            typedef R record_t;
-            //! Record pointer type (struct of pointers to members of R)
-            typedef typename R::Ptr record_ptr_t;
-
+    template<typename K>
+    class SelectKeyMap {
         private:
-            //! Map of keys to indices to the data
-            std::unordered_map<K, size_t> map{};
-            //! Start of the data
-            record_t *data = nullptr;
-            //! Number of records stored
-            size_t n = 0;
-            //! Allocated space in terms of number of records that fit in it
-            size_t capacity = 0;
-            //! Number of pages allocated
-            size_t pages_alloc = 0;
+            //! Chosen density
+            KeyDensity mode;
+            //! Map used for dense keys (empty otherwise)
+            SparseKeyMap<K> dense_map{};
+            //! Map used for sparse keys (empty otherwise)
+            OpenKeyMap<K> sparse_map{};
 
         public:
-            //! Construct the table and defer allocation to first insertion
-            TableAoS() = default;
-
             /**
-             * Construct the table and allocate space for `count` records
+             * Construct an empty map
              *
-             * \param count Number of records to allocate space for
+             * \param density Density of the keys
              */
-            explicit TableAoS(size_t count) { allocate(count); }
-
-            opt_index add(const key_t &key, const record_t &record) override;
-            bool add(const key_t *keys, const record_t *records, size_t count) override;
-            bool add(const key_t *keys, const record_ptr_t &records, size_t count) override;
-            opt_index remove(const key_t &key) override;
-            opt_index remove(opt_index idx) override;
-            opt_index lookup(const key_t &key) override;
-            key_t lookup(const opt_index &idx) override;
-            record_t get_copy(const key_t &key) override;
-            record_t get_copy(const opt_index &i) override;
-            record_ptr_t get_reference(const key_t &key) override;
-            record_ptr_t get_reference(const opt_index &i) override;
-            record_ptr_t get_reference() override;
-            void get_reference(const key_t *keys, record_ptr_t *dest, size_t count) override;
-            void increment_reference(record_ptr_t &ref) override { util::invoke_n<record_t::count, IncrementHelper>(ref); }
-            size_t size() override { return n; }
-            std::vector<key_t> keys() override;
-            size_t allocated() override { return capacity; }
-            size_t pages() override { return pages_alloc; }
-            const char* type_name() override { return "AoS"; }
-
-            virtual ~TableAoS();
+            explicit SelectKeyMap(KeyDensity density = KeyDensity::dense) : mode(density) {}
 
-        private:
-            //! Helper functor to fill the Nth member of the ith record with data being pointed to by the Nth member of
-            //! the record pointer, incrementing the record pointer member.
-            template <size_t N>
-            struct AddsHelper {
-                void operator()(record_t *arr, const size_t i, record_ptr_t &records) {
-                    // From Nth member of records,
-                    auto src = std::invoke(util::get_pointer_to_member<record_ptr_t, N>(), records);
-                    // to Nth member of ith record, copy
-                    std::invoke(util::get_pointer_to_member<record_t, N>(), arr[i]) = *src;
-                    // and increment the pointer in records
-                    std::invoke(util::get_pointer_to_member<record_ptr_t, N>(), records)++;
-                }
-            };
+            //! Get the density the map was constructed for
+            KeyDensity density() const { return mode; }
 
-            //! Helper functor to fill Nth member of R::Ptr with a pointer to the appropriate value of record i
-            template <size_t N>
-            struct GetRefHelper {
-                void operator()(record_t *arr, const size_t i, record_ptr_t &result) {
-                    // Get the appropriate value's address
-                    auto ptr = &(std::invoke(util::get_pointer_to_member<record_t, N>(), arr[i]));
+            //! See \ref SparseKeyMap::find(const K &) const
+            opt_index find(const K &key) const {
+                return (mode == KeyDensity::dense) ? dense_map.find(key) : sparse_map.find(key);
+            }
+
+            //! See \ref SparseKeyMap::find(const K *, size_t *, size_t) const
+            uint64_t find(const K *keys, size_t *dest, size_t count) const {
+                return (mode == KeyDensity::dense) ? dense_map.find(keys, dest, count) : sparse_map.find(keys, dest, count);
+            }
+
+            //! See \ref SparseKeyMap::conflict
+            opt_index conflict(const K &key) const {
+                return (mode == KeyDensity::dense) ? dense_map.conflict(key) : sparse_map.conflict(key);
+            }
 
-                    // Set result's member to the address
-                    std::invoke(util::get_pointer_to_member<record_ptr_t, N>(), result) = ptr;
+            //! See \ref SparseKeyMap::insert
+            void insert(const K &key, size_t index) {
+                if (mode == KeyDensity::dense) {
+                    dense_map.insert(key, index);
+                } else {
+                    sparse_map.insert(key, index);
                 }
-            };
+            }
 
-            //! Helper functor to increment Nth member of R::Ptr
-            template <size_t N>
-            struct IncrementHelper {
-                void operator()(record_ptr_t &ref) {
-                    // Increment member by sizeof(R) bytes (next element, same offset)
-                    // Note: cast to byte ptr -> increment by size of R -> cast back to member type ptr
-                    typedef typename util::GetMemberType<record_ptr_t, N>::type member_type;
-                    auto member_p = util::get_pointer_to_member<record_ptr_t, N>();
-                    std::invoke(member_p, ref) = (member_type) (((unsigned char *) std::invoke(member_p, ref)) + sizeof(record_t));
+            //! See \ref SparseKeyMap::erase
+            void erase(const K &key) {
+                if (mode == KeyDensity::dense) {
+                    dense_map.erase(key);
+                } else {
+                    sparse_map.erase(key);
                 }
-            };
-
-            void allocate(size_t size);
+            }
     };
 
     /**
-     * Allocate page-aligned space that fits at least the given amount of records.
-     * Size of the allocated space is rounded up to the nearest 2^N pages.
-     * If the table wasn't empty, the old data is copied over to the new space.
+     * Get the number of pages to allocate to fit the provided amount of space.
+     * The number is rounded up to the nearest 2^N pages.
      *
-     * \tparam K Key type
-     * \tparam R Record type
-     * \param size Number of records to allocate space for
+     * \param space_needed Number of bytes needed
+     * \return Number of pages
      */
     // Note: rounding up to 2^N instead of just nearest page to ensure geometric progression and amortised performance
-    template<typename K, typename R>
-    void TableAoS<K, R>::allocate(size_t size) {
-        // Make sure old data will fit into new space
-        assert(size >= n);
-
-        // Skip if already big enough or requested zero size (which any space fits)
-        if (capacity >= size || size == 0) {
-            return;
-        }
-
-        // Calculate target space size
-        // The nearest greater power of 2 has 1 in the position of the last leading 0 and 0s everywhere else
+    inline size_t round_pages(size_t space_needed) {
         // For the rounded-up division see https://stackoverflow.com/q/2745074
-        long pagesize = sysconf(_SC_PAGESIZE);
-        unsigned long space_needed = size * sizeof(record_t);
-        unsigned long pages_needed = space_needed / pagesize + (space_needed % pagesize != 0);
-        size_t pages_target;
+        const size_t pagesize = sysconf(_SC_PAGESIZE);
+        const size_t pages_needed = space_needed / pagesize + (space_needed % pagesize != 0);
         if ((pages_needed & (pages_needed - 1)) == 0) {
-            // Pages needed is a power of two -> use that
+            // Pages needed is a power of two (or zero) -> use that
             // See http://www.graphics.stanford.edu/~seander/bithacks.html#DetermineIfPowerOf2 for power of 2 test
-            pages_target = pages_needed;
+            return pages_needed;
         } else {
             // Not a power of two -> find the nearest greater one
             // The nearest greater power of 2 has 1 in the position of the last leading 0 and 0s everywhere else
-            int shift_by = ((sizeof(unsigned long) * 8) - __builtin_clzl(pages_needed));
-            pages_target = 1 << shift_by;
+            const int shift_by = ((sizeof(unsigned long) * 8) - __builtin_clzl(pages_needed));
+            return static_cast<size_t>(1) << shift_by;
         }
-        size_t space_target = pages_target * pagesize;
-        assert(space_target >= space_needed);
+    }
 
-        // Allocate that much page-aligned space
-        record_t *target = static_cast<record_t *>(aligned_alloc(pagesize, space_target));
-        assert(target != nullptr);
+    //! Alignment of data array starts in column-oriented tables (a cache line, which is also a multiple of SIMD widths)
+    // Note: aligning to a cache line also prevents threads writing different arrays from sharing cache lines
+    constexpr size_t column_alignment = 64;
 
-        // Copy data into new space
-        if (n > 0) {
-            std::copy_n(data, n, target);
-        }
+    //! Tables trim their space once fewer than 1 / shrink_ratio of the allocated records are used (see \ref Table::trim)
+    constexpr size_t shrink_ratio = 4;
 
-        // Deallocate old data
-        if (data && capacity > 0) {
-            free(data);
+    /** \struct TableStats
+     * Counts of a table's operations, for finding which tables drive the frame time
+     * Operations are only counted when enabled at compile time (see \ref open_sea::table_stats), otherwise counting
+     *  compiles away.
+     */
+    struct TableStats {
+        //! Counted operations
+        enum Counter : size_t {
+            lookups,        //!< Keys looked up
+            lookup_misses,  //!< Keys looked up but not found
+            adds,           //!< Records added
+            removes,        //!< Records removed
+            reallocations,  //!< Reallocations of the space (growing or shrinking it)
+            bytes_copied,   //!< Bytes of records copied or moved by reallocations
+            key_lists,      //!< Reads of the key list (see \ref Table::keys)
+            counter_count   //!< Number of counters
+        };
+
+        //! Names of the counters
+        static constexpr const char *names[counter_count] = {
+                "Lookups", "Lookup misses", "Adds", "Removes", "Reallocations", "Bytes copied", "Key lists"
+        };
+
+        //! Counts indexed by counter
+        std::array<uint64_t, counter_count> counts{};
+
+        //! Get count of the counter
+        uint64_t operator[](Counter c) const { return counts[c]; }
+
+        /**
+         * Get counts since the earlier stats were taken
+         *
+         * \param earlier Earlier stats of the same table
+         * \return Difference of the counts
+         */
+        TableStats operator-(const TableStats &earlier) const {
+            TableStats result;
+            for (size_t c = 0; c < counter_count; c++) {
+                result.counts[c] = counts[c] - earlier.counts[c];
+            }
+            return result;
         }
+    };
 
-        // Update state
-        data = target;
-        capacity = space_target / sizeof(record_t);
-        pages_alloc = pages_target;
+    /**
+     * Round the value up to the nearest multiple of the alignment
+     *
+     * \param value Value to round
+     * \param alignment Alignment (power of two)
+     * \return Rounded value
+     */
+    constexpr size_t align_up(size_t value, size_t alignment) {
+        return (value + alignment - 1) & ~(alignment - 1);
     }
 
-    template<typename K, typename R>
-    opt_index TableAoS<K, R>::add(const key_t &key, const record_t &record) {
-        // Check the key is not present yet
-        try {
-            map.at(key);
-            return opt_index();
-        } catch (std::out_of_range &e) {}
-
-        // Check there is enough space
-        if (capacity <= n) {
-            // At capacity -> allocate enough space to add a record
-            allocate(n + 1);
+    /**
+     * Fault in all pages of the space, so that later writes to it don't stall on page faults
+     * Existing contents are preserved.
+     *
+     * \param start Start of the space (page-aligned)
+     * \param bytes Size of the space in bytes
+     */
+    inline void prefault_pages(void *start, size_t bytes) {
+#ifdef MADV_POPULATE_WRITE
+        // Populate the whole range at once, as MAP_POPULATE does on mapping (Linux 5.14+)
+        if (madvise(start, bytes, MADV_POPULATE_WRITE) == 0) {
+            return;
+        }
+#endif
+        // Otherwise touch every page (writing back the value read, so that the page is faulted in as writable)
+        const size_t pagesize = sysconf(_SC_PAGESIZE);
+        auto *bytes_start = static_cast<volatile unsigned char *>(start);
+        for (size_t offset = 0; offset < bytes; offset += pagesize) {
+            bytes_start[offset] = bytes_start[offset];
         }
-
-        // Set row to the record
-        data[n] = record;
-
-        // Update map
-        map[key] = n;
-
-        // Return inserted index and increment size
-        return opt_index(n++);
     }
 
-    template<typename K, typename R>
-    bool TableAoS<K, R>::add(const key_t *keys, const record_t *records, size_t count) {
-        // Skip if count is zero
-        if (count == 0) {
-            return false;
-        }
+    /** \struct HeapAllocation
+     * Allocation policy using page-aligned heap blocks (`aligned_alloc` and `free`)
+     * Blocks can't grow in place, so growing tables allocate a new block and copy their records over.
+     */
+    struct HeapAllocation {
+        /**
+         * Allocate a page-aligned block
+         *
+         * \param bytes Size of the block in bytes (a multiple of the page size)
+         * \return Start of the block, or `nullptr` on failure
+         */
+        static void *allocate(size_t bytes) { return aligned_alloc(sysconf(_SC_PAGESIZE), bytes); }
+
+        /**
+         * Grow a block, keeping its contents (never possible for heap blocks)
+         *
+         * \return `nullptr`
+         */
+        static void *grow(void */*block*/, size_t /*bytes*/, size_t /*new_bytes*/) { return nullptr; }
+
+        /**
+         * Deallocate a block
+         *
+         * \param block Start of the block
+         */
+        static void deallocate(void *block, size_t /*bytes*/) { free(block); }
+    };
 
-        // Check no key is present yet
-        for (size_t i = 0; i < count; i++) {
-            try {
-                map.at(keys[i]);
-                return false;
-            } catch (std::out_of_range&) {}
+    /** \struct MappedAllocation
+     * Allocation policy mapping anonymous memory directly (`mmap`)
+     * On Linux, blocks grow with `mremap`, which moves the pages to a larger range instead of copying their contents.
+     * Blocks of at least \ref huge_threshold bytes are advised to use transparent huge pages, reducing TLB misses when
+     *  scanning large tables.
+     */
+    struct MappedAllocation {
+        //! Size of blocks from which transparent huge pages are requested (a huge page on x86-64)
+        static constexpr size_t huge_threshold = static_cast<size_t>(2) << 20u;
+
+        /**
+         * Advise the kernel to back a large block with huge pages
+         *
+         * \param block Start of the block
+         * \param bytes Size of the block in bytes
+         */
+        static void advise(void *block, size_t bytes) {
+#ifdef MADV_HUGEPAGE
+            if (bytes >= huge_threshold) {
+                // Note: only advice, so failure (e.g. huge pages disabled) is fine
+                madvise(block, bytes, MADV_HUGEPAGE);
+            }
+#else
+            (void) block;
+            (void) bytes;
+#endif
         }
 
-        // Check there is enough space
-        if (capacity < (n + count)) {
-            // Wouldn't fit -> allocate enough space to add all the records
-            allocate(n + count);
+        /**
+         * Map a block
+         *
+         * \param bytes Size of the block in bytes (a multiple of the page size)
+         * \return Start of the block, or `nullptr` on failure
+         */
+        static void *allocate(size_t bytes) {
+            void *block = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (block == MAP_FAILED) {
+                return nullptr;
+            }
+            advise(block, bytes);
+            return block;
         }
 
-        // Copy all records to the end of the data
-        std::copy_n(records, count, data+n);
-
-        // Update key map
-        for (size_t i = 0; i < count; i++) {
-            map[keys[i]] = n;
-            n++;
+        /**
+         * Grow a block, keeping its contents
+         * The block may move, in which case the old start is no longer valid.
+         *
+         * \param block Start of the block
+         * \param bytes Current size of the block in bytes
+         * \param new_bytes New size of the block in bytes (a multiple of the page size)
+         * \return New start of the block, or `nullptr` if it can't grow (the block is then left unchanged)
+         */
+        static void *grow(void *block, size_t bytes, size_t new_bytes) {
+#ifdef MREMAP_MAYMOVE
+            void *grown = mremap(block, bytes, new_bytes, MREMAP_MAYMOVE);
+            if (grown == MAP_FAILED) {
+                return nullptr;
+            }
+            advise(grown, new_bytes);
+            return grown;
+#else
+            (void) block;
+            (void) bytes;
+            (void) new_bytes;
+            return nullptr;
+#endif
         }
 
-        return true;
-    }
+        /**
+         * Unmap a block
+         *
+         * \param block Start of the block
+         * \param bytes Size of the block in bytes
+         */
+        static void deallocate(void *block, size_t bytes) { munmap(block, bytes); }
+    };
 
-    template<typename K, typename R>
-    bool TableAoS<K, R>::add(const key_t *keys, const record_ptr_t &records, size_t count) {
-        // Skip if count is zero
-        if (count == 0) {
-            return false;
+    /**
+     * Resize a block to the given number of pages, keeping its first `keep` bytes
+     * A growing block is grown by the allocation policy if it can (e.g. \ref MappedAllocation), so its contents are
+     *  not copied. Otherwise a new block is allocated and the kept bytes are copied over.
+     *
+     * \tparam A Allocation policy
+     * \param block Start of the block (`nullptr` if none), replaced by the new start (`nullptr` for zero pages)
+     * \param pages Number of pages of the block, replaced by the target
+     * \param pages_target Number of pages to resize the block to
+     * \param keep Number of bytes at the start of the block to keep
+     * \return Number of bytes copied
+     */
+    template<typename A>
+    size_t resize_block(void *&block, size_t &pages, size_t pages_target, size_t keep) {
+        if (pages_target == pages) {
+            return 0;
         }
-
-        // Check no key is present yet
-        for (size_t i = 0; i < count; i++) {
-            try {
-                map.at(keys[i]);
-                return false;
-            } catch (std::out_of_range&) {}
+        const size_t pagesize = sysconf(_SC_PAGESIZE);
+
+        // Grow the block if the allocation policy can
+        if (block && pages_target > pages) {
+            void *grown = A::grow(block, pages * pagesize, pages_target * pagesize);
+            if (grown) {
+                block = grown;
+                pages = pages_target;
+                return 0;
+            }
         }
 
-        // Check there is enough space
-        if (capacity < (n + count)) {
-            // Wouldn't fit -> allocate enough space to add all the records
-            allocate(n + count);
+        // Otherwise allocate a new block and copy the kept bytes over
+        void *target = nullptr;
+        if (pages_target > 0) {
+            target = A::allocate(pages_target * pagesize);
+            assert(target != nullptr);
         }
-
-        // Process each record (copying records to modify it)
-        record_ptr_t rs_copy = records;
-        for (size_t i = 0; i < count; i++) {
-            // Set row to the record
-            util::invoke_n<record_t::count, AddsHelper>(data, n, rs_copy);
-
-            // Update state
-            map[keys[i]] = n;
-            n++;
+        if (block) {
+            if (target && keep > 0) {
+                std::copy_n(static_cast<unsigned char *>(block), keep, static_cast<unsigned char *>(target));
+            }
+            A::deallocate(block, pages * pagesize);
         }
+        block = target;
+        pages = pages_target;
+        return (target) ? keep : 0;
+    }
 
-        return true;
+    //! Mask selecting all columns (members) of a record
+    constexpr uint64_t all_columns = ~static_cast<uint64_t>(0);
+
+    /**
+     * Get the mask selecting a single column (member) of a record
+     *
+     * \param n Index of the member
+     * \return Mask with only the bit of the column set
+     */
+    constexpr uint64_t column(size_t n) {
+        return static_cast<uint64_t>(1) << n;
     }
 
-    template<typename K, typename R>
-    opt_index TableAoS<K, R>::remove(opt_index idx) {
-        // Find the index's key in the map and remove using the key overload
-        if (idx.is_set() && idx.get() < n) {
-            for (auto i = map.begin(); i != map.end(); i++) {
-                if (i->second == idx.get()) {
-                    return remove(i->first);
+    /** \class ChangeTracker
+     * \brief Tracks which columns of which records changed
+     *
+     * Keeps a version counter for each column, incremented by every change to the column.
+     * When enabled, also keeps the list of changed keys with a mask of changed columns for each, until cleared.
+     * Changes are tracked by key rather than by index, so they are unaffected by records moving within the table.
+     *
+     * \tparam K Key type
+     * \tparam M Key-index map type (maps changed keys to their position in the list)
+     * \tparam C Number of columns (at most 64, one bit each in the masks)
+     */
+    template<typename K, typename M, size_t C>
+    class ChangeTracker {
+            static_assert(C <= 64, "Change masks have one bit per column.");
+
+        private:
+            //! Mask of the existing columns
+            static constexpr uint64_t existing = (C == 64) ? all_columns : column(C) - 1;
+
+            //! Version counter of each column
+            std::array<uint64_t, C> versions{};
+            //! Whether changed keys are tracked
+            bool enabled = false;
+            //! Position of each changed key in the list
+            M positions{};
+            //! Changed keys
+            std::vector<K> changed_keys{};
+            //! Masks of changed columns (parallel to the changed keys)
+            std::vector<uint64_t> masks{};
+
+        public:
+            /**
+             * Enable or disable tracking of changed keys
+             * Disabling it clears the tracked changes. Column versions are kept either way.
+             *
+             * \param enable Whether to track changed keys
+             */
+            void enable(bool enable) {
+                enabled = enable;
+                if (!enabled) {
+                    clear();
                 }
             }
 
-            // We got here -> none found
-            return opt_index();
-        } else {
-            // Unset or out of range
-            return opt_index();
-        }
-    }
+            //! Check whether changed keys are tracked
+            bool is_enabled() const { return enabled; }
 
-    template<typename K, typename R>
-    opt_index TableAoS<K, R>::remove(const key_t &key) {
-        // Check the key is present
-        try {
-            // Get the index to delete and of last item
-            size_t index = map.at(key);
-            size_t last = n - 1;
-
-            // Only copy over when not last
-            if (index != last) {
-                // Move last into deleted
-                data[index] = data[last];
-
-                // Update key-index map
-                for (auto i = map.begin(); i != map.end(); i++) {
-                    if (i->second == last) {
-                        i->second = index;
-                        break;
-                    }
+            /**
+             * Get version of the column
+             *
+             * \param c Column index
+             * \return Number of changes to the column so far
+             *
+             * \throws std::out_of_range When the column doesn't exist
+             */
+            uint64_t version(size_t c) const { return versions.at(c); }
+
+            /**
+             * Record a change to columns of the key's record
+             *
+             * \param key Key of the changed record
+             * \param columns Mask of the changed columns
+             */
+            void touch(const K &key, uint64_t columns) {
+                columns &= existing;
+                for (uint64_t rest = columns; rest != 0; rest &= rest - 1) {
+                    versions[__builtin_ctzll(rest)]++;
+                }
+                if (!enabled || columns == 0) {
+                    return;
+                }
+
+                opt_index pos = positions.find(key);
+                if (pos.is_set()) {
+                    masks[pos.get()] |= columns;
+                } else {
+                    positions.insert(key, changed_keys.size());
+                    changed_keys.push_back(key);
+                    masks.push_back(columns);
                 }
             }
 
-            // Decrement size and erase the removed key
-            n--;
-            map.erase(key);
+            /**
+             * Get the columns of the key's record changed since last cleared
+             *
+             * \param key Key
+             * \return Mask of the changed columns (zero if none or not tracked)
+             */
+            uint64_t changes(const K &key) const {
+                opt_index pos = positions.find(key);
+                return pos.is_set() ? masks[pos.get()] : 0;
+            }
 
-            return opt_index(index);
-        } catch (std::out_of_range &e) {
-            // Not present -> nothing to remove
-            return opt_index();
-        }
-    }
+            //! Get keys changed since last cleared, in order of their first change
+            const std::vector<K> &changed() const { return changed_keys; }
 
-    template<typename K, typename R>
-    opt_index TableAoS<K, R>::lookup(const key_t &key) {
-        // Find the key
-        try {
-            // Return index when found
-            return opt_index(map.at(key));
-        } catch (std::out_of_range &e) {
-            // Not present -> unset
-            return opt_index();
+            //! Forget all changed keys
+            void clear() {
+                for (const K &key : changed_keys) {
+                    positions.erase(key);
+                }
+                changed_keys.clear();
+                masks.clear();
+            }
+    };
+
+    /**
+     * Apply the function to the records with any of the selected columns changed since changes were last cleared
+     * Keys that no longer have a record are skipped.
+     *
+     * \tparam T Table type
+     * \tparam F Function type
+     * \param table Table
+     * \param f Function taking the key, a reference to the record and the mask of its changed columns (limited to the
+     *  selected ones)
+     * \param columns Mask of the selected columns
+     */
+    template<typename T, typename F>
+    void apply_changed(T &table, F f, uint64_t columns) {
+        for (const auto &key : table.changed_keys()) {
+            const uint64_t mask = table.changes(key) & columns;
+            if (mask == 0) {
+                continue;
+            }
+            opt_index i = table.lookup(key);
+            if (i.is_set()) {
+                f(key, table.get_reference(i), mask);
+            }
         }
     }
 
-    template<typename K, typename R>
-    typename TableAoS<K, R>::key_t TableAoS<K, R>::lookup(const opt_index &idx) {
-        // Check the index is valid
-        if (!idx.is_set()) {
-            // Unset -> error
-            throw std::out_of_range("Index is unset.");
+    template<typename T, size_t... N>
+    class View;
+
+    /**
+     * Compute the order of records of a table sorted by a value computed for each record
+     * The sort is stable, i.e. records with equal values keep their relative order.
+     *
+     * \tparam T Table type
+     * \tparam F Function type
+     * \param table Table
+     * \param f Function taking the key and a reference to the record, returning the value to sort by (any type
+     *  comparable by `<`)
+     * \return Indices of the records in sorted order (i.e. position `i` holds the current index of the `i`th record)
+     */
+    template<typename T, typename F>
+    std::vector<size_t> sorted_order(T &table, F f) {
+        const size_t n = table.size();
+        std::vector<size_t> order(n);
+        for (size_t i = 0; i < n; i++) {
+            order[i] = i;
         }
-        if (idx.get() > n) {
-            // Outside -> error
-            throw std::out_of_range("Index is outside the table.");
+        if (n == 0) {
+            return order;
         }
 
-        // Find the key
-        for (auto i = map.begin(); i != map.end(); i++) {
-            if (i->second == idx.get()) {
-                return i->first;
-            }
+        // Compute the values
+        std::vector<decltype(f(table.keys()[0], table.get_reference()))> values;
+        values.reserve(n);
+        const auto &keys = table.keys();
+        auto ref = table.get_reference();
+        for (size_t i = 0; i < n; i++, table.increment_reference(ref)) {
+            values.push_back(f(keys[i], ref));
         }
 
-        // Not found -> error
-        throw std::out_of_range("No record found for the provided key.");
-    }
-
-    template<typename K, typename R>
-    typename TableAoS<K, R>::record_t TableAoS<K, R>::get_copy(const key_t &key) {
-        // Check the key is present
-        try {
-            // Return copy of the record associated with the key
-            return data[map.at(key)];
-        } catch (std::out_of_range &e) {
-            // Not present -> error
-            throw std::out_of_range("No record found for the provided key.");
-        }
+        // Sort the indices by the values
+        std::stable_sort(order.begin(), order.end(), [&values](size_t a, size_t b) { return values[a] < values[b]; });
+        return order;
     }
 
-    template<typename K, typename R>
-    typename TableAoS<K, R>::record_t TableAoS<K, R>::get_copy(const opt_index &i) {
-        // Check the index is set and within range
-        if (!i.is_set()) {
-            // Not set -> error
-            throw std::invalid_argument("Index is not set.");
-        } else if(i.get() < this->n) {
-            // Return copy of the record at the index
-            return data[i.get()];
-        } else {
-            // Not present -> error
-            throw std::out_of_range("No record found for the provided index.");
+    /**
+     * Invert a permutation
+     *
+     * \param order Permutation (position `i` holds the current index of the record to move to `i`)
+     * \return Inverse permutation (position `i` holds the new index of the record currently at `i`)
+     */
+    inline std::vector<size_t> invert_order(const std::vector<size_t> &order) {
+        std::vector<size_t> inverse(order.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            inverse[order[i]] = i;
         }
+        return inverse;
     }
 
-    template<typename K, typename R>
-    typename TableAoS<K, R>::record_ptr_t TableAoS<K, R>::get_reference(const key_t &key) {
-        // Check the key is present
-        try {
-            // Get the index and prepare result
-            size_t index = map.at(key);
-            record_ptr_t result;
-
-            // Set result to point to the correct entries
-            util::invoke_n<record_t::count, GetRefHelper>(data, index, result);
-
-            return result;
-        } catch (std::out_of_range &e) {
-            // Not present -> error
-            throw std::out_of_range("No record found for the provided key.");
+    /**
+     * Check that the order is a permutation of the given number of records
+     *
+     * \param order Order to check
+     * \param n Number of records
+     *
+     * \throws std::invalid_argument When the order is not a permutation of `n` records
+     */
+    inline void check_order(const std::vector<size_t> &order, size_t n) {
+        if (order.size() != n) {
+            throw std::invalid_argument("Order size doesn't match the number of records.");
         }
-    }
-
-    template<typename K, typename R>
-    typename TableAoS<K, R>::record_ptr_t TableAoS<K, R>::get_reference(const opt_index &i) {
-        // Check if the index is set and within range
-        if (!i.is_set()) {
-            // Not set -> error
-            throw std::invalid_argument("Index is not set.");
-        } else if (i.get() < this->n) {
-            // Get the index and prepare result
-            size_t index = i.get();
-            record_ptr_t result;
-
-            // Set result to point to the correct entries
-            util::invoke_n<record_t::count, GetRefHelper>(data, index, result);
-
-            return result;
-        } else {
-            // Not present -> error
-            throw std::out_of_range("No record found for the provided index.");
+        std::vector<bool> seen(n, false);
+        for (size_t i : order) {
+            if (i >= n || seen[i]) {
+                throw std::invalid_argument("Order is not a permutation of the records.");
+            }
+            seen[i] = true;
         }
     }
 
-    template<typename K, typename R>
-    typename TableAoS<K, R>::record_ptr_t TableAoS<K, R>::get_reference() {
-        // Prepare result
-        record_ptr_t result;
-
-        // Set result to point to array starts
-        util::invoke_n<record_t::count, GetRefHelper>(data, 0u, result);
-
-        return result;
+    /**
+     * Mark records of a table that are associated with any of the provided keys
+     * Keys with no record associated are ignored.
+     *
+     * \tparam T Table type
+     * \param table Table
+     * \param keys Keys to mark
+     * \param count Number of keys
+     * \return Flags indexed by record index, set iff the record is associated with one of the keys
+     */
+    template<typename T>
+    std::vector<bool> mark_keys(T &table, const typename T::key_t *keys, size_t count) {
+        std::vector<bool> marked;
+        mark_keys(table, keys, count, marked);
+        return marked;
     }
 
-    template<typename K, typename R>
-    void TableAoS<K, R>::get_reference(const key_t *keys, record_ptr_t *dest, size_t count) {
-        // Go through each key
-        const key_t *k = keys;
-        record_ptr_t *d = dest;
-        for (size_t i = 0; i < count; i++, k++, d++) {
-            // Set destination to the reference
-            try {
-                *d = get_reference(*k);
-            } catch (std::out_of_range &e) {
-                // Not present -> fill with nullptrs
-                *d = {nullptr};
+    /**
+     * Mark records of a table that are associated with any of the provided keys, reusing the memory of the flags
+     * Keys with no record associated are ignored.
+     *
+     * \tparam T Table type
+     * \param table Table
+     * \param keys Keys to mark
+     * \param count Number of keys
+     * \param marked Destination for the flags indexed by record index (overwritten), set iff the record is associated
+     *  with one of the keys
+     */
+    template<typename T>
+    void mark_keys(T &table, const typename T::key_t *keys, size_t count, std::vector<bool> &marked) {
+        marked.assign(table.size(), false);
+        for (size_t i = 0; i < count; i++) {
+            opt_index found = table.lookup(keys[i]);
+            if (found.is_set()) {
+                marked[found.get()] = true;
             }
         }
     }
 
-    template<typename K, typename R>
-    std::vector<typename TableAoS<K, R>::key_t> TableAoS<K, R>::keys() {
-        std::vector<key_t> result;
-        for (auto kv : map) {
-            result.push_back(kv.first);
+    /**
+     * Mark records of a table that satisfy the predicate
+     *
+     * \tparam T Table type
+     * \tparam P Predicate type
+     * \param table Table
+     * \param pred Predicate taking the key and a reference to the record, returning `true` iff the record is to be marked
+     * \return Flags indexed by record index, set iff the record satisfies the predicate
+     */
+    template<typename T, typename P>
+    std::vector<bool> mark_if(T &table, P pred) {
+        const size_t n = table.size();
+        std::vector<bool> marked(n, false);
+        if (n == 0) {
+            return marked;
         }
-        return result;
-    }
 
-    template<typename K, typename R>
-    TableAoS<K, R>::~TableAoS() {
-        // Deallocate data
-        if (data && capacity > 0) {
-            free(data);
+        const auto &keys = table.keys();
+        auto ref = table.get_reference();
+        for (size_t i = 0; i < n; i++, table.increment_reference(ref)) {
+            marked[i] = pred(keys[i], ref);
         }
+        return marked;
     }
 
-    /** \class TableSoA
-     * Table that stores its records as a struct of arrays
+
+    /** \class Table
+     * Stores records associated with keys.
+     * This is the virtual interface of tables, implementations are used through it by wrapping them in a
+     *  \ref TableAdaptor.
      *
      * \tparam K Key type
      * \tparam R Record type
      */
     template<typename K, typename R>
-    class TableSoA : public Table<K, R> {
+    class Table {
         public:
             //! Key type
             typedef K key_t;
@@ -718,255 +1049,2221 @@ namespace open_sea::data {
             //! Record pointer type (struct of pointers to members of R)
             typedef typename R::Ptr record_ptr_t;
 
-        private:
-            //! Map of keys to indices to the data
-            std::unordered_map<key_t, size_t> map{};
-            //! Start of the data
-            void *data = nullptr;
-            //! Starts of data arrays
-            void *arrays[record_t::count] {nullptr};
-            //! Number of records stored
-            size_t n = 0;
-            //! Allocated space in terms of number of records that fit in it
-            size_t capacity = 0;
-            //! Number of pages allocated
-            size_t pages_alloc = 0;
-
-        public:
-            //! Construct the table and defer allocation to first insertion
-            TableSoA() = default;
+            /**
+             * \brief Add record under the provided key
+             *
+             * Copies the values of the provided record and associates them with the key.
+             * Does nothing when the key already has a record associated with it.
+             *
+             * \param key Key to associate with the record
+             * \param record Record to add
+             * \return index of the record iff the structure was modified (i.e. the record was added), unset otherwise
+             */
+            virtual opt_index add(const key_t &key, const record_t &record) = 0;
 
             /**
-             * Construct the table and allocate space for `count` records
+             * \brief Add records under the provided keys
              *
-             * \param count Number of records to allocate space for
+             * Copies the values of the provided records and associates them with the keys.
+             * Does nothing (at all) when any of the keys already has a record associated with it.
+             * Of keys within the batch that would share a record (the same key repeated, or for sparse maps keys sharing
+             *  an index, such as two generations of an entity), only the last one is added.
+             * The records have to be provided as an array of record instances (AoS layout).
+             *
+             * \param keys Keys to associate with the records
+             * \param records Records to add
+             * \param count Number of records to add
+             * \return `true` iff the structure was modified (i.e. the records were added)
              */
-            explicit TableSoA(size_t count) { allocate(count); }
-
-            opt_index add(const key_t &key, const record_t &record) override;
-            bool add(const key_t *keys, const record_t *records, size_t count) override;
-            bool add(const key_t *keys, const record_ptr_t &records, size_t count) override;
-            opt_index remove(const key_t &key) override;
-            opt_index remove(opt_index idx) override;
-            opt_index lookup(const key_t &key) override;
-            key_t lookup(const opt_index &idx) override;
-            record_t get_copy(const key_t &key) override;
-            record_t get_copy(const opt_index &i) override;
-            record_ptr_t get_reference(const key_t &key) override;
-            record_ptr_t get_reference(const opt_index &i) override;
-            record_ptr_t get_reference() override;
-            void get_reference(const key_t *keys, record_ptr_t *dest, size_t count) override;
-            void increment_reference(record_ptr_t &ref) override { util::invoke_n<record_t::count, IncrementHelper>(ref); }
-            size_t size() override { return n; }
-            std::vector<key_t> keys() override;
-            size_t allocated() override { return capacity; }
-            size_t pages() override { return pages_alloc; }
-            const char* type_name() override { return "SoA"; }
-
-            virtual ~TableSoA();
+            virtual bool add(const key_t *keys, const record_t *records, size_t count) = 0;
 
-        private:
-            //! Helper functor to compute start of Nth data array based on the previous one (N != 0) and the capacity
-            template <size_t N>
-            struct AllocatePtrHelper {
-                void operator()(void **target_arrays, const size_t size) {
-                    auto previous = (typename util::GetMemberType<record_t, N - 1>::type *) target_arrays[N - 1];
-                    previous += size;
-                    target_arrays[N] = (void*) previous;
-                }
+            /**
+             * \brief Add records under the provided keys
+             *
+             * Copies the values of the provided records and associates them with the keys.
+             * Does nothing (at all) when any of the keys already has a record associated with it.
+             * Of keys within the batch that would share a record (the same key repeated, or for sparse maps keys sharing
+             *  an index, such as two generations of an entity), only the last one is added.
+             * The records have to be provided as a record pointer type (SoA layout).
+             *
+             * \param keys Keys to associate with the records
+             * \param records Records to add
+             * \param count Number of records to add
+             * \return `true` iff the structure was modified (i.e. the records were added)
+             */
+            virtual bool add(const key_t *keys, const record_ptr_t &records, size_t count) = 0;
+
+            /**
+             * \brief Remove record at the provided index
+             *
+             * Does nothing when no record is at the index.
+             * Done by copying the last record over the one to be removed and decrementing size.
+             * Potentially reshuffles the data, and therefore invalidates any references to it.
+             *
+             * \param idx Index of record to remove
+             * \return index of the removed element (and where last element was moved) iff the structure was modified
+             *          (i.e. the key was present and associated record removed)
+             */
+            virtual opt_index remove(opt_index idx) = 0;
+
+            /**
+             * \brief Remove record associated with the provided key
+             *
+             * Does nothing when no record is associated with the key.
+             * Done by copying the last record over the one to be removed and decrementing size.
+             * Potentially reshuffles the data, and therefore invalidates any references to it.
+             *
+             * \param key Key to remove
+             * \return index of the removed element (and where last element was moved) iff the structure was modified
+             *          (i.e. the key was present and associated record removed)
+             */
+            virtual opt_index remove(const key_t &key) = 0;
+
+            /**
+             * \brief Remove records associated with the provided keys
+             *
+             * Keys with no record associated are ignored.
+             * Done in a single pass that compacts the remaining records, keeping their order, and updates their indices.
+             * Reshuffles the data, and therefore invalidates any references to it.
+             *
+             * \param keys Keys to remove
+             * \param count Number of keys
+             * \return Number of removed records
+             */
+            virtual size_t remove(const key_t *keys, size_t count) = 0;
+
+            /**
+             * \brief Remove marked records
+             *
+             * Done in a single pass that compacts the remaining records, keeping their order, and updates their indices.
+             * The record at index `i` ends up at `i` minus the number of marked records before it.
+             * Reshuffles the data, and therefore invalidates any references to it.
+             *
+             * \param marked Flags indexed by record index (of size equal to the number of records), set for records to
+             *  remove
+             * \return Number of removed records
+             */
+            virtual size_t remove_marked(const std::vector<bool> &marked) = 0;
+
+            /**
+             * \brief Remove records that satisfy the predicate
+             *
+             * \tparam P Predicate type
+             * \param pred Predicate taking the key and a reference to the record, returning `true` iff the record is to
+             *  be removed
+             * \return Number of removed records
+             */
+            template<typename P>
+            size_t remove_if(P pred) { return remove_marked(mark_if(*this, pred)); }
+
+            /**
+             * \brief Reorder the records
+             *
+             * Applies the permutation to all members and keys in place, and updates the indices of keys.
+             * Reshuffles the data, and therefore invalidates any references to it.
+             *
+             * \param order Permutation (position `i` holds the current index of the record to move to `i`)
+             *
+             * \throws std::invalid_argument When the order is not a permutation of the records
+             */
+            virtual void permute(const std::vector<size_t> &order) = 0;
+
+            /**
+             * \brief Swap two records
+             *
+             * Exchanges the records (and their keys) at the two indices, and updates the indices of their keys.
+             * Invalidates any references to the two records.
+             *
+             * \param a Index of the first record
+             * \param b Index of the second record
+             *
+             * \throws std::invalid_argument When either index is unset
+             * \throws std::out_of_range When either index is outside the table
+             */
+            virtual void swap(const opt_index &a, const opt_index &b) = 0;
+
+            /**
+             * \brief Sort the records by a value computed for each record
+             *
+             * The sort is stable.
+             * Reshuffles the data, and therefore invalidates any references to it.
+             * The returned permutation can be used to update any stored indices (see \ref invert_order).
+             *
+             * \tparam F Function type
+             * \param f Function taking the key and a reference to the record, returning the value to sort by
+             * \return Applied permutation (position `i` holds the previous index of the record now at `i`)
+             */
+            template<typename F>
+            std::vector<size_t> sort(F f) {
+                std::vector<size_t> order = sorted_order(*this, f);
+                permute(order);
+                return order;
+            }
+
+            /**
+             * Set a member of the record under the provided key, recording the change
+             *
+             * \tparam N Index of the member
+             * \tparam V Value type
+             * \param key Key
+             * \param value New value of the member
+             *
+             * \throws std::out_of_range When no record is associated with the provided key
+             */
+            template<size_t N, typename V>
+            void set(const key_t &key, const V &value) {
+                Table &table = *this;
+                *std::invoke(util::get_pointer_to_member<record_ptr_t, N>(), table.get_reference(key)) = value;
+                table.touch(key, column(N));
+            }
+
+            /**
+             * Set a member of the record at the provided index, recording the change
+             *
+             * \tparam N Index of the member
+             * \tparam V Value type
+             * \param i Index
+             * \param value New value of the member
+             *
+             * \throws std::out_of_range When no record is at the provided index
+             */
+            template<size_t N, typename V>
+            void set(const opt_index &i, const V &value) {
+                Table &table = *this;
+                *std::invoke(util::get_pointer_to_member<record_ptr_t, N>(), table.get_reference(i)) = value;
+                table.touch(i, column(N));
+            }
+
+            /**
+             * Apply the function to the records with any of the selected columns changed since changes were last cleared
+             * Requires change tracking to be enabled (see \ref track_changes).
+             * The function must not touch any records or add or remove any records.
+             *
+             * \tparam F Function type
+             * \param f Function taking the key, a reference to the record and the mask of its changed columns (limited
+             *  to the selected ones)
+             * \param columns Mask of the selected columns
+             */
+            template<typename F>
+            void for_each_changed(F f, uint64_t columns = all_columns) {
+                apply_changed(*this, f, columns);
+            }
+
+            /**
+             * Get index of the record that adding the provided key would evict
+             * For sparse maps, this is the record of a different key sharing the same index (e.g. a dead entity of an
+             *  older generation).
+             *
+             * \param key Key about to be added
+             * \return Instance of `opt_index` with the index, or unset if adding the key would evict no record
+             */
+            virtual opt_index conflict(const key_t &key) = 0;
+
+            /**
+             * Get index of record under the provided key
+             *
+             * \param key Key to look up
+             * \return Instance of `opt_index` with the index, or unset if no record associated with the provided key
+             */
+            virtual opt_index lookup(const key_t &key) = 0;
+
+            /**
+             * Get key of record at the provided index
+             *
+             * \param idx Index to look up
+             * \return Instance of `key_t` with which the index is associated
+             *
+             * \throws std::out_of_range When no record is at the provided index
+             */
+            virtual key_t lookup(const opt_index &idx) = 0;
+
+            /**
+             * Get copy of record under the provided key
+             *
+             * \param key Key to look up
+             * \return Instance of R whose members are copies of values associated with the provided key
+             *
+             * \throws std::out_of_range When no record is associated with the provided key
+             */
+            virtual record_t get_copy(const key_t &key) = 0;
+
+            /**
+             * Get copy of record at the provided index
+             *
+             * \param i Index
+             * \return Instance of R whose members are copies of values at the provided index
+             *
+             * \throws std::out_of_range When no record is at the provided index
+             */
+            virtual record_t get_copy(const opt_index &i) = 0;
+
+            /**
+             * Get read-write reference to the record under the provided key
+             *
+             * \param key Key to look up
+             * \return Instance of R::Ptr (struct of pointers to members of R) whose members point to the values
+             *  associated with the provided key
+             *
+             * \throws std::out_of_range When no record is associated with the provided key
+             */
+            virtual record_ptr_t get_reference(const key_t &key) = 0;
+
+            /**
+             * Get read-write reference to the record at the provided index
+             *
+             * \param i Index
+             * \return Instance of R::Ptr (struct of pointers to members of R) whose members point to the values
+             *  at the provided index
+             *
+             * \throws std::out_of_range When no record is at the provided index
+             */
+            virtual record_ptr_t get_reference(const opt_index &i) = 0;
+
+            /**
+             * Get read-write references to the records under the provided keys
+             * References are set to `nullptr` when no record is associated with that key
+             *
+             * \param keys Keys to look up
+             * \param dest Array of size `count` with R:Ptr instances to fill with the references
+             * \param count Number of records to look up
+             */
+            virtual void get_reference(const key_t *keys, record_ptr_t *dest, size_t count) = 0;
+
+            /**
+             * Get read-write reference to the first record
+             * Undefined when empty
+             *
+             * \return Instance of R::Ptr (struct of pointers to members of R) whose members point to the values
+             *  associated with the first record
+             */
+            virtual record_ptr_t get_reference() = 0;
+
+            /**
+             * Increment reference to point to the next record
+             *
+             * \param ref Reference to increment
+             */
+            virtual void increment_reference(record_ptr_t &ref) = 0;
+
+            /**
+             * Get number of segments the records are stored in
+             * A segment is a run of records in which the values of each member are evenly spaced in memory.
+             *
+             * \return Number of non-empty segments
+             */
+            virtual size_t segment_count() = 0;
+
+            /**
+             * Get start and layout of a segment
+             *
+             * \param seg Segment index (less than \ref segment_count)
+             * \param start Reference to fill with pointers to the values of the first record in the segment
+             * \param stride Set to the distance in bytes between values of consecutive records, or to 0 when the values
+             *  of each member are packed (i.e. the distance is the size of the member)
+             * \return Number of records in the segment
+             */
+            virtual size_t segment(size_t seg, record_ptr_t &start, size_t &stride) = 0;
+
+            /**
+             * Note that a scan read the selected columns of a number of records (e.g. of a segment)
+             * Called by views (see \ref View), so that tables adapting their layout to how they are accessed (see
+             *  \ref TableAdaptive) know which columns are scanned. Other tables ignore it.
+             *
+             * \param columns Mask of the read columns (see \ref column)
+             * \param count Number of records
+             */
+            virtual void sample_scan(uint64_t columns, size_t count) = 0;
+
+            /**
+             * Get a view over the selected members of all records
+             * The view resolves the storage layout once per segment, so iterating it doesn't go through virtual calls
+             *  per record and only touches the selected members.
+             *
+             * \tparam N Indices of the members to view
+             * \return View over the members
+             */
+            template<size_t... N>
+            View<Table, N...> view() { return View<Table, N...>(*this); }
+
+            //! Get number of records
+            virtual size_t size() = 0;
+
+            //! Get keys of all records, in index order (i.e. the key of record `i` is at position `i`)
+            virtual const std::vector<key_t> &keys() = 0;
+
+            /**
+             * Get structure version
+             * The version changes whenever a record is added, removed or moved to a different index, so that data derived
+             *  from the structure (e.g. cached indices) can be checked for staleness.
+             *
+             * \return Structure version
+             */
+            virtual uint64_t version() = 0;
+
+            /**
+             * Enable or disable tracking of changed records (disabled by default)
+             * Column versions are kept either way, and disabling the tracking clears the tracked changes.
+             * Changes are only recorded through \ref touch and \ref set, as writes through references can't be observed.
+             * Adding or removing records isn't a change (see \ref version for that).
+             *
+             * \param enable Whether to track changed records
+             */
+            virtual void track_changes(bool enable) = 0;
+
+            //! Check whether changed records are tracked
+            virtual bool tracking_changes() = 0;
+
+            /**
+             * Get version of a column
+             * The version is incremented by every recorded change to the column, so that data derived from it (e.g.
+             *  uploaded to the GPU) can be checked for staleness.
+             *
+             * \param c Index of the member
+             * \return Column version
+             *
+             * \throws std::out_of_range When the record has no such member
+             */
+            virtual uint64_t column_version(size_t c) = 0;
+
+            /**
+             * Record a change to the record under the provided key
+             *
+             * \param key Key
+             * \param columns Mask of the changed members (see \ref column)
+             */
+            virtual void touch(const key_t &key, uint64_t columns = all_columns) = 0;
+
+            /**
+             * Record a change to the record at the provided index
+             *
+             * \param i Index
+             * \param columns Mask of the changed members (see \ref column)
+             *
+             * \throws std::out_of_range When no record is at the provided index
+             */
+            virtual void touch(const opt_index &i, uint64_t columns = all_columns) = 0;
+
+            /**
+             * Get the members of the record under the provided key changed since changes were last cleared
+             *
+             * \param key Key
+             * \return Mask of the changed members (zero if none, or if changes aren't tracked)
+             */
+            virtual uint64_t changes(const key_t &key) = 0;
+
+            //! Get keys whose records changed since changes were last cleared (may include keys no longer present)
+            virtual const std::vector<key_t> &changed_keys() = 0;
+
+            //! Forget the tracked changes (column versions are kept)
+            virtual void clear_changes() = 0;
+
+            /**
+             * Lock the structure, so that adding, removing or moving records throws until it is unlocked
+             * Used to keep references and column pointers valid while they are used (e.g. by worker threads).
+             * Locks nest, i.e. the structure stays locked until each lock is matched by an unlock (see \ref
+             *  StructureLock).
+             * Writing the records' members is still allowed.
+             */
+            virtual void lock_structure() = 0;
+
+            //! Release a lock of the structure
+            virtual void unlock_structure() = 0;
+
+            //! Check whether the structure is locked
+            virtual bool structure_locked() = 0;
+
+            //! Get counts of the table's operations (all zero unless \ref open_sea::table_stats is enabled)
+            virtual TableStats stats() = 0;
+
+            //! Reset counts of the table's operations
+            virtual void reset_stats() = 0;
+
+            /**
+             * Reserve space for at least the given amount of records, optionally pre-faulting it
+             * Pre-faulting maps all pages of the space up front, so that filling the table later does not page fault.
+             *
+             * \param size Number of records to reserve space for
+             * \param prefault Whether to pre-fault the space
+             */
+            virtual void reserve(size_t size, bool prefault = false) = 0;
+
+            /**
+             * Shrink the allocated space to the smallest that fits the current records
+             * Moves the records if any pages are freed, invalidating references to them.
+             *
+             * \throws std::logic_error When the structure is locked
+             */
+            virtual void shrink_to_fit() = 0;
+
+            /**
+             * Shrink the allocated space iff fewer than 1 / \ref shrink_ratio of it is used
+             * The space is shrunk to fit twice the current records, so that a table whose size oscillates doesn't
+             *  reallocate each time (hysteresis between growing on full and shrinking on a quarter full).
+             * Meant to be called periodically off the critical path (e.g. after garbage collection), so that memory use
+             *  follows the live records without reallocating on removal.
+             * Does nothing while the structure is locked.
+             *
+             * \return Number of freed pages
+             */
+            virtual size_t trim() = 0;
+
+            //! Get number of allocated records
+            virtual size_t allocated() = 0;
+
+            //! Get number of allocated pages
+            virtual size_t pages() = 0;
+
+            //! Get name of the table type (ie the storage scheme)
+            virtual const char* type_name() = 0;
+
+            virtual ~Table() = default;
+    };
+
+    /** \class View
+     * View over selected members of all records in a table.
+     * Iteration proceeds one segment (see \ref Table::segment) at a time, with a single table call per segment.
+     * Each segment's records are reported to the table as a scan of the viewed columns (see \ref Table::sample_scan).
+     * Within a segment the values are accessed through plain pointers, so that loops over packed members can be
+     *  vectorised by the compiler.
+     * Like references, a view's iteration is invalidated by changes to the table's structure.
+     *
+     * Example:
+     * ```
+     * for (auto [position, matrix] : table->view<0, 3>()) { ... }
+     * table->view<0>().for_each([](glm::vec3 &position){ ... });
+     * ```
+     *
+     * \tparam T Table type (either \ref Table or a concrete table, in which case the calls are not virtual at all)
+     * \tparam N Indices of the viewed members
+     */
+    template<typename T, size_t... N>
+    class View {
+        public:
+            //! Record type
+            typedef typename T::record_t record_t;
+            //! Record pointer type (struct of pointers to members of R)
+            typedef typename T::record_ptr_t record_ptr_t;
+            //! Type of the Ith member of R
+            template<size_t I>
+            using member_t = typename util::GetMemberType<record_t, I>::type;
+            //! Type of a viewed record (tuple of references to the viewed members)
+            typedef std::tuple<member_t<N>&...> value_t;
+
+            /** \struct Chunk
+             * Range of consecutive viewed records within a segment
+             */
+            struct Chunk {
+                //! Number of records
+                size_t count;
+                //! Distance in bytes between values of consecutive records (0 when packed)
+                size_t stride;
+                //! Pointers to the viewed members of the first record
+                std::tuple<member_t<N> *...> firsts;
+            };
+
+            static_assert(sizeof...(N) > 0, "View has to select at least one member.");
+
+            //! Mask of the viewed columns
+            static constexpr uint64_t columns = (column(N) | ...);
+
+            //! Iterator over the viewed records
+            class Iterator {
+                private:
+                    //! Viewed table
+                    T *table = nullptr;
+                    //! Number of segments in the table
+                    size_t segments = 0;
+                    //! Index of current segment
+                    size_t seg = 0;
+                    //! Index of current record within the segment
+                    size_t i = 0;
+                    //! Number of records in the current segment
+                    size_t count = 0;
+                    //! Pointers to values of the first record in the current segment
+                    record_ptr_t start{};
+                    //! Stride of the current segment (0 when packed)
+                    size_t stride = 0;
+
+                    //! Load the segment at the current segment index, or become an end iterator past the last one
+                    void load() {
+                        if (seg < segments) {
+                            count = table->segment(seg, start, stride);
+                            table->sample_scan(columns, count);
+                        } else {
+                            seg = segments;
+                            count = 0;
+                        }
+                        i = 0;
+                    }
+
+                    //! Get reference to the Ith member of the current record
+                    template<size_t I>
+                    member_t<I> &get() const {
+                        member_t<I> *first = std::invoke(util::get_pointer_to_member<record_ptr_t, I>(), start);
+                        if (stride == 0) {
+                            return first[i];
+                        } else {
+                            return *reinterpret_cast<member_t<I> *>(reinterpret_cast<unsigned char *>(first) + i * stride);
+                        }
+                    }
+
+                public:
+                    //! Construct an end iterator
+                    Iterator() = default;
+
+                    /**
+                     * Construct an iterator pointing to the first record in the provided segment
+                     *
+                     * \param table Viewed table
+                     * \param seg Segment index (segment count for an end iterator)
+                     */
+                    Iterator(T *table, size_t seg) : table(table), segments(table->segment_count()), seg(seg) { load(); }
+
+                    value_t operator*() const { return value_t(get<N>()...); }
+
+                    Iterator &operator++() {
+                        if (++i >= count) {
+                            seg++;
+                            load();
+                        }
+                        return *this;
+                    }
+
+                    bool operator==(const Iterator &other) const { return seg == other.seg && i == other.i; }
+                    bool operator!=(const Iterator &other) const { return !(*this == other); }
+            };
+
+        private:
+            //! Viewed table
+            T &table;
+
+            /**
+             * Apply the function to each record of a segment whose members are packed
+             *
+             * \param count Number of records
+             * \param f Function to apply
+             * \param arrays Arrays of the viewed members
+             */
+            template<typename F, typename... V>
+            static void apply_packed(size_t count, F &f, V *... arrays) {
+                for (size_t i = 0; i < count; i++) {
+                    f(arrays[i]...);
+                }
+            }
+
+            /**
+             * Apply the function to each record of a segment whose members are spaced by the stride
+             *
+             * \param count Number of records
+             * \param stride Distance in bytes between values of consecutive records
+             * \param f Function to apply
+             * \param firsts Values of the first record
+             */
+            template<typename F, typename... V>
+            static void apply_strided(size_t count, size_t stride, F &f, V *... firsts) {
+                for (size_t i = 0; i < count; i++) {
+                    f(*reinterpret_cast<V *>(reinterpret_cast<unsigned char *>(firsts) + i * stride)...);
+                }
+            }
+
+            //! Get pointer to the value `offset` records after the first one
+            template<typename V>
+            static V *advance(V *first, size_t offset, size_t stride) {
+                if (stride == 0) {
+                    return first + offset;
+                }
+                return reinterpret_cast<V *>(reinterpret_cast<unsigned char *>(first) + offset * stride);
+            }
+
+        public:
+            //! Construct a view over the table
+            explicit View(T &table) : table(table) {}
+
+            Iterator begin() const { return Iterator(&table, 0); }
+            Iterator end() const { return Iterator(&table, table.segment_count()); }
+
+            /**
+             * Apply the function to the viewed members of each record, in index order
+             * This is the fastest way to iterate, as the loop over each segment is a plain loop over arrays.
+             *
+             * \param f Function taking references to the viewed members (in the order of `N`)
+             */
+            template<typename F>
+            void for_each(F &&f) const {
+                const size_t segments = table.segment_count();
+                record_ptr_t start;
+                size_t stride;
+                for (size_t seg = 0; seg < segments; seg++) {
+                    const size_t count = table.segment(seg, start, stride);
+                    table.sample_scan(columns, count);
+                    if (stride == 0) {
+                        apply_packed(count, f, std::invoke(util::get_pointer_to_member<record_ptr_t, N>(), start)...);
+                    } else {
+                        apply_strided(count, stride, f, std::invoke(util::get_pointer_to_member<record_ptr_t, N>(), start)...);
+                    }
+                }
+            }
+
+            /**
+             * Split the viewed records into chunks of consecutive records
+             * Each segment is split separately, into chunks of the provided size except for the last one.
+             * With a size that is a multiple of the cache line size (in records), chunks of aligned columns start on
+             *  cache lines, so no two chunks share a cache line.
+             * Like references, the chunks are invalidated by changes to the table's structure.
+             *
+             * \param size Maximum number of records in a chunk (non-zero)
+             * \return Chunks in index order
+             */
+            std::vector<Chunk> chunks(size_t size) const {
+                assert(size > 0);
+                std::vector<Chunk> result;
+                const size_t segments = table.segment_count();
+                record_ptr_t start;
+                size_t stride;
+                for (size_t seg = 0; seg < segments; seg++) {
+                    const size_t count = table.segment(seg, start, stride);
+                    table.sample_scan(columns, count);
+                    for (size_t offset = 0; offset < count; offset += size) {
+                        result.push_back(Chunk{std::min(size, count - offset), stride, std::make_tuple(
+                                advance(std::invoke(util::get_pointer_to_member<record_ptr_t, N>(), start), offset, stride)...)});
+                    }
+                }
+                return result;
+            }
+
+            /**
+             * Apply the function to the viewed members of each record in the chunk, in index order
+             *
+             * \param chunk Chunk
+             * \param f Function taking references to the viewed members (in the order of `N`)
+             */
+            template<typename F>
+            static void apply(const Chunk &chunk, F &f) {
+                std::apply([&chunk, &f](member_t<N> *... firsts) {
+                    if (chunk.stride == 0) {
+                        apply_packed(chunk.count, f, firsts...);
+                    } else {
+                        apply_strided(chunk.count, chunk.stride, f, firsts...);
+                    }
+                }, chunk.firsts);
+            }
+    };
+
+    /** \class StorageBase
+     * Static base of the record storages.
+     * A storage only decides where the members of each record are in memory, and leaves the keys and the order of the
+     *  records to the table using it (see \ref TableBase).
+     * Each storage derives from it with itself as `S` and provides the address of each member of a record
+     *  (`address<N>(i)`) and the number of records from a record on whose member is packed after it (`run<N>(i)`).
+     * Copying, moving and referring to records is then implemented in terms of those, but a storage may provide faster
+     *  versions where its layout allows it (e.g. copying whole records in \ref StorageAoS).
+     *
+     * Besides that, each storage provides:
+     *  - `grow(size, n)` and `shrink(size, n)` to resize its space to fit `size` records, keeping the first `n`, and
+     *     returning the number of bytes copied (`shrink(0, 0)` frees all its space)
+     *  - `prefault()` to pre-fault its space
+     *  - `increment_reference(ref)` to move a reference to the next record
+     *  - `segment_count(n)` and `segment(seg, n, start, stride)` to describe the segments of the first `n` records
+     *  - `allocated()`, `pages()` and `type_name()` as described in \ref Table
+     *
+     * \tparam S Storage type
+     * \tparam R Record type
+     */
+    template<typename S, typename R>
+    class StorageBase {
+        public:
+            //! Record type
+            typedef R record_t;
+            //! Record pointer type (struct of pointers to members of R)
+            typedef typename R::Ptr record_ptr_t;
+
+            StorageBase(const StorageBase &other) = delete;
+            StorageBase &operator=(const StorageBase &other) = delete;
+
+            /**
+             * Copy the record to the index
+             *
+             * \param i Index
+             * \param record Record to copy
+             */
+            void write(size_t i, const record_t &record) {
+                util::invoke_n<record_t::count, WriteHelper>(self(), i, record);
+            }
+
+            /**
+             * Copy the records to the consecutive indices starting at the index
+             *
+             * \param i First index
+             * \param records Records to copy
+             * \param count Number of records
+             */
+            void write(size_t i, const record_t *records, size_t count) {
+                for (size_t k = 0; k < count; k++) {
+                    static_cast<S &>(*this).write(i + k, records[k]);
+                }
+            }
+
+            /**
+             * Copy the records to the consecutive indices starting at the index, one member at a time
+             *
+             * \param i First index
+             * \param records Pointers to the first values of each member (each packed)
+             * \param count Number of records
+             */
+            void write(size_t i, const record_ptr_t &records, size_t count) {
+                util::invoke_n<record_t::count, WritesHelper>(self(), i, records, count);
+            }
+
+            /**
+             * Copy the record at the index
+             *
+             * \param i Index
+             * \return Copy of the record
+             */
+            record_t read(size_t i) const {
+                record_t result;
+                util::invoke_n<record_t::count, ReadHelper>(self(), i, result);
+                return result;
+            }
+
+            /**
+             * Copy the record at one index over the record at another
+             *
+             * \param to Index to copy to
+             * \param from Index to copy from
+             */
+            void move_record(size_t to, size_t from) {
+                util::invoke_n<record_t::count, MoveHelper>(self(), to, from);
+            }
+
+            /**
+             * Point to the record at the index
+             *
+             * \param i Index
+             * \return Pointers to the record's members
+             */
+            record_ptr_t reference(size_t i) const {
+                record_ptr_t result;
+                util::invoke_n<record_t::count, RefHelper>(self(), i, result);
+                return result;
+            }
+
+            /**
+             * Point to the records at the indices
+             *
+             * \param indices Indices
+             * \param misses Miss mask (bit `k` set iff index `k` is not valid, in which case the reference is null)
+             * \param dest Destination for the references
+             * \param count Number of indices (at most \ref lookup_batch)
+             */
+            void references(const size_t *indices, uint64_t misses, record_ptr_t *dest, size_t count) const {
+                util::invoke_n<record_t::count, RefsHelper>(self(), indices, misses, dest, count);
+            }
+
+        protected:
+            StorageBase() = default;
+            ~StorageBase() = default;
+
+            //! Get the storage implementation
+            const S &self() const { return static_cast<const S &>(*this); }
+
+        private:
+            //! Helper functor to copy the Nth member of the provided record to its place
+            template <size_t N>
+            struct WriteHelper {
+                void operator()(const S &s, const size_t i, const record_t &record) {
+                    *s.template address<N>(i) = std::invoke(util::get_pointer_to_member<record_t, N>(), record);
+                }
+            };
+
+            //! Helper functor to copy the Nth members of the provided records to their places, one run at a time
+            template <size_t N>
+            struct WritesHelper {
+                void operator()(const S &s, const size_t offset, const record_ptr_t &records, size_t count) {
+                    auto src = std::invoke(util::get_pointer_to_member<record_ptr_t, N>(), records);
+                    for (size_t done = 0; done < count;) {
+                        const size_t i = offset + done;
+                        const size_t run = std::min(count - done, s.template run<N>(i));
+                        std::copy_n(src + done, run, s.template address<N>(i));
+                        done += run;
+                    }
+                }
+            };
+
+            //! Helper functor to fill Nth member of R with a copy of the appropriate value of record i
+            template <size_t N>
+            struct ReadHelper {
+                void operator()(const S &s, const size_t i, record_t &result) {
+                    std::invoke(util::get_pointer_to_member<record_t, N>(), result) = *s.template address<N>(i);
+                }
+            };
+
+            //! Helper functor to copy Nth member of a record (e.g. the last one) to the provided index
+            template <size_t N>
+            struct MoveHelper {
+                void operator()(const S &s, const size_t to, const size_t from) {
+                    *s.template address<N>(to) = *s.template address<N>(from);
+                }
+            };
+
+            //! Helper functor to fill Nth member of R::Ptr with a pointer to the appropriate value of record i
+            template <size_t N>
+            struct RefHelper {
+                void operator()(const S &s, const size_t i, record_ptr_t &result) {
+                    std::invoke(util::get_pointer_to_member<record_ptr_t, N>(), result) = s.template address<N>(i);
+                }
+            };
+
+            //! Helper functor to fill Nth members of R::Ptr array elements with pointers to the appropriate values of
+            //!     records at the resolved indices (`nullptr` where the miss mask bit is set)
+            template <size_t N>
+            struct RefsHelper {
+                void operator()(const S &s, const size_t *indices, const uint64_t misses, record_ptr_t *dest, size_t count) {
+                    for (size_t i = 0; i < count; i++) {
+                        std::invoke(util::get_pointer_to_member<record_ptr_t, N>(), dest[i]) =
+                                ((misses >> i) & 1u) ? nullptr : s.template address<N>(indices[i]);
+                    }
+                }
+            };
+    };
+
+    /** \class StorageAoS
+     * Record storage as an array of structs
+     *
+     * \tparam R Record type
+     * \tparam A Allocation policy (e.g. \ref HeapAllocation or \ref MappedAllocation)
+     */
+    template<typename R, typename A = HeapAllocation>
+    class StorageAoS : public StorageBase<StorageAoS<R, A>, R> {
+        public:
+            //! Record type
+            typedef R record_t;
+            //! Record pointer type (struct of pointers to members of R)
+            typedef typename R::Ptr record_ptr_t;
+
+        private:
+            //! Start of the data
+            record_t *data = nullptr;
+            //! Allocated space in terms of number of records that fit in it
+            size_t capacity = 0;
+            //! Number of pages allocated
+            size_t pages_alloc = 0;
+
+        public:
+            StorageAoS() = default;
+
+            using StorageBase<StorageAoS<R, A>, R>::write;
+            void write(size_t i, const record_t &record) { data[i] = record; }
+            void write(size_t i, const record_t *records, size_t count) { std::copy_n(records, count, data + i); }
+            record_t read(size_t i) const { return data[i]; }
+            void move_record(size_t to, size_t from) { data[to] = data[from]; }
+
+            /**
+             * Get address of the Nth member of the record at the provided index
+             *
+             * \tparam N Member index
+             * \param i Record index
+             * \return Address of the member
+             */
+            template <size_t N>
+            typename util::GetMemberType<record_t, N>::type *address(size_t i) const {
+                return &(std::invoke(util::get_pointer_to_member<record_t, N>(), data[i]));
+            }
+
+            //! Get the number of records from the index on whose Nth member is packed (none, members are interleaved)
+            template <size_t N>
+            size_t run(size_t /*i*/) const { return 1; }
+
+            size_t grow(size_t size, size_t n) { return resize(round_pages(size * sizeof(record_t)), n); }
+            size_t shrink(size_t size, size_t n);
+            void prefault() {
+                if (data) {
+                    prefault_pages(data, pages_alloc * sysconf(_SC_PAGESIZE));
+                }
+            }
+            void increment_reference(record_ptr_t &ref) const { util::invoke_n<record_t::count, IncrementHelper>(ref); }
+            size_t segment_count(size_t n) const { return n > 0 ? 1 : 0; }
+            size_t segment(size_t seg, size_t n, record_ptr_t &start, size_t &stride) const;
+            size_t allocated() const { return capacity; }
+            size_t pages() const { return pages_alloc; }
+            const char* type_name() const { return "AoS"; }
+
+            ~StorageAoS() { resize(0, 0); }
+
+        private:
+            //! Helper functor to increment Nth member of R::Ptr
+            template <size_t N>
+            struct IncrementHelper {
+                void operator()(record_ptr_t &ref) {
+                    // Increment member by sizeof(R) bytes (next element, same offset)
+                    // Note: cast to byte ptr -> increment by size of R -> cast back to member type ptr
+                    typedef typename util::GetMemberType<record_ptr_t, N>::type member_type;
+                    auto member_p = util::get_pointer_to_member<record_ptr_t, N>();
+                    std::invoke(member_p, ref) = (member_type) (((unsigned char *) std::invoke(member_p, ref)) + sizeof(record_t));
+                }
+            };
+
+            size_t resize(size_t pages_target, size_t n);
+    };
+
+    /**
+     * Resize the space to the number of pages, keeping the first `n` records
+     * The space is grown by the allocation policy if it can, and otherwise the records are copied over to new space.
+     *
+     * \tparam R Record type
+     * \tparam A Allocation policy
+     * \param pages_target Number of pages
+     * \param n Number of records to keep
+     * \return Number of bytes copied
+     */
+    template<typename R, typename A>
+    size_t StorageAoS<R, A>::resize(size_t pages_target, size_t n) {
+        void *block = data;
+        const size_t copied = resize_block<A>(block, pages_alloc, pages_target, n * sizeof(record_t));
+        data = static_cast<record_t *>(block);
+        capacity = pages_alloc * sysconf(_SC_PAGESIZE) / sizeof(record_t);
+        return copied;
+    }
+
+    /**
+     * Shrink the space to the smallest that fits `size` records, if that frees any pages
+     *
+     * \tparam R Record type
+     * \tparam A Allocation policy
+     * \param size Number of records to keep space for (at least `n`)
+     * \param n Number of records to keep
+     * \return Number of bytes copied
+     */
+    template<typename R, typename A>
+    size_t StorageAoS<R, A>::shrink(size_t size, size_t n) {
+        const size_t pages_target = round_pages(size * sizeof(record_t));
+        return (pages_target < pages_alloc) ? resize(pages_target, n) : 0;
+    }
+
+    /**
+     * Get start and layout of a segment.
+     * All records are in a single segment, in which values of each member are spaced by the size of the record.
+     *
+     * \tparam R Record type
+     * \tparam A Allocation policy
+     * \param seg Segment index (has to be 0)
+     * \param n Number of records
+     * \param start Reference to fill with pointers to the values of the first record
+     * \param stride Set to the size of the record
+     * \return Number of records
+     */
+    template<typename R, typename A>
+    size_t StorageAoS<R, A>::segment(size_t seg, size_t n, record_ptr_t &start, size_t &stride) const {
+        assert(seg == 0 && n > 0);
+        start = this->reference(0);
+        stride = sizeof(record_t);
+        return n;
+    }
+
+    /** \class StorageSoA
+     * Record storage as a struct of arrays
+     * Each array is a separate page-aligned block, so that vectorised code can use aligned loads and each array can be
+     *  grown by the allocation policy on its own (with \ref MappedAllocation, growth then never copies the records).
+     *
+     * \tparam R Record type
+     * \tparam A Allocation policy (e.g. \ref HeapAllocation or \ref MappedAllocation)
+     */
+    template<typename R, typename A = HeapAllocation>
+    class StorageSoA : public StorageBase<StorageSoA<R, A>, R> {
+        public:
+            //! Record type
+            typedef R record_t;
+            //! Record pointer type (struct of pointers to members of R)
+            typedef typename R::Ptr record_ptr_t;
+
+        private:
+            //! Starts of data arrays
+            void *arrays[record_t::count] {nullptr};
+            //! Number of pages allocated to each data array
+            size_t array_pages[record_t::count] {0};
+            //! Allocated space in terms of number of records that fit in it
+            size_t capacity = 0;
+            //! Number of pages allocated
+            size_t pages_alloc = 0;
+
+        public:
+            StorageSoA() = default;
+
+            /**
+             * Get address of the Nth member of the record at the provided index
+             *
+             * \tparam N Member index
+             * \param i Record index
+             * \return Address of the member
+             */
+            template <size_t N>
+            typename util::GetMemberType<record_t, N>::type *address(size_t i) const {
+                typedef typename util::GetMemberType<record_t, N>::type member_type;
+                return static_cast<member_type *>(arrays[N]) + i;
+            }
+
+            //! Get the number of records from the index on whose Nth member is packed (all, each array is contiguous)
+            template <size_t N>
+            size_t run(size_t /*i*/) const { return std::numeric_limits<size_t>::max(); }
+
+            size_t grow(size_t size, size_t n);
+            size_t shrink(size_t size, size_t n);
+            void prefault() {
+                for (size_t i = 0; i < record_t::count; i++) {
+                    if (arrays[i]) {
+                        prefault_pages(arrays[i], array_pages[i] * sysconf(_SC_PAGESIZE));
+                    }
+                }
+            }
+            void increment_reference(record_ptr_t &ref) const { util::invoke_n<record_t::count, IncrementHelper>(ref); }
+            size_t segment_count(size_t n) const { return n > 0 ? 1 : 0; }
+            size_t segment(size_t seg, size_t n, record_ptr_t &start, size_t &stride) const;
+            size_t allocated() const { return capacity; }
+            size_t pages() const { return pages_alloc; }
+            const char* type_name() const { return "SoA"; }
+
+            ~StorageSoA() { shrink(0, 0); }
+
+        private:
+            //! Helper functor to add the number of pages the Nth data array needs to fit `size` records to the total
+            template <size_t N>
+            struct PagesHelper {
+                void operator()(size_t &pages, const size_t size) {
+                    typedef typename util::GetMemberType<record_t, N>::type member_type;
+                    pages += (size > 0) ? round_pages(size * sizeof(member_type)) : 0;
+                }
+            };
+
+            //! Helper functor to resize the Nth data array to fit `size` records, keeping the first `count`, and lower
+            //!     the capacity to the number of records that fit in it
+            template <size_t N>
+            struct ResizeHelper {
+                void operator()(void **arrays, size_t *pages, const size_t size, const size_t count, size_t &capacity,
+                                size_t &copied) {
+                    typedef typename util::GetMemberType<record_t, N>::type member_type;
+                    const size_t pages_target = (size > 0) ? round_pages(size * sizeof(member_type)) : 0;
+                    copied += resize_block<A>(arrays[N], pages[N], pages_target, count * sizeof(member_type));
+                    capacity = std::min(capacity, pages[N] * sysconf(_SC_PAGESIZE) / sizeof(member_type));
+                }
+            };
+
+            //! Helper functor to increment Nth member of R::Ptr
+            template <size_t N>
+            struct IncrementHelper {
+                void operator()(record_ptr_t &ref) {
+                    // Increment member by 1 (next element of its array)
+                    auto member_p = util::get_pointer_to_member<record_ptr_t, N>();
+                    std::invoke(member_p, ref)++;
+                }
+            };
+    };
+
+    /**
+     * Grow the space to fit at least the given amount of records.
+     * Size of the space of each array is rounded up to the nearest 2^N pages.
+     * Each array is grown by the allocation policy if it can, and otherwise its records are copied over to new space.
+     *
+     * \tparam R Record type
+     * \tparam A Allocation policy
+     * \param size Number of records to allocate space for
+     * \param n Number of records to keep
+     * \return Number of bytes copied
+     */
+    template<typename R, typename A>
+    size_t StorageSoA<R, A>::grow(size_t size, size_t n) {
+        // Resize each array, fitting as many records as the smallest one can hold
+        size_t capacity_target = std::numeric_limits<size_t>::max();
+        size_t copied = 0;
+        util::invoke_n<record_t::count, ResizeHelper>(arrays, array_pages, size, n, capacity_target, copied);
+        assert(capacity_target >= size);
+
+        capacity = capacity_target;
+        pages_alloc = std::accumulate(std::begin(array_pages), std::end(array_pages), static_cast<size_t>(0));
+        return copied;
+    }
+
+    /**
+     * Shrink the space to the smallest that fits `size` records, if that frees any pages
+     *
+     * \tparam R Record type
+     * \tparam A Allocation policy
+     * \param size Number of records to keep space for (at least `n`)
+     * \param n Number of records to keep
+     * \return Number of bytes copied
+     */
+    template<typename R, typename A>
+    size_t StorageSoA<R, A>::shrink(size_t size, size_t n) {
+        // Calculate target space size, skipping if no pages would be freed
+        size_t pages_target = 0;
+        util::invoke_n<record_t::count, PagesHelper>(pages_target, size);
+        if (pages_target >= pages_alloc) {
+            return 0;
+        }
+
+        // Resize each array, fitting as many records as the smallest one can hold
+        size_t capacity_target = (size > 0) ? std::numeric_limits<size_t>::max() : 0;
+        size_t copied = 0;
+        util::invoke_n<record_t::count, ResizeHelper>(arrays, array_pages, size, n, capacity_target, copied);
+
+        capacity = capacity_target;
+        pages_alloc = pages_target;
+        return copied;
+    }
+
+    /**
+     * Get start and layout of a segment.
+     * All records are in a single segment, in which values of each member are packed in its array.
+     *
+     * \tparam R Record type
+     * \tparam A Allocation policy
+     * \param seg Segment index (has to be 0)
+     * \param n Number of records
+     * \param start Reference to fill with pointers to the array starts
+     * \param stride Set to 0 (packed)
+     * \return Number of records
+     */
+    template<typename R, typename A>
+    size_t StorageSoA<R, A>::segment(size_t seg, size_t n, record_ptr_t &start, size_t &stride) const {
+        assert(seg == 0 && n > 0);
+        start = this->reference(0);
+        stride = 0;
+        return n;
+    }
+
+    /** \class StorageChunked
+     * Record storage in fixed-size chunks, each holding a struct of arrays
+     *
+     * Growth appends new chunks instead of reallocating, so records are never copied on growth.
+     * Each chunk starts with a small header and is aligned to its size, which allows \ref increment_reference to find
+     *  the next chunk from just the reference.
+     *
+     * \tparam R Record type
+     * \tparam B Chunk size in bytes (power of two, at least one page)
+     */
+    template<typename R, size_t B = (1u << 16u)>
+    class StorageChunked : public StorageBase<StorageChunked<R, B>, R> {
+        public:
+            //! Record type
+            typedef R record_t;
+            //! Record pointer type (struct of pointers to members of R)
+            typedef typename R::Ptr record_ptr_t;
+
+            static_assert((B & (B - 1)) == 0, "Chunk size has to be a power of two.");
+
+        private:
+            //! Header at the start of each chunk
+            struct ChunkHeader {
+                //! Position of the chunk in the chunk list
+                size_t index;
+            };
+            //! Space reserved for the chunk header (keeps the first array on its own cache line)
+            static constexpr size_t header_size = 64;
+
+            //! Chunks in index order
+            std::vector<void *> chunks{};
+            //! Offsets of the data arrays from the chunk start
+            size_t offsets[record_t::count] {0};
+            //! Number of records that fit into a chunk
+            size_t chunk_records = 0;
+
+        public:
+            StorageChunked() { layout(); }
+
+            /**
+             * Get address of the Nth member of the record at the provided index
+             *
+             * \tparam N Member index
+             * \param i Record index
+             * \return Address of the member
+             */
+            template <size_t N>
+            typename util::GetMemberType<record_t, N>::type *address(size_t i) const {
+                typedef typename util::GetMemberType<record_t, N>::type member_type;
+                auto chunk = static_cast<unsigned char *>(chunks[i / chunk_records]);
+                return reinterpret_cast<member_type *>(chunk + offsets[N]) + i % chunk_records;
+            }
+
+            //! Get the number of records from the index on whose Nth member is packed (the rest of its chunk)
+            template <size_t N>
+            size_t run(size_t i) const { return chunk_records - i % chunk_records; }
+
+            size_t grow(size_t size, size_t n);
+            size_t shrink(size_t size, size_t n);
+            void prefault() {
+                for (void *chunk : chunks) {
+                    prefault_pages(chunk, B);
+                }
+            }
+            void increment_reference(record_ptr_t &ref) const;
+            size_t segment_count(size_t n) const { return (n + chunk_records - 1) / chunk_records; }
+            size_t segment(size_t seg, size_t n, record_ptr_t &start, size_t &stride) const;
+            size_t allocated() const { return chunks.size() * chunk_records; }
+            size_t pages() const { return chunks.size() * (B / sysconf(_SC_PAGESIZE)); }
+            const char* type_name() const { return "Chunked"; }
+
+            ~StorageChunked() { shrink(0, 0); }
+
+        private:
+            //! Helper functor to add the size of the Nth member to the total
+            template <size_t N>
+            struct SizeHelper {
+                void operator()(size_t &total) {
+                    total += sizeof(typename util::GetMemberType<record_t, N>::type);
+                }
+            };
+
+            //! Helper functor to compute offset of the Nth data array from the end of the previous one
+            template <size_t N>
+            struct LayoutHelper {
+                void operator()(size_t *offsets, size_t &end, const size_t records) {
+                    typedef typename util::GetMemberType<record_t, N>::type member_type;
+                    offsets[N] = align_up(end, column_alignment);
+                    end = offsets[N] + records * sizeof(member_type);
+                }
+            };
+
+            //! Helper functor to increment Nth member of R::Ptr
+            template <size_t N>
+            struct IncrementHelper {
+                void operator()(record_ptr_t &ref) {
+                    // Increment member by 1 (next element of its array)
+                    auto member_p = util::get_pointer_to_member<record_ptr_t, N>();
+                    std::invoke(member_p, ref)++;
+                }
+            };
+
+            void layout();
+    };
+
+    /**
+     * Compute the number of records that fit into a chunk and the offsets of the data arrays within the chunk.
+     *
+     * \tparam R Record type
+     * \tparam B Chunk size in bytes
+     */
+    template<typename R, size_t B>
+    void StorageChunked<R, B>::layout() {
+        // Reserve the worst-case alignment padding of each array, and fit as many records as possible in the rest
+        size_t record_size = 0;
+        util::invoke_n<record_t::count, SizeHelper>(record_size);
+        chunk_records = (B - header_size - record_t::count * column_alignment) / record_size;
+        assert(chunk_records > 0);
+
+        // Lay the arrays out after the header
+        size_t end = header_size;
+        util::invoke_n<record_t::count, LayoutHelper>(offsets, end, chunk_records);
+        assert(end <= B);
+    }
+
+    /**
+     * Allocate chunks until at least the given amount of records fits.
+     * Existing chunks are left untouched, so no records are copied.
+     *
+     * \tparam R Record type
+     * \tparam B Chunk size in bytes
+     * \param size Number of records to allocate space for
+     * \return Number of bytes copied (always 0)
+     */
+    template<typename R, size_t B>
+    size_t StorageChunked<R, B>::grow(size_t size, size_t /*n*/) {
+        while (allocated() < size) {
+            // Allocate chunk aligned to its size and fill in its header
+            void *chunk = aligned_alloc(B, B);
+            assert(chunk != nullptr);
+            static_cast<ChunkHeader *>(chunk)->index = chunks.size();
+            chunks.push_back(chunk);
+        }
+        return 0;
+    }
+
+    /**
+     * Deallocate chunks past the last one needed to fit `size` records.
+     * Only unused chunks are deallocated, so no records are copied.
+     *
+     * \tparam R Record type
+     * \tparam B Chunk size in bytes
+     * \param size Number of records to keep space for (at least `n`)
+     * \return Number of bytes copied (always 0)
+     */
+    template<typename R, size_t B>
+    size_t StorageChunked<R, B>::shrink(size_t size, size_t /*n*/) {
+        const size_t needed = (size + chunk_records - 1) / chunk_records;
+        while (chunks.size() > needed) {
+            free(chunks.back());
+            chunks.pop_back();
+        }
+        return 0;
+    }
+
+    /**
+     * Get start and layout of a segment.
+     * Each chunk is a segment, in which values of each member are packed in its array.
+     *
+     * \tparam R Record type
+     * \tparam B Chunk size in bytes
+     * \param seg Segment (chunk) index
+     * \param n Number of records
+     * \param start Reference to fill with pointers to the array starts in the chunk
+     * \param stride Set to 0 (packed)
+     * \return Number of records in the chunk
+     */
+    template<typename R, size_t B>
+    size_t StorageChunked<R, B>::segment(size_t seg, size_t n, record_ptr_t &start, size_t &stride) const {
+        assert(seg < segment_count(n));
+        const size_t first = seg * chunk_records;
+        start = this->reference(first);
+        stride = 0;
+        return std::min(chunk_records, n - first);
+    }
+
+    /**
+     * Increment reference to point to the next record
+     * When the reference leaves its chunk, it is moved to the start of the next chunk (if there is one).
+     *
+     * \tparam R Record type
+     * \tparam B Chunk size in bytes
+     * \param ref Reference to increment
+     */
+    template<typename R, size_t B>
+    void StorageChunked<R, B>::increment_reference(record_ptr_t &ref) const {
+        typedef typename util::GetMemberType<record_t, 0>::type first_type;
+
+        // Move to next element of each array
+        util::invoke_n<record_t::count, IncrementHelper>(ref);
+
+        // Find the chunk from the previous element of the first array (chunks are aligned to their size)
+        first_type *first = std::invoke(util::get_pointer_to_member<record_ptr_t, 0>(), ref);
+        auto chunk = reinterpret_cast<unsigned char *>(reinterpret_cast<uintptr_t>(first - 1) & ~(uintptr_t) (B - 1));
+
+        // Jump to the next chunk when past the end of this one
+        if (first == reinterpret_cast<first_type *>(chunk + offsets[0]) + chunk_records) {
+            const size_t next = reinterpret_cast<ChunkHeader *>(chunk)->index + 1;
+            if (next < chunks.size()) {
+                ref = this->reference(next * chunk_records);
+            }
+        }
+    }
+
+    /** \class StorageAoSoA
+     * Record storage as an array of blocks, each block holding a struct of arrays of W records
+     *
+     * Members selected by the group mask G are stored in blocks, with each member's values for the W records of a block
+     *  laid out contiguously (a lane) and aligned for SIMD loads.
+     * The remaining members are stored as separate arrays outside the blocks, as in \ref StorageSoA.
+     * This keeps members that are processed together close, while moving rarely used members out of the way.
+     *
+     * \tparam R Record type
+     * \tparam W Number of records in a block (power of two, e.g. 4, 8 or 16)
+     * \tparam G Mask of members stored in blocks (bit N set iff member N is in the blocks)
+     * \tparam A Allocation policy (e.g. \ref HeapAllocation or \ref MappedAllocation)
+     */
+    template<typename R, size_t W = 8, uint64_t G = ~static_cast<uint64_t>(0), typename A = HeapAllocation>
+    class StorageAoSoA : public StorageBase<StorageAoSoA<R, W, G, A>, R> {
+        public:
+            //! Record type
+            typedef R record_t;
+            //! Record pointer type (struct of pointers to members of R)
+            typedef typename R::Ptr record_ptr_t;
+
+            static_assert(W > 0 && (W & (W - 1)) == 0, "Block width has to be a power of two.");
+            static_assert(record_t::count <= 64, "Group mask only covers 64 members.");
+
+            //! Alignment of each lane within a block (enough for aligned 256-bit loads)
+            static constexpr size_t lane_alignment = 32;
+
+        private:
+            //! Start of the data (the first block)
+            void *data = nullptr;
+            //! Number of pages allocated to the blocks
+            size_t data_pages = 0;
+            //! Starts of data arrays of members outside the blocks (`nullptr` for members in the blocks)
+            void *arrays[record_t::count] {nullptr};
+            //! Number of pages allocated to each data array outside the blocks
+            size_t array_pages[record_t::count] {0};
+            //! Offsets of lanes from their block start (only for members in the blocks)
+            size_t lane_offsets[record_t::count] {0};
+            //! Size of a block in bytes
+            size_t block_bytes = 0;
+            //! Allocated space in terms of number of records that fit in it
+            size_t capacity = 0;
+            //! Number of pages allocated
+            size_t pages_alloc = 0;
+
+            //! `true` iff member N is stored in the blocks
+            template <size_t N>
+            static constexpr bool in_block = ((G >> N) & 1u) != 0;
+
+        public:
+            StorageAoSoA() { layout(); }
+
+            /**
+             * Get address of the Nth member of the record at the provided index
+             *
+             * \tparam N Member index
+             * \param i Record index
+             * \return Address of the member
+             */
+            template <size_t N>
+            typename util::GetMemberType<record_t, N>::type *address(size_t i) const {
+                typedef typename util::GetMemberType<record_t, N>::type member_type;
+                if constexpr (in_block<N>) {
+                    auto block = static_cast<unsigned char *>(data) + (i / W) * block_bytes;
+                    return reinterpret_cast<member_type *>(block + lane_offsets[N]) + i % W;
+                } else {
+                    return static_cast<member_type *>(arrays[N]) + i;
+                }
+            }
+
+            //! Get the number of records from the index on whose Nth member is packed (the rest of its lane, or all
+            //!     outside the blocks)
+            template <size_t N>
+            size_t run(size_t i) const { return in_block<N> ? W - i % W : std::numeric_limits<size_t>::max(); }
+
+            size_t grow(size_t size, size_t n);
+            size_t shrink(size_t size, size_t n);
+            void prefault();
+            void increment_reference(record_ptr_t &ref) const { util::invoke_n<record_t::count, IncrementHelper>(this, ref); }
+            size_t segment_count(size_t n) const { return (n + W - 1) / W; }
+            size_t segment(size_t seg, size_t n, record_ptr_t &start, size_t &stride) const;
+            size_t allocated() const { return capacity; }
+            size_t pages() const { return pages_alloc; }
+            const char* type_name() const { return "AoSoA"; }
+
+            ~StorageAoSoA() { shrink(0, 0); }
+
+        private:
+            //! Helper functor to lay out the Nth member as a lane in the blocks (if it is in them)
+            template <size_t N>
+            struct LayoutHelper {
+                void operator()(StorageAoSoA *s) {
+                    typedef typename util::GetMemberType<record_t, N>::type member_type;
+                    if constexpr (in_block<N>) {
+                        s->lane_offsets[N] = s->block_bytes;
+                        s->block_bytes = align_up(s->block_bytes + W * sizeof(member_type), lane_alignment);
+                    }
+                }
+            };
+
+            //! Helper functor to add the number of pages the Nth data array outside the blocks needs to fit `size`
+            //!     records to the total
+            template <size_t N>
+            struct PagesHelper {
+                void operator()(size_t &pages, const size_t size) {
+                    typedef typename util::GetMemberType<record_t, N>::type member_type;
+                    if constexpr (!in_block<N>) {
+                        pages += (size > 0) ? round_pages(size * sizeof(member_type)) : 0;
+                    }
+                }
+            };
+
+            //! Helper functor to resize the Nth data array outside the blocks to fit `size` records, keeping the first
+            //!     `count`, and lower the capacity to the number of records that fit in it
+            template <size_t N>
+            struct ResizeHelper {
+                void operator()(void **arrays, size_t *pages, const size_t size, const size_t count, size_t &capacity,
+                                size_t &copied) {
+                    typedef typename util::GetMemberType<record_t, N>::type member_type;
+                    if constexpr (!in_block<N>) {
+                        const size_t pages_target = (size > 0) ? round_pages(size * sizeof(member_type)) : 0;
+                        copied += resize_block<A>(arrays[N], pages[N], pages_target, count * sizeof(member_type));
+                        capacity = std::min(capacity, pages[N] * sysconf(_SC_PAGESIZE) / sizeof(member_type));
+                    }
+                }
+            };
+
+            //! Helper functor to increment Nth member of R::Ptr, skipping over the rest of the block at lane end
+            template <size_t N>
+            struct IncrementHelper {
+                void operator()(const StorageAoSoA *s, record_ptr_t &ref) {
+                    typedef typename util::GetMemberType<record_t, N>::type member_type;
+                    auto member_p = util::get_pointer_to_member<record_ptr_t, N>();
+                    member_type *&ptr = std::invoke(member_p, ref);
+                    ptr++;
+
+                    if constexpr (in_block<N>) {
+                        // Check whether the pointer left its lane (i.e. the previous record was last in its block)
+                        auto byte = reinterpret_cast<unsigned char *>(ptr);
+                        auto lane_end = static_cast<size_t>(byte - static_cast<unsigned char *>(s->data)) % s->block_bytes;
+                        if (lane_end == s->lane_offsets[N] + W * sizeof(member_type)) {
+                            // Jump to the same lane in the next block
+                            ptr = reinterpret_cast<member_type *>(byte + s->block_bytes - W * sizeof(member_type));
+                        }
+                    }
+                }
             };
 
-            //! Specialization of the \ref AllocatePtrHelper functor to do nothing when N is 0 (handled separately)
-            template <>
-            struct AllocatePtrHelper<0> { void operator()(void */*target_arrays*/[], const size_t /*size*/) {} };
+            void layout();
+    };
+
+    /**
+     * Compute the block layout (lane offsets and block size).
+     *
+     * \tparam R Record type
+     * \tparam W Number of records in a block
+     * \tparam G Mask of members stored in blocks
+     * \tparam A Allocation policy
+     */
+    template<typename R, size_t W, uint64_t G, typename A>
+    void StorageAoSoA<R, W, G, A>::layout() {
+        util::invoke_n<record_t::count, LayoutHelper>(this);
+        block_bytes = align_up(block_bytes, column_alignment);
+    }
+
+    /**
+     * Grow the space to fit at least the given amount of records.
+     * Size of the space of the blocks and of each array outside them is rounded up to the nearest 2^N pages.
+     * The blocks and each array are grown by the allocation policy if it can, and otherwise their records are copied
+     *  over to new space.
+     *
+     * \tparam R Record type
+     * \tparam W Number of records in a block
+     * \tparam G Mask of members stored in blocks
+     * \tparam A Allocation policy
+     * \param size Number of records to allocate space for
+     * \param n Number of records to keep
+     * \return Number of bytes copied
+     */
+    template<typename R, size_t W, uint64_t G, typename A>
+    size_t StorageAoSoA<R, W, G, A>::grow(size_t size, size_t n) {
+        // Resize the blocks (whose layout does not depend on capacity, so used blocks stay in place) and each array
+        //  outside them, fitting as many records as the smallest one can hold
+        size_t capacity_target = std::numeric_limits<size_t>::max();
+        size_t copied = 0;
+        if (block_bytes > 0) {
+            const size_t pages_target = round_pages(((size + W - 1) / W) * block_bytes);
+            copied += resize_block<A>(data, data_pages, pages_target, ((n + W - 1) / W) * block_bytes);
+            capacity_target = (data_pages * sysconf(_SC_PAGESIZE) / block_bytes) * W;
+        }
+        util::invoke_n<record_t::count, ResizeHelper>(arrays, array_pages, size, n, capacity_target, copied);
+        assert(capacity_target >= size);
+
+        capacity = capacity_target;
+        pages_alloc = std::accumulate(std::begin(array_pages), std::end(array_pages), data_pages);
+        return copied;
+    }
+
+    /**
+     * Shrink the space to the smallest that fits `size` records, if that frees any pages
+     *
+     * \tparam R Record type
+     * \tparam W Number of records in a block
+     * \tparam G Mask of members stored in blocks
+     * \tparam A Allocation policy
+     * \param size Number of records to keep space for (at least `n`)
+     * \param n Number of records to keep
+     * \return Number of bytes copied
+     */
+    template<typename R, size_t W, uint64_t G, typename A>
+    size_t StorageAoSoA<R, W, G, A>::shrink(size_t size, size_t n) {
+        // Calculate target space size (whole blocks, plus each array outside them), skipping if no pages would be freed
+        const size_t data_target = (size > 0 && block_bytes > 0) ? round_pages(((size + W - 1) / W) * block_bytes) : 0;
+        size_t pages_target = data_target;
+        util::invoke_n<record_t::count, PagesHelper>(pages_target, size);
+        if (pages_target >= pages_alloc) {
+            return 0;
+        }
+
+        // Resize the blocks and each array outside them, fitting as many records as the smallest one can hold
+        size_t capacity_target = (size > 0) ? std::numeric_limits<size_t>::max() : 0;
+        size_t copied = resize_block<A>(data, data_pages, data_target, ((n + W - 1) / W) * block_bytes);
+        if (data_pages > 0) {
+            capacity_target = (data_pages * sysconf(_SC_PAGESIZE) / block_bytes) * W;
+        }
+        util::invoke_n<record_t::count, ResizeHelper>(arrays, array_pages, size, n, capacity_target, copied);
+
+        capacity = capacity_target;
+        pages_alloc = pages_target;
+        return copied;
+    }
+
+    /**
+     * Pre-fault the blocks and each array outside them
+     *
+     * \tparam R Record type
+     * \tparam W Number of records in a block
+     * \tparam G Mask of members stored in blocks
+     * \tparam A Allocation policy
+     */
+    template<typename R, size_t W, uint64_t G, typename A>
+    void StorageAoSoA<R, W, G, A>::prefault() {
+        const size_t pagesize = sysconf(_SC_PAGESIZE);
+        if (data) {
+            prefault_pages(data, data_pages * pagesize);
+        }
+        for (size_t i = 0; i < record_t::count; i++) {
+            if (arrays[i]) {
+                prefault_pages(arrays[i], array_pages[i] * pagesize);
+            }
+        }
+    }
+
+    /**
+     * Get start and layout of a segment.
+     * Each block is a segment, in which values of each member are packed in its lane (or its array outside the blocks).
+     *
+     * \tparam R Record type
+     * \tparam W Number of records in a block
+     * \tparam G Mask of members stored in blocks
+     * \tparam A Allocation policy
+     * \param seg Segment (block) index
+     * \param n Number of records
+     * \param start Reference to fill with pointers to the lane starts in the block
+     * \param stride Set to 0 (packed)
+     * \return Number of records in the block
+     */
+    template<typename R, size_t W, uint64_t G, typename A>
+    size_t StorageAoSoA<R, W, G, A>::segment(size_t seg, size_t n, record_ptr_t &start, size_t &stride) const {
+        assert(seg < segment_count(n));
+        const size_t first = seg * W;
+        start = this->reference(first);
+        stride = 0;
+        return std::min(W, n - first);
+    }
+
+    //! Record layout of a \ref StorageAdaptive
+    enum class RecordLayout {
+        aos,    //!< Array of structs (see \ref StorageAoS)
+        soa     //!< Struct of arrays (see \ref StorageSoA)
+    };
+
+    /** \class StorageAdaptive
+     * Record storage either as an array of structs or as a struct of arrays, switchable at run time
+     * Only the storage of the current layout holds any space.
+     *
+     * \tparam R Record type
+     * \tparam A Allocation policy (e.g. \ref HeapAllocation or \ref MappedAllocation)
+     */
+    template<typename R, typename A = HeapAllocation>
+    class StorageAdaptive {
+        public:
+            //! Record type
+            typedef R record_t;
+            //! Record pointer type (struct of pointers to members of R)
+            typedef typename R::Ptr record_ptr_t;
+
+        private:
+            //! Current layout
+            RecordLayout current = RecordLayout::soa;
+            //! Storage used when the layout is AoS
+            StorageAoS<R, A> aos{};
+            //! Storage used when the layout is SoA
+            StorageSoA<R, A> soa{};
 
-            //! Helper functor to copy Nth data array after reallocation
-            template <size_t N>
-            struct AllocateCopyHelper {
-                void operator()(void **src_arrays, void **dest_arrays, const size_t count) {
-                    typedef typename util::GetMemberType<record_t, N>::type member_type;
-                    auto src = static_cast<member_type *>(src_arrays[N]);
-                    auto dest = static_cast<member_type *>(dest_arrays[N]);
-                    std::copy_n(src, count, dest);
+        public:
+            StorageAdaptive() = default;
+            StorageAdaptive(const StorageAdaptive &other) = delete;
+            StorageAdaptive &operator=(const StorageAdaptive &other) = delete;
+
+            void write(size_t i, const record_t &record) { is_aos() ? aos.write(i, record) : soa.write(i, record); }
+            void write(size_t i, const record_t *records, size_t count) {
+                is_aos() ? aos.write(i, records, count) : soa.write(i, records, count);
+            }
+            void write(size_t i, const record_ptr_t &records, size_t count) {
+                is_aos() ? aos.write(i, records, count) : soa.write(i, records, count);
+            }
+            record_t read(size_t i) const { return is_aos() ? aos.read(i) : soa.read(i); }
+            void move_record(size_t to, size_t from) { is_aos() ? aos.move_record(to, from) : soa.move_record(to, from); }
+            record_ptr_t reference(size_t i) const { return is_aos() ? aos.reference(i) : soa.reference(i); }
+            void references(const size_t *indices, uint64_t misses, record_ptr_t *dest, size_t count) const {
+                is_aos() ? aos.references(indices, misses, dest, count) : soa.references(indices, misses, dest, count);
+            }
+            size_t grow(size_t size, size_t n) { return is_aos() ? aos.grow(size, n) : soa.grow(size, n); }
+            size_t shrink(size_t size, size_t n) { return is_aos() ? aos.shrink(size, n) : soa.shrink(size, n); }
+            void prefault() { is_aos() ? aos.prefault() : soa.prefault(); }
+            void increment_reference(record_ptr_t &ref) const {
+                is_aos() ? aos.increment_reference(ref) : soa.increment_reference(ref);
+            }
+            size_t segment_count(size_t n) const { return is_aos() ? aos.segment_count(n) : soa.segment_count(n); }
+            size_t segment(size_t seg, size_t n, record_ptr_t &start, size_t &stride) const {
+                return is_aos() ? aos.segment(seg, n, start, stride) : soa.segment(seg, n, start, stride);
+            }
+            size_t allocated() const { return is_aos() ? aos.allocated() : soa.allocated(); }
+            size_t pages() const { return is_aos() ? aos.pages() : soa.pages(); }
+            const char* type_name() const { return is_aos() ? "Adaptive (AoS)" : "Adaptive (SoA)"; }
+
+            //! Get the current layout
+            RecordLayout layout() const { return current; }
+
+            /**
+             * Switch to the layout, copying the first `n` records over to the other storage in the same order
+             * The other storage is sized to fit just the records, and the current one is freed.
+             *
+             * \param target Layout to switch to
+             * \param n Number of records
+             * \return Number of bytes copied
+             */
+            size_t switch_layout(RecordLayout target, size_t n) {
+                if (target == current) {
+                    return 0;
                 }
-            };
 
-            //! Helper functor to append the Nth member of the provided record to the appropriate data array
-            template <size_t N>
-            struct AddHelper {
-                void operator()(void **arr, const size_t count, const record_t &record) {
-                    typedef typename util::GetMemberType<record_t, N>::type member_type;
-                    auto start = static_cast<member_type *>(arr[N]);
-                    start[count] = std::invoke(util::get_pointer_to_member<record_t, N>(), record);
+                if (target == RecordLayout::aos) {
+                    migrate(soa, aos, n);
+                } else {
+                    migrate(aos, soa, n);
                 }
-            };
+                current = target;
+                return n * sizeof(record_t);
+            }
 
-            //! Helper functor to append the Nth members of the provided records to the appropriate data array
-            template <size_t N>
-            struct AddsPtrHelper {
-                void operator()(void **arr, const size_t offset, const record_ptr_t &records, size_t count) {
-                    typedef typename util::GetMemberType<record_t, N>::type member_type;
-                    // From the relevant member of records,
-                    auto src = std::invoke(util::get_pointer_to_member<record_ptr_t, N>(), records);
-                    // to just after the last entry in the relevant array,
-                    auto dest = static_cast<member_type *>(arr[N]) + offset;
-                    // copy count elements
-                    std::copy_n(src, count, dest);
+        private:
+            //! `true` iff the layout is AoS
+            bool is_aos() const { return current == RecordLayout::aos; }
+
+            /**
+             * Copy the first `n` records from one storage to the other, and free the source
+             *
+             * \param from Source storage
+             * \param to Destination storage (empty)
+             * \param n Number of records
+             */
+            template<typename From, typename To>
+            static void migrate(From &from, To &to, size_t n) {
+                to.grow(n, 0);
+                for (size_t i = 0; i < n; i++) {
+                    to.write(i, from.read(i));
                 }
-            };
+                from.shrink(0, 0);
+            }
+    };
 
-            //! Helper functor to copy Nth member of the last record to the provided index
-            template <size_t N>
-            struct RemoveHelper {
-                void operator()(void **arr, const size_t index, const size_t last) {
-                    typedef typename util::GetMemberType<record_t, N>::type member_type;
-                    auto start = static_cast<member_type *>(arr[N]);
-                    start[index] = start[last];
+    /** \class TableBase
+     * Static base of the table implementations.
+     * Keeps the keys of the records, the key map and the state shared by all layouts (change tracking, structure locks
+     *  and operation counts), and implements the operations on the table's structure once, in terms of the record
+     *  storage `S`.
+     * The storage only decides where the members of each record are in memory (see \ref StorageBase), so adding,
+     *  removing and reordering records behaves the same in all layouts.
+     * Each implementation derives from it with itself as `D` and provides the same functions as \ref Table, but as
+     *  non-virtual functions, so that calls through the implementation type can be inlined.
+     * Where a common interface is needed (e.g. debug UI), the implementation can be wrapped in a \ref TableAdaptor.
+     *
+     * \tparam D Implementation type
+     * \tparam K Key type
+     * \tparam R Record type
+     * \tparam M Key-index map type
+     * \tparam S Record storage type
+     */
+    template<typename D, typename K, typename R, typename M, typename S>
+    class TableBase {
+        public:
+            //! Key type
+            typedef K key_t;
+            //! Record type
+            typedef R record_t;
+            //! Record pointer type (struct of pointers to members of R)
+            typedef typename R::Ptr record_ptr_t;
+            //! Record storage type
+            typedef S storage_t;
+
+            // Structure (see \ref Table for documentation)
+            opt_index add(const key_t &key, const record_t &record);
+            bool add(const key_t *keys, const record_t *records, size_t count);
+            bool add(const key_t *keys, const record_ptr_t &records, size_t count);
+            opt_index remove(const key_t &key);
+            opt_index remove(opt_index idx);
+            size_t remove(const key_t *keys, size_t count) {
+                return remove_marked(mark_keys(static_cast<D &>(*this), keys, count));
+            }
+            size_t remove_marked(const std::vector<bool> &marked);
+            void permute(const std::vector<size_t> &order);
+            void swap(const opt_index &a, const opt_index &b);
+
+            // Access (see \ref Table for documentation)
+            opt_index conflict(const key_t &key) { return map.conflict(key); }
+            opt_index lookup(const key_t &key) { return count_lookup(map.find(key)); }
+            key_t lookup(const opt_index &idx);
+            record_t get_copy(const key_t &key);
+            record_t get_copy(const opt_index &i);
+            record_ptr_t get_reference(const key_t &key);
+            record_ptr_t get_reference(const opt_index &i);
+            record_ptr_t get_reference();
+            void get_reference(const key_t *keys, record_ptr_t *dest, size_t count);
+            void increment_reference(record_ptr_t &ref) { storage.increment_reference(ref); }
+            size_t segment_count() { return storage.segment_count(n); }
+            size_t segment(size_t seg, record_ptr_t &start, size_t &stride) { return storage.segment(seg, n, start, stride); }
+            size_t size() { return n; }
+            const std::vector<key_t> &keys() {
+                tally(TableStats::key_lists);
+                return dense_keys;
+            }
+            uint64_t version() { return structure_version; }
+            size_t allocated() { return storage.allocated(); }
+            size_t pages() { return storage.pages(); }
+            const char* type_name() { return storage.type_name(); }
+
+            /**
+             * Get a view over the selected members of all records
+             *
+             * \tparam N Indices of the members to view
+             * \return View over the members
+             */
+            template<size_t... N>
+            View<D, N...> view() { return View<D, N...>(static_cast<D &>(*this)); }
+
+            /**
+             * Remove records that satisfy the predicate
+             *
+             * \tparam P Predicate type
+             * \param pred Predicate taking the key and a reference to the record, returning `true` iff the record is to
+             *  be removed
+             * \return Number of removed records
+             */
+            template<typename P>
+            size_t remove_if(P pred) {
+                D &table = static_cast<D &>(*this);
+                return table.remove_marked(mark_if(table, pred));
+            }
+
+            /**
+             * Sort the records by a value computed for each record
+             *
+             * \tparam F Function type
+             * \param f Function taking the key and a reference to the record, returning the value to sort by
+             * \return Applied permutation (position `i` holds the previous index of the record now at `i`)
+             */
+            template<typename F>
+            std::vector<size_t> sort(F f) {
+                D &table = static_cast<D &>(*this);
+                std::vector<size_t> order = sorted_order(table, f);
+                table.permute(order);
+                return order;
+            }
+
+            /**
+             * Set a member of the record under the provided key, recording the change
+             *
+             * \tparam N Index of the member
+             * \tparam V Value type
+             * \param key Key
+             * \param value New value of the member
+             *
+             * \throws std::out_of_range When no record is associated with the provided key
+             */
+            template<size_t N, typename V>
+            void set(const key_t &key, const V &value) {
+                D &table = static_cast<D &>(*this);
+                *std::invoke(util::get_pointer_to_member<record_ptr_t, N>(), table.get_reference(key)) = value;
+                table.touch(key, column(N));
+            }
+
+            /**
+             * Set a member of the record at the provided index, recording the change
+             *
+             * \tparam N Index of the member
+             * \tparam V Value type
+             * \param i Index
+             * \param value New value of the member
+             *
+             * \throws std::out_of_range When no record is at the provided index
+             */
+            template<size_t N, typename V>
+            void set(const opt_index &i, const V &value) {
+                D &table = static_cast<D &>(*this);
+                *std::invoke(util::get_pointer_to_member<record_ptr_t, N>(), table.get_reference(i)) = value;
+                table.touch(i, column(N));
+            }
+
+            /**
+             * Apply the function to the records with any of the selected columns changed since changes were last cleared
+             * Requires change tracking to be enabled (see \ref track_changes).
+             * The function must not touch any records or add or remove any records.
+             *
+             * \tparam F Function type
+             * \param f Function taking the key, a reference to the record and the mask of its changed columns (limited
+             *  to the selected ones)
+             * \param columns Mask of the selected columns
+             */
+            template<typename F>
+            void for_each_changed(F f, uint64_t columns = all_columns) {
+                apply_changed(static_cast<D &>(*this), f, columns);
+            }
+
+            // Space (see \ref Table for documentation)
+            void reserve(size_t size, bool prefault = false);
+            void shrink(size_t size);
+            void shrink_to_fit() { shrink(n); }
+            size_t trim() {
+                if (structure_locked() || n >= storage.allocated() / shrink_ratio) {
+                    return 0;
                 }
-            };
+                const size_t before = storage.pages();
+                shrink(2 * n);
+                return before - storage.pages();
+            }
 
-            //! Helper functor to fill Nth member of R with a copy of the appropriate value of record i
-            template <size_t N>
-            struct GetCopyHelper {
-                void operator()(void **arr, const size_t i, record_t &result) {
-                    typedef typename util::GetMemberType<record_t, N>::type member_type;
-                    auto start = static_cast<member_type *>(arr[N]);
-                    std::invoke(util::get_pointer_to_member<record_t, N>(), result) = start[i];
+            // Access sampling (see \ref Table for documentation)
+            void sample_scan(uint64_t /*columns*/, size_t /*count*/) {}
+
+            // Change tracking (see \ref Table for documentation)
+            void track_changes(bool enable) { tracker.enable(enable); }
+            bool tracking_changes() { return tracker.is_enabled(); }
+            uint64_t column_version(size_t c) { return tracker.version(c); }
+            void touch(const key_t &key, uint64_t columns = all_columns) { tracker.touch(key, columns); }
+            void touch(const opt_index &i, uint64_t columns = all_columns) { tracker.touch(lookup(i), columns); }
+            uint64_t changes(const key_t &key) { return tracker.changes(key); }
+            const std::vector<key_t> &changed_keys() { return tracker.changed(); }
+            void clear_changes() { tracker.clear(); }
+
+            // Structure locking (see \ref Table for documentation)
+            void lock_structure() { structure_locks++; }
+            void unlock_structure() {
+                assert(structure_locks > 0);
+                structure_locks--;
+            }
+            bool structure_locked() { return structure_locks > 0; }
+
+            // Operation counts (see \ref Table for documentation)
+            TableStats stats() {
+                TableStats result;
+                for (size_t c = 0; c < TableStats::counter_count; c++) {
+                    result.counts[c] = counters[c].load(std::memory_order_relaxed);
                 }
-            };
+                return result;
+            }
+            void reset_stats() {
+                for (auto &counter : counters) {
+                    counter.store(0, std::memory_order_relaxed);
+                }
+            }
 
-            //! Helper functor to fill Nth member of R::Ptr with a pointer to the appropriate value of record i
-            template <size_t N>
-            struct GetRefHelper {
-                void operator()(void **arr, const size_t i, record_ptr_t &result) {
-                    typedef typename util::GetMemberType<record_t, N>::type member_type;
-                    auto start = static_cast<member_type *>(arr[N]);
-                    std::invoke(util::get_pointer_to_member<record_ptr_t, N>(), result) = start + i;
+        protected:
+            //! Record storage
+            storage_t storage{};
+            //! Map of keys to indices to the records
+            M map{};
+            //! Keys of the records, parallel to the records (i.e. key of record `i` is at index `i`)
+            std::vector<key_t> dense_keys{};
+            //! Structure version (incremented on every change to which record is at which index)
+            uint64_t structure_version = 0;
+            //! Number of records stored
+            size_t n = 0;
+            //! Tracker of changed records
+            ChangeTracker<K, M, R::count> tracker{};
+            //! Number of held structure locks
+            size_t structure_locks = 0;
+            //! Operation counters (atomic, as lookups may run concurrently)
+            std::array<std::atomic<uint64_t>, TableStats::counter_count> counters{};
+
+            /**
+             * Count an operation (no-op unless \ref open_sea::table_stats is enabled)
+             *
+             * \param c Counter
+             * \param by Amount to count
+             */
+            void tally(TableStats::Counter c, uint64_t by = 1) {
+                if constexpr (table_stats) {
+                    counters[c].fetch_add(by, std::memory_order_relaxed);
                 }
-            };
+            }
 
-            //! Helper functor to fill Nth members of R::Ptr array elements with pointers to the appropriate values of
-            //!     records under keys
-            template <size_t N>
-            struct GetRefsHelper {
-                void operator()(void **arr, std::unordered_map<key_t, size_t> &m, const key_t *keys, record_ptr_t *dest, size_t count) {
-                    typedef typename util::GetMemberType<record_t, N>::type member_type;
-                    auto start = static_cast<member_type *>(arr[N]);
-                    const key_t *k = keys;
-                    record_ptr_t *d = dest;
-                    for (size_t i = 0; i < count; i++, k++, d++) {
-                        try {
-                            std::invoke(util::get_pointer_to_member<record_ptr_t, N>(), *d) = start + m.at(*k);
-                        } catch (std::out_of_range &e) {
-                            std::invoke(util::get_pointer_to_member<record_ptr_t, N>(), *d) = nullptr;
-                        }
-                    }
+            /**
+             * Count a lookup of a key
+             *
+             * \param found Result of the lookup
+             * \return Result of the lookup
+             */
+            opt_index count_lookup(opt_index found) {
+                tally(TableStats::lookups);
+                if (!found.is_set()) {
+                    tally(TableStats::lookup_misses);
                 }
-            };
+                return found;
+            }
 
-            //! Helper functor to increment Nth member of R::Ptr
-            template <size_t N>
-            struct IncrementHelper {
-                void operator()(record_ptr_t &ref) {
-                    // Increment member by 1 (next element of its array)
-                    auto member_p = util::get_pointer_to_member<record_ptr_t, N>();
-                    std::invoke(member_p, ref)++;
+            /**
+             * Count a batch of lookups of keys
+             *
+             * \param count Number of keys in the batch
+             * \param misses Miss mask of the batch (bit `i` set iff key `i` was not found)
+             */
+            void count_lookups(size_t count, uint64_t misses) {
+                tally(TableStats::lookups, count);
+                tally(TableStats::lookup_misses, __builtin_popcountll(misses));
+            }
+
+            /**
+             * Check the structure is not locked, before changing it
+             *
+             * \throws std::logic_error When the structure is locked
+             */
+            void check_structure() const {
+                if (structure_locks > 0) {
+                    throw std::logic_error("Table structure is locked.");
                 }
-            };
+            }
 
             void allocate(size_t size);
+            bool prepare_batch(const key_t *keys, size_t count);
+            void append_batch(const key_t *keys, size_t count);
+
+            /**
+             * Remove the record of any key that would be displaced from the map by inserting the provided key
+             * For sparse maps, this is a key sharing the same index (e.g. a dead entity of an older generation).
+             *
+             * \param key Key about to be inserted
+             */
+            void evict_conflict(const key_t &key) {
+                opt_index stale = map.conflict(key);
+                if (stale.is_set()) {
+                    remove(stale);
+                }
+            }
+
+            TableBase() = default;
+
+            /**
+             * Construct the table with the key map and allocate space for `count` records
+             *
+             * \param count Number of records to allocate space for
+             * \param map Key map (empty, e.g. constructed with non-default options)
+             */
+            TableBase(size_t count, M map) : map(std::move(map)) { allocate(count); }
+
+            ~TableBase() = default;
     };
 
     /**
-     * Allocate page-aligned space that fits at least the given amount of records.
-     * Size of the allocated space is rounded up to the nearest 2^N pages.
-     * If the table wasn't empty, the old data is copied over to the new space.
+     * Make space for at least the given amount of records.
+     * The storage keeps the current records, growing its space in place where it can.
      *
+     * \tparam D Implementation type
      * \tparam K Key type
      * \tparam R Record type
+     * \tparam M Key-index map type
+     * \tparam S Record storage type
      * \param size Number of records to allocate space for
      */
-    template<typename K, typename R>
-    void TableSoA<K, R>::allocate(size_t size) {
-        // Make sure data will fit into new space
-        assert(size > n);
+    template<typename D, typename K, typename R, typename M, typename S>
+    void TableBase<D, K, R, M, S>::allocate(size_t size) {
+        check_structure();
 
-        // Skip if already big enough or requested zero size (which any space fits)
-        if (capacity >= size || size == 0) {
+        // Skip if already big enough
+        if (storage.allocated() >= size) {
             return;
         }
 
-        // Calculate target space size
-        // For the rounded-up division see https://stackoverflow.com/q/2745074
-        long pagesize = sysconf(_SC_PAGESIZE);
-        unsigned long space_needed = size * sizeof(record_t);
-        unsigned long pages_needed = space_needed / pagesize + (space_needed % pagesize != 0);
-        size_t pages_target;
-        if ((pages_needed & (pages_needed - 1)) == 0) {
-            // Pages needed is a power of two -> use that
-            // See http://www.graphics.stanford.edu/~seander/bithacks.html#DetermineIfPowerOf2 for power of 2 test
-            pages_target = pages_needed;
-        } else {
-            // Not a power of two -> find the nearest greater one
-            // The nearest greater power of 2 has 1 in the position of the last leading 0 and 0s everywhere else
-            int shift_by = ((sizeof(unsigned long) * 8) - __builtin_clzl(pages_needed));
-            pages_target = 1 << shift_by;
-        }
-        size_t space_target = pages_target * pagesize;
-        assert(space_target >= space_needed);
-
-        // Allocate that much page-aligned space
-        void *target = aligned_alloc(pagesize, space_target);
-        assert(target != nullptr);
-
-        // Compute array start pointers
-        void *target_arrays[record_t::count];
-        target_arrays[0] = target;
-        util::invoke_n<record_t::count, AllocatePtrHelper>(target_arrays, space_target / sizeof(record_t));
+        tally(TableStats::bytes_copied, storage.grow(size, n));
+        tally(TableStats::reallocations);
+        dense_keys.reserve(storage.allocated());
+    }
 
-        // Copy data into new space
-        if (n > 0) {
-            util::invoke_n<record_t::count, AllocateCopyHelper>(arrays, target_arrays, n);
+    /**
+     * Reserve space for at least the given amount of records, optionally pre-faulting it
+     * Pre-faulting maps all pages of the space up front, so that filling the table later does not page fault.
+     *
+     * \tparam D Implementation type
+     * \tparam K Key type
+     * \tparam R Record type
+     * \tparam M Key-index map type
+     * \tparam S Record storage type
+     * \param size Number of records to reserve space for
+     * \param prefault Whether to pre-fault the space
+     */
+    template<typename D, typename K, typename R, typename M, typename S>
+    void TableBase<D, K, R, M, S>::reserve(size_t size, bool prefault) {
+        if (size > n) {
+            allocate(size);
         }
 
-        // Deallocate old data
-        if (data && capacity > 0) {
-            free(data);
+        if (prefault) {
+            storage.prefault();
         }
+    }
 
-        // Update state
-        data = target;
-        std::copy(std::begin(target_arrays), std::end(target_arrays), std::begin(arrays));
-        capacity = space_target / sizeof(record_t);
-        pages_alloc = pages_target;
+    /**
+     * Shrink the allocated space to the smallest that fits the given amount of records (and at least the current ones)
+     * Does nothing unless some pages would be freed.
+     *
+     * \tparam D Implementation type
+     * \tparam K Key type
+     * \tparam R Record type
+     * \tparam M Key-index map type
+     * \tparam S Record storage type
+     * \param size Number of records to keep space for
+     */
+    template<typename D, typename K, typename R, typename M, typename S>
+    void TableBase<D, K, R, M, S>::shrink(size_t size) {
+        check_structure();
+
+        const size_t before = storage.pages();
+        const size_t copied = storage.shrink(std::max(size, n), n);
+        if (storage.pages() != before) {
+            tally(TableStats::reallocations);
+            tally(TableStats::bytes_copied, copied);
+        }
+        dense_keys.shrink_to_fit();
     }
 
-    template<typename K, typename R>
-    opt_index TableSoA<K, R>::add(const key_t &key, const R &record) {
+    template<typename D, typename K, typename R, typename M, typename S>
+    opt_index TableBase<D, K, R, M, S>::add(const key_t &key, const record_t &record) {
+        check_structure();
+
         // Check the key is not present yet
-        try {
-            map.at(key);
+        if (map.find(key).is_set()) {
             return opt_index();
-        } catch (std::out_of_range &e) {}
+        }
+
+        // Evict the record of any key this one would displace from the map
+        evict_conflict(key);
 
         // Check there is enough space
-        if (capacity <= n) {
-            // At capacity -> allocate enough space to add a record
-            allocate(n + 1);
-        }
+        allocate(n + 1);
 
         // Set row to the record
-        util::invoke_n<record_t::count, AddHelper>(arrays, n, record);
+        storage.write(n, record);
 
-        // Update map
-        map[key] = n;
+        // Update map and keys
+        map.insert(key, n);
+        dense_keys.push_back(key);
+        structure_version++;
+        tally(TableStats::adds);
 
         // Return inserted index and increment size
         return opt_index(n++);
     }
 
-    template<typename K, typename R>
-    bool TableSoA<K, R>::add(const key_t *keys, const record_t *records, size_t count) {
+    template<typename D, typename K, typename R, typename M, typename S>
+    bool TableBase<D, K, R, M, S>::add(const key_t *keys, const record_t *records, size_t count) {
+        if (!prepare_batch(keys, count)) {
+            return false;
+        }
+
+        // Copy all records to the end of the data, then add their keys
+        storage.write(n, records, count);
+        append_batch(keys, count);
+        return true;
+    }
+
+    template<typename D, typename K, typename R, typename M, typename S>
+    bool TableBase<D, K, R, M, S>::add(const key_t *keys, const record_ptr_t &records, size_t count) {
+        if (!prepare_batch(keys, count)) {
+            return false;
+        }
+
+        // Copy all records to the end of the data, then add their keys
+        storage.write(n, records, count);
+        append_batch(keys, count);
+        return true;
+    }
+
+    /**
+     * Prepare to add a batch of records: check that none of the keys is present yet, evict the records of any keys they
+     *  would displace from the map, and make space for the batch after the current records.
+     *
+     * \tparam D Implementation type
+     * \tparam K Key type
+     * \tparam R Record type
+     * \tparam M Key-index map type
+     * \tparam S Record storage type
+     * \param keys Keys of the batch
+     * \param count Number of keys
+     * \return `true` iff the batch is to be added (i.e. it isn't empty and none of the keys is present)
+     */
+    template<typename D, typename K, typename R, typename M, typename S>
+    bool TableBase<D, K, R, M, S>::prepare_batch(const key_t *keys, size_t count) {
+        check_structure();
+
         // Skip if count is zero
         if (count == 0) {
             return false;
@@ -974,261 +3271,866 @@ namespace open_sea::data {
 
         // Check no key is present yet
         for (size_t i = 0; i < count; i++) {
-            try {
-                map.at(keys[i]);
+            if (map.find(keys[i]).is_set()) {
                 return false;
-            } catch (std::out_of_range&) {}
+            }
         }
 
-        // Check there is enough space
-        if (capacity < (n + count)) {
-            // Wouldn't fit -> allocate enough space to add all the records
-            allocate(n + count);
+        // Evict the records of any keys these would displace from the map
+        for (size_t i = 0; i < count; i++) {
+            evict_conflict(keys[i]);
         }
 
-        // Append each record
-        for (size_t i = 0; i < count; i++) {
-            // Set row to the record
-            util::invoke_n<record_t::count, AddHelper>(arrays, n, records[i]);
+        // Check there is enough space
+        allocate(n + count);
+        return true;
+    }
 
-            // Update map
-            map[keys[i]] = n++;
+    /**
+     * Add the keys of a batch of records written after the current ones.
+     * A key displacing an earlier key of the same batch from the map (i.e. the same key again, or for sparse maps a
+     *  key sharing its index, such as a newer generation of an entity) wins, and the earlier key's record is dropped
+     *  by compacting the batch in order. So only the last of such keys is added, and the map and the records agree.
+     *
+     * \tparam D Implementation type
+     * \tparam K Key type
+     * \tparam R Record type
+     * \tparam M Key-index map type
+     * \tparam S Record storage type
+     * \param keys Keys of the batch (none present before the batch, see \ref prepare_batch)
+     * \param count Number of keys
+     */
+    template<typename D, typename K, typename R, typename M, typename S>
+    void TableBase<D, K, R, M, S>::append_batch(const key_t *keys, size_t count) {
+        // Map the keys to their indices, noting whether any displaces an earlier one of the batch
+        const size_t first = n;
+        bool displaced = false;
+        for (size_t i = 0; i < count; i++) {
+            displaced |= map.find(keys[i]).is_set() || map.conflict(keys[i]).is_set();
+            map.insert(keys[i], first + i);
         }
+        dense_keys.insert(dense_keys.end(), keys, keys + count);
+        n += count;
+
+        // Drop the records of displaced keys (which no longer map to their index), moving the rest towards the start
+        if (displaced) {
+            size_t next = first;
+            for (size_t i = first; i < n; i++) {
+                if (map.find(dense_keys[i]) != opt_index(i)) {
+                    continue;
+                }
+                if (next != i) {
+                    storage.move_record(next, i);
+                    dense_keys[next] = dense_keys[i];
+                    map.insert(dense_keys[next], next);
+                }
+                next++;
+            }
+            n = next;
+            dense_keys.resize(n);
+        }
+        structure_version++;
+        tally(TableStats::adds, n - first);
+    }
 
-        return true;
+    template<typename D, typename K, typename R, typename M, typename S>
+    opt_index TableBase<D, K, R, M, S>::remove(opt_index idx) {
+        // Find the index's key and remove using the key overload
+        if (idx.is_set() && idx.get() < n) {
+            // Note: copy, because the key's storage gets overwritten by the removal
+            const key_t key = dense_keys[idx.get()];
+            return remove(key);
+        } else {
+            // Unset or out of range
+            return opt_index();
+        }
     }
 
-    template<typename K, typename R>
-    bool TableSoA<K, R>::add(const key_t *keys, const record_ptr_t &records, size_t count) {
-        // Skip if count is zero
-        if (count == 0) {
-            return false;
+    template<typename D, typename K, typename R, typename M, typename S>
+    opt_index TableBase<D, K, R, M, S>::remove(const key_t &key) {
+        check_structure();
+
+        // Check the key is present
+        opt_index found = map.find(key);
+        if (!found.is_set()) {
+            // Not present -> nothing to remove
+            return opt_index();
         }
 
-        // Check no key is present yet
-        for (size_t i = 0; i < count; i++) {
-            try {
-                map.at(keys[i]);
-                return false;
-            } catch (std::out_of_range&) {}
+        // Get the index to delete and of last item
+        size_t index = found.get();
+        size_t last = n - 1;
+
+        // Only copy over when not last
+        if (index != last) {
+            // Move last into deleted
+            storage.move_record(index, last);
+
+            // Update key-index map and move last key into deleted
+            const key_t last_key = dense_keys[last];
+            map.insert(last_key, index);
+            dense_keys[index] = last_key;
         }
 
-        // Check there is enough space
-        if (capacity < (n + count)) {
-            // Wouldn't fit -> allocate enough space to add all the records
-            allocate(n + count);
+        // Decrement size and erase the removed key
+        n--;
+        map.erase(key);
+        dense_keys.pop_back();
+        structure_version++;
+        tally(TableStats::removes);
+
+        return opt_index(index);
+    }
+
+    /**
+     * Remove marked records.
+     * The remaining records are moved towards the start in a single pass, keeping their order, and only the keys of
+     *  moved records are updated in the map.
+     *
+     * \tparam D Implementation type
+     * \tparam K Key type
+     * \tparam R Record type
+     * \tparam M Key-index map type
+     * \tparam S Record storage type
+     * \param marked Flags indexed by record index, set for records to remove
+     * \return Number of removed records
+     */
+    template<typename D, typename K, typename R, typename M, typename S>
+    size_t TableBase<D, K, R, M, S>::remove_marked(const std::vector<bool> &marked) {
+        check_structure();
+
+        assert(marked.size() == n);
+
+        // Find the first removed record (nothing before it moves)
+        const size_t first = std::find(marked.begin(), marked.end(), true) - marked.begin();
+        if (first >= n) {
+            return 0;
         }
 
-        // Copy records data to relevant arrays
-        util::invoke_n<record_t::count, AddsPtrHelper>(arrays, n, records, count);
+        // Move each remaining record after it to the next unoccupied index
+        size_t next = first;
+        for (size_t i = first; i < n; i++) {
+            if (marked[i]) {
+                // Removed -> erase key
+                map.erase(dense_keys[i]);
+            } else {
+                // Remaining -> move record and key
+                storage.move_record(next, i);
+                dense_keys[next] = dense_keys[i];
+                map.insert(dense_keys[next], next);
+                next++;
+            }
+        }
+
+        // Shrink to the remaining records
+        const size_t removed = n - next;
+        n = next;
+        dense_keys.resize(n);
+        structure_version++;
+        tally(TableStats::removes, removed);
+
+        return removed;
+    }
+
+    /**
+     * Reorder the records.
+     * The permutation is applied in place by following each of its cycles, holding a single record aside.
+     *
+     * \tparam D Implementation type
+     * \tparam K Key type
+     * \tparam R Record type
+     * \tparam M Key-index map type
+     * \tparam S Record storage type
+     * \param order Permutation (position `i` holds the current index of the record to move to `i`)
+     *
+     * \throws std::invalid_argument When the order is not a permutation of the records
+     */
+    template<typename D, typename K, typename R, typename M, typename S>
+    void TableBase<D, K, R, M, S>::permute(const std::vector<size_t> &order) {
+        check_structure();
 
-        // Update key map
-        for (size_t i = 0; i < count; i++) {
-            map[keys[i]] = n;
-            n++;
-        }
+        check_order(order, n);
 
-        return true;
-    }
+        std::vector<bool> placed(n, false);
+        for (size_t start = 0; start < n; start++) {
+            // Skip records already in place
+            if (placed[start] || order[start] == start) {
+                continue;
+            }
 
-    template<typename K, typename R>
-    opt_index TableSoA<K, R>::remove(opt_index idx) {
-        // Find the index's key in the map and remove using the key overload
-        if (idx.is_set() && idx.get() < n) {
-            for (auto i = map.begin(); i != map.end(); i++) {
-                if (i->second == idx.get()) {
-                    return remove(i->first);
-                }
+            // Hold the record at the cycle start aside
+            const record_t held = storage.read(start);
+            const key_t held_key = dense_keys[start];
+
+            // Move records along the cycle until the one that goes to the held record's place
+            size_t to = start;
+            for (size_t from = order[start]; from != start; from = order[from]) {
+                storage.move_record(to, from);
+                dense_keys[to] = dense_keys[from];
+                map.insert(dense_keys[to], to);
+                placed[to] = true;
+                to = from;
             }
 
-            // We got here -> none found
-            return opt_index();
-        } else {
-            // Unset or out of range
-            return opt_index();
+            // Close the cycle with the held record
+            storage.write(to, held);
+            dense_keys[to] = held_key;
+            map.insert(held_key, to);
+            placed[to] = true;
         }
+        structure_version++;
     }
 
-    template<typename K, typename R>
-    opt_index TableSoA<K, R>::remove(const key_t &key) {
-        // Check the key is present
-        try {
-            // Get the index to delete and of last item
-            size_t index = map.at(key);
-            size_t last = n - 1;
-
-            // Only copy over when not last
-            if (index != last) {
-                // Move last into deleted
-                util::invoke_n<record_t::count, RemoveHelper>(arrays, index, last);
-
-                // Update key-index map
-                for (auto i = map.begin(); i != map.end(); i++) {
-                    if (i->second == last) {
-                        i->second = index;
-                        break;
-                    }
-                }
-            }
-
-            // Decrement size and erase the removed key
-            n--;
-            map.erase(key);
+    /**
+     * Swap two records.
+     *
+     * \tparam D Implementation type
+     * \tparam K Key type
+     * \tparam R Record type
+     * \tparam M Key-index map type
+     * \tparam S Record storage type
+     * \param a Index of the first record
+     * \param b Index of the second record
+     *
+     * \throws std::invalid_argument When either index is unset
+     * \throws std::out_of_range When either index is outside the table
+     */
+    template<typename D, typename K, typename R, typename M, typename S>
+    void TableBase<D, K, R, M, S>::swap(const opt_index &a, const opt_index &b) {
+        check_structure();
 
-            return opt_index(index);
-        } catch (std::out_of_range &e) {
-            // Not present -> nothing to remove
-            return opt_index();
+        // Check the indices are set and within range
+        if (!a.is_set() || !b.is_set()) {
+            // Not set -> error
+            throw std::invalid_argument("Index is not set.");
+        }
+        if (a.get() >= n || b.get() >= n) {
+            // Outside -> error
+            throw std::out_of_range("Index is outside the table.");
         }
-    }
 
-    template<typename K, typename R>
-    opt_index TableSoA<K, R>::lookup(const key_t &key) {
-        // Find the key
-        try {
-            // Return index when found
-            return opt_index(map.at(key));
-        } catch (std::out_of_range &e) {
-            // Not present -> unset
-            return opt_index();
+        // Nothing to do when swapping a record with itself
+        const size_t i = a.get();
+        const size_t j = b.get();
+        if (i == j) {
+            return;
         }
+
+        // Swap the records
+        const record_t held = storage.read(i);
+        storage.move_record(i, j);
+        storage.write(j, held);
+
+        // Swap the keys and update their indices
+        std::swap(dense_keys[i], dense_keys[j]);
+        map.insert(dense_keys[i], i);
+        map.insert(dense_keys[j], j);
+        structure_version++;
     }
 
-    template<typename K, typename R>
-    typename TableSoA<K, R>::key_t TableSoA<K, R>::lookup(const opt_index &idx) {
+    template<typename D, typename K, typename R, typename M, typename S>
+    typename TableBase<D, K, R, M, S>::key_t TableBase<D, K, R, M, S>::lookup(const opt_index &idx) {
         // Check the index is valid
         if (!idx.is_set()) {
             // Unset -> error
             throw std::out_of_range("Index is unset.");
         }
-        if (idx.get() > n) {
+        if (idx.get() >= n) {
             // Outside -> error
             throw std::out_of_range("Index is outside the table.");
         }
 
-        // Find the key
-        for (auto i = map.begin(); i != map.end(); i++) {
-            if (i->second == idx.get()) {
-                return i->first;
-            }
-        }
-
-        // Not found -> error
-        throw std::out_of_range("No record found for the provided key.");
+        // Return the key stored alongside the record
+        return dense_keys[idx.get()];
     }
 
-    template<typename K, typename R>
-    typename TableSoA<K, R>::record_t TableSoA<K, R>::get_copy(const key_t &key) {
+    template<typename D, typename K, typename R, typename M, typename S>
+    typename TableBase<D, K, R, M, S>::record_t TableBase<D, K, R, M, S>::get_copy(const key_t &key) {
         // Check the key is present
-        try {
-            // Get the index and prepare result
-            size_t index = map.at(key);
-            record_t result;
-
-            // Move last into deleted
-            util::invoke_n<record_t::count, GetCopyHelper>(arrays, index, result);
-
-            return result;
-        } catch (std::out_of_range &e) {
+        opt_index found = count_lookup(map.find(key));
+        if (!found.is_set()) {
             // Not present -> error
             throw std::out_of_range("No record found for the provided key.");
         }
+
+        // Return copy of the record associated with the key
+        return storage.read(found.get());
     }
 
-    template<typename K, typename R>
-    typename TableSoA<K, R>::record_t TableSoA<K, R>::get_copy(const opt_index &i) {
+    template<typename D, typename K, typename R, typename M, typename S>
+    typename TableBase<D, K, R, M, S>::record_t TableBase<D, K, R, M, S>::get_copy(const opt_index &i) {
         // Check the index is set and within range
         if (!i.is_set()) {
             // Not set -> error
             throw std::invalid_argument("Index is not set.");
-        } else if(i.get() < this->n) {
-            // Get the index and prepare result
-            size_t index = i.get();
-            record_t result;
-
-            // Move last into deleted
-            util::invoke_n<record_t::count, GetCopyHelper>(arrays, index, result);
-
-            return result;
+        } else if (i.get() < n) {
+            // Return copy of the record at the index
+            return storage.read(i.get());
         } else {
             // Not present -> error
             throw std::out_of_range("No record found for the provided index.");
         }
     }
 
-    template<typename K, typename R>
-    typename TableSoA<K, R>::record_ptr_t TableSoA<K, R>::get_reference(const key_t &key) {
+    template<typename D, typename K, typename R, typename M, typename S>
+    typename TableBase<D, K, R, M, S>::record_ptr_t TableBase<D, K, R, M, S>::get_reference(const key_t &key) {
         // Check the key is present
-        try {
-            // Get the index and prepare result
-            size_t index = map.at(key);
-            record_ptr_t result;
-
-            // Set result to point to the correct entries
-            util::invoke_n<record_t::count, GetRefHelper>(arrays, index, result);
-
-            return result;
-        } catch (std::out_of_range &e) {
+        opt_index found = count_lookup(map.find(key));
+        if (!found.is_set()) {
             // Not present -> error
             throw std::out_of_range("No record found for the provided key.");
         }
+
+        // Point to the record associated with the key
+        return storage.reference(found.get());
     }
 
-    template<typename K, typename R>
-    typename TableSoA<K, R>::record_ptr_t TableSoA<K, R>::get_reference(const opt_index &i) {
+    template<typename D, typename K, typename R, typename M, typename S>
+    typename TableBase<D, K, R, M, S>::record_ptr_t TableBase<D, K, R, M, S>::get_reference(const opt_index &i) {
         // Check if the index is set and within range
         if (!i.is_set()) {
             // Not set -> error
             throw std::invalid_argument("Index is not set.");
-        } else if (i.get() < this->n) {
-            // Get the index and prepare result
-            size_t index = i.get();
-            record_ptr_t result;
-
-            // Set result to point to the correct entries
-            util::invoke_n<record_t::count, GetRefHelper>(arrays, index, result);
-
-            return result;
+        } else if (i.get() < n) {
+            // Point to the record at the index
+            return storage.reference(i.get());
         } else {
             // Not present -> error
             throw std::out_of_range("No record found for the provided index.");
         }
     }
 
-    template<typename K, typename R>
-    typename TableSoA<K, R>::record_ptr_t TableSoA<K, R>::get_reference() {
-        // Prepare result
-        record_ptr_t result;
-
-        // Set result to point to array starts
-        util::invoke_n<record_t::count, GetRefHelper>(arrays, 0u, result);
-
+    template<typename D, typename K, typename R, typename M, typename S>
+    typename TableBase<D, K, R, M, S>::record_ptr_t TableBase<D, K, R, M, S>::get_reference() {
+        // Point to the first record (or leave the reference empty when no space is allocated yet)
+        record_ptr_t result{};
+        if (storage.allocated() > 0) {
+            result = storage.reference(0);
+        }
         return result;
     }
 
-    template<typename K, typename R>
-    void TableSoA<K, R>::get_reference(const key_t *keys, record_ptr_t *dest, size_t count) {
-        // Go through keys for each member and set references
-        util::invoke_n<record_t::count, GetRefsHelper>(arrays, map, keys, dest, count);
+    template<typename D, typename K, typename R, typename M, typename S>
+    void TableBase<D, K, R, M, S>::get_reference(const key_t *keys, record_ptr_t *dest, size_t count) {
+        // Process the keys in batches
+        size_t indices[lookup_batch];
+        for (size_t done = 0; done < count; done += lookup_batch) {
+            // Resolve the whole batch of keys to indices at once
+            const size_t batch = std::min(lookup_batch, count - done);
+            const uint64_t misses = map.find(keys + done, indices, batch);
+            count_lookups(batch, misses);
+
+            // Fill in the references from the indices
+            storage.references(indices, misses, dest + done, batch);
+        }
     }
 
-    template<typename K, typename R>
-    std::vector<typename TableSoA<K, R>::key_t> TableSoA<K, R>::keys() {
-        std::vector<key_t> result;
-        for (auto kv : map) {
-            result.push_back(kv.first);
+    /** \class StructureLock
+     * Scoped lock of a table's structure (see \ref Table::lock_structure).
+     *
+     * \tparam T Table type
+     */
+    template<typename T>
+    class StructureLock {
+        private:
+            //! Locked table
+            T &table;
+
+        public:
+            //! Lock the table's structure
+            explicit StructureLock(T &table) : table(table) { table.lock_structure(); }
+            StructureLock(const StructureLock &other) = delete;
+            StructureLock &operator=(const StructureLock &other) = delete;
+            //! Unlock the table's structure
+            ~StructureLock() { table.unlock_structure(); }
+    };
+
+    /** \class TableAdaptor
+     * Adaptor exposing a table implementation through the virtual \ref Table interface.
+     * Does not own the table, which has to outlive it.
+     *
+     * \tparam T Table implementation type
+     */
+    template<typename T>
+    class TableAdaptor : public Table<typename T::key_t, typename T::record_t> {
+        public:
+            //! Key type
+            typedef typename T::key_t key_t;
+            //! Record type
+            typedef typename T::record_t record_t;
+            //! Record pointer type (struct of pointers to members of R)
+            typedef typename T::record_ptr_t record_ptr_t;
+
+        private:
+            //! Adapted table
+            T &table;
+
+        public:
+            //! Construct an adaptor of the table
+            explicit TableAdaptor(T &table) : table(table) {}
+
+            opt_index add(const key_t &key, const record_t &record) override { return table.add(key, record); }
+            bool add(const key_t *keys, const record_t *records, size_t count) override { return table.add(keys, records, count); }
+            bool add(const key_t *keys, const record_ptr_t &records, size_t count) override { return table.add(keys, records, count); }
+            opt_index remove(const key_t &key) override { return table.remove(key); }
+            opt_index remove(opt_index idx) override { return table.remove(idx); }
+            size_t remove(const key_t *keys, size_t count) override { return table.remove(keys, count); }
+            size_t remove_marked(const std::vector<bool> &marked) override { return table.remove_marked(marked); }
+            void permute(const std::vector<size_t> &order) override { table.permute(order); }
+            void swap(const opt_index &a, const opt_index &b) override { table.swap(a, b); }
+            opt_index conflict(const key_t &key) override { return table.conflict(key); }
+            opt_index lookup(const key_t &key) override { return table.lookup(key); }
+            key_t lookup(const opt_index &idx) override { return table.lookup(idx); }
+            record_t get_copy(const key_t &key) override { return table.get_copy(key); }
+            record_t get_copy(const opt_index &i) override { return table.get_copy(i); }
+            record_ptr_t get_reference(const key_t &key) override { return table.get_reference(key); }
+            record_ptr_t get_reference(const opt_index &i) override { return table.get_reference(i); }
+            record_ptr_t get_reference() override { return table.get_reference(); }
+            void get_reference(const key_t *keys, record_ptr_t *dest, size_t count) override { table.get_reference(keys, dest, count); }
+            void increment_reference(record_ptr_t &ref) override { table.increment_reference(ref); }
+            size_t segment_count() override { return table.segment_count(); }
+            size_t segment(size_t seg, record_ptr_t &start, size_t &stride) override { return table.segment(seg, start, stride); }
+            void sample_scan(uint64_t columns, size_t count) override { table.sample_scan(columns, count); }
+            size_t size() override { return table.size(); }
+            const std::vector<key_t> &keys() override { return table.keys(); }
+            uint64_t version() override { return table.version(); }
+            void track_changes(bool enable) override { table.track_changes(enable); }
+            bool tracking_changes() override { return table.tracking_changes(); }
+            uint64_t column_version(size_t c) override { return table.column_version(c); }
+            void touch(const key_t &key, uint64_t columns) override { table.touch(key, columns); }
+            void touch(const opt_index &i, uint64_t columns) override { table.touch(i, columns); }
+            uint64_t changes(const key_t &key) override { return table.changes(key); }
+            const std::vector<key_t> &changed_keys() override { return table.changed_keys(); }
+            void clear_changes() override { table.clear_changes(); }
+            void lock_structure() override { table.lock_structure(); }
+            void unlock_structure() override { table.unlock_structure(); }
+            bool structure_locked() override { return table.structure_locked(); }
+            TableStats stats() override { return table.stats(); }
+            void reset_stats() override { table.reset_stats(); }
+            void reserve(size_t size, bool prefault) override { table.reserve(size, prefault); }
+            void shrink_to_fit() override { table.shrink_to_fit(); }
+            size_t trim() override { return table.trim(); }
+            size_t allocated() override { return table.allocated(); }
+            size_t pages() override { return table.pages(); }
+            const char* type_name() override { return table.type_name(); }
+    };
+
+    /** \class TableAoS
+     * Table that stores its records as an array of structs (see \ref StorageAoS)
+     *
+     * \tparam K Key type
+     * \tparam R Record type
+     * \tparam M Key-index map type
+     * \tparam A Allocation policy (e.g. \ref HeapAllocation or \ref MappedAllocation)
+     */
+    template<typename K, typename R, typename M = HashKeyMap<K>, typename A = HeapAllocation>
+    class TableAoS : public TableBase<TableAoS<K, R, M, A>, K, R, M, StorageAoS<R, A>> {
+            typedef TableBase<TableAoS<K, R, M, A>, K, R, M, StorageAoS<R, A>> base_t;
+
+        public:
+            //! Construct the table and defer allocation to first insertion
+            TableAoS() = default;
+
+            /**
+             * Construct the table and allocate space for `count` records
+             *
+             * \param count Number of records to allocate space for
+             */
+            explicit TableAoS(size_t count) : base_t(count, M()) {}
+
+            /**
+             * Construct the table with the key map and allocate space for `count` records
+             *
+             * \param count Number of records to allocate space for
+             * \param map Key map (empty, e.g. constructed with non-default options)
+             */
+            TableAoS(size_t count, M map) : base_t(count, std::move(map)) {}
+    };
+
+    /** \class TableSoA
+     * Table that stores its records as a struct of arrays (see \ref StorageSoA)
+     *
+     * \tparam K Key type
+     * \tparam R Record type
+     * \tparam M Key-index map type
+     * \tparam A Allocation policy (e.g. \ref HeapAllocation or \ref MappedAllocation)
+     */
+    template<typename K, typename R, typename M = HashKeyMap<K>, typename A = HeapAllocation>
+    class TableSoA : public TableBase<TableSoA<K, R, M, A>, K, R, M, StorageSoA<R, A>> {
+            typedef TableBase<TableSoA<K, R, M, A>, K, R, M, StorageSoA<R, A>> base_t;
+
+        public:
+            //! Construct the table and defer allocation to first insertion
+            TableSoA() = default;
+
+            /**
+             * Construct the table and allocate space for `count` records
+             *
+             * \param count Number of records to allocate space for
+             */
+            explicit TableSoA(size_t count) : base_t(count, M()) {}
+
+            /**
+             * Construct the table with the key map and allocate space for `count` records
+             *
+             * \param count Number of records to allocate space for
+             * \param map Key map (empty, e.g. constructed with non-default options)
+             */
+            TableSoA(size_t count, M map) : base_t(count, std::move(map)) {}
+    };
+
+    /** \class TableChunked
+     * Table that stores its records in fixed-size chunks, each holding a struct of arrays (see \ref StorageChunked)
+     * Growth appends new chunks instead of reallocating, so records are never copied on growth and references to them
+     *  remain valid until a removal moves them.
+     *
+     * \tparam K Key type
+     * \tparam R Record type
+     * \tparam M Key-index map type
+     * \tparam B Chunk size in bytes (power of two, at least one page)
+     */
+    template<typename K, typename R, typename M = HashKeyMap<K>, size_t B = (1u << 16u)>
+    class TableChunked : public TableBase<TableChunked<K, R, M, B>, K, R, M, StorageChunked<R, B>> {
+            typedef TableBase<TableChunked<K, R, M, B>, K, R, M, StorageChunked<R, B>> base_t;
+
+        public:
+            //! Construct the table and defer allocation to first insertion
+            TableChunked() = default;
+
+            /**
+             * Construct the table and allocate space for `count` records
+             *
+             * \param count Number of records to allocate space for
+             */
+            explicit TableChunked(size_t count) : base_t(count, M()) {}
+
+            /**
+             * Construct the table with the key map and allocate space for `count` records
+             *
+             * \param count Number of records to allocate space for
+             * \param map Key map (empty, e.g. constructed with non-default options)
+             */
+            TableChunked(size_t count, M map) : base_t(count, std::move(map)) {}
+    };
+
+    /** \class TableAoSoA
+     * Table that stores its records as an array of blocks, each block holding a struct of arrays of W records (see
+     *  \ref StorageAoSoA)
+     *
+     * \tparam K Key type
+     * \tparam R Record type
+     * \tparam M Key-index map type
+     * \tparam W Number of records in a block (power of two, e.g. 4, 8 or 16)
+     * \tparam G Mask of members stored in blocks (bit N set iff member N is in the blocks)
+     * \tparam A Allocation policy (e.g. \ref HeapAllocation or \ref MappedAllocation)
+     */
+    template<typename K, typename R, typename M = HashKeyMap<K>, size_t W = 8, uint64_t G = ~static_cast<uint64_t>(0),
+            typename A = HeapAllocation>
+    class TableAoSoA : public TableBase<TableAoSoA<K, R, M, W, G, A>, K, R, M, StorageAoSoA<R, W, G, A>> {
+            typedef TableBase<TableAoSoA<K, R, M, W, G, A>, K, R, M, StorageAoSoA<R, W, G, A>> base_t;
+
+        public:
+            //! Construct the table and defer allocation to first insertion
+            TableAoSoA() = default;
+
+            /**
+             * Construct the table and allocate space for `count` records
+             *
+             * \param count Number of records to allocate space for
+             */
+            explicit TableAoSoA(size_t count) : base_t(count, M()) {}
+
+            /**
+             * Construct the table with the key map and allocate space for `count` records
+             *
+             * \param count Number of records to allocate space for
+             * \param map Key map (empty, e.g. constructed with non-default options)
+             */
+            TableAoSoA(size_t count, M map) : base_t(count, std::move(map)) {}
+    };
+
+    /** \class TableAdaptive
+     * Table that stores its records either as an array of structs or as a struct of arrays, and switches between the two
+     *  depending on how its records are accessed (see \ref StorageAdaptive).
+     *
+     * Accesses are sampled as they happen: records accessed by key or index (e.g. \ref get_copy and keyed
+     *  \ref get_reference), and records covered by sequential scans along with the columns they read (views report
+     *  the viewed columns, see \ref sample_scan, while \ref get_reference from the start exposes all of them).
+     * Each layout's cost of the sampled accesses is estimated in cache lines touched:
+     *  - A random access reads the whole record, touching its lines in AoS, but one line per member in SoA.
+     *  - A scan touches up to a line per read column of each record in AoS (at most the whole record), but only the
+     *     read columns in SoA.
+     *
+     * The layout is only changed in \ref adapt, which has to be called at a quiet point (e.g. during garbage collection).
+     * It switches once enough accesses are sampled and the other layout's estimate is lower by \ref adapt_margin.
+     * Switching copies all the records straight into the other layout's storage in the same order, so keys and indices
+     *  stay valid (references do not).
+     * The last decision and the time taken by the switch are kept for debugging (see \ref last_decision).
+     *
+     * \tparam K Key type
+     * \tparam R Record type
+     * \tparam M Key-index map type
+     * \tparam A Allocation policy (e.g. \ref HeapAllocation or \ref MappedAllocation)
+     */
+    template<typename K, typename R, typename M = HashKeyMap<K>, typename A = HeapAllocation>
+    class TableAdaptive : public TableBase<TableAdaptive<K, R, M, A>, K, R, M, StorageAdaptive<R, A>> {
+            typedef TableBase<TableAdaptive<K, R, M, A>, K, R, M, StorageAdaptive<R, A>> base_t;
+
+        public:
+            //! Key type
+            typedef K key_t;
+            //! Record type
+            typedef R record_t;
+            //! Record pointer type (struct of pointers to members of R)
+            typedef typename R::Ptr record_ptr_t;
+
+            //! Minimum number of sampled accesses before the layout can be switched
+            static constexpr uint64_t min_samples = 1024;
+            //! Factor by which the other layout's estimated cost has to be lower to switch to it
+            static constexpr double adapt_margin = 2.0;
+            //! Assumed cache line size in bytes
+            static constexpr double line_size = 64.0;
+
+            /** \struct Decision
+             * Outcome of an adaptation
+             */
+            struct Decision {
+                //! Whether any decision has been made yet
+                bool made = false;
+                //! Layout before the decision
+                RecordLayout from = RecordLayout::soa;
+                //! Layout after the decision
+                RecordLayout to = RecordLayout::soa;
+                //! Accesses by key or index sampled
+                uint64_t random = 0;
+                //! Records covered by scans sampled
+                uint64_t scanned = 0;
+                //! Estimated cache lines touched by the sampled accesses in AoS
+                double aos_lines = 0.0;
+                //! Estimated cache lines touched by the sampled accesses in SoA
+                double soa_lines = 0.0;
+                //! Bytes of records copied by the switch (0 if kept)
+                size_t bytes_copied = 0;
+                //! Time taken by the switch in milliseconds (0 if kept)
+                double milliseconds = 0.0;
+            };
+
+        private:
+            //! Records accessed by key or index since the last decision
+            std::atomic<uint64_t> sampled_random{0};
+            //! Records covered by scans since the last decision
+            std::atomic<uint64_t> sampled_scanned{0};
+            //! Bytes the scans since the last decision would fetch in AoS
+            std::atomic<uint64_t> scanned_aos_bytes{0};
+            //! Bytes the scans since the last decision would fetch in SoA
+            std::atomic<uint64_t> scanned_soa_bytes{0};
+            //! Last decision
+            Decision decision{};
+
+        public:
+            /**
+             * Construct the table in the layout and allocate space for `count` records
+             *
+             * \param count Number of records to allocate space for
+             * \param map Key map (empty, e.g. constructed with non-default options)
+             * \param layout Initial layout
+             */
+            explicit TableAdaptive(size_t count = 0, M map = M(), RecordLayout layout = RecordLayout::soa) {
+                this->map = std::move(map);
+                this->storage.switch_layout(layout, 0);
+                this->allocate(count);
+            }
+
+            record_t get_copy(const key_t &key) {
+                sample(sampled_random, 1);
+                return base_t::get_copy(key);
+            }
+            record_t get_copy(const opt_index &i) {
+                sample(sampled_random, 1);
+                return base_t::get_copy(i);
+            }
+            record_ptr_t get_reference(const key_t &key) {
+                sample(sampled_random, 1);
+                return base_t::get_reference(key);
+            }
+            record_ptr_t get_reference(const opt_index &i) {
+                sample(sampled_random, 1);
+                return base_t::get_reference(i);
+            }
+            record_ptr_t get_reference() {
+                sample_scan(all_columns, this->n);
+                return base_t::get_reference();
+            }
+            void get_reference(const key_t *keys, record_ptr_t *dest, size_t count) {
+                sample(sampled_random, count);
+                base_t::get_reference(keys, dest, count);
+            }
+
+            /**
+             * Sample a scan reading the selected columns of a number of records
+             *
+             * \param columns Mask of the read columns (see \ref column)
+             * \param count Number of records
+             */
+            void sample_scan(uint64_t columns, size_t count) {
+                size_t read = 0;
+                size_t read_bytes = 0;
+                util::invoke_n<record_t::count, ColumnBytesHelper>(columns, read, read_bytes);
+                sample(sampled_scanned, count);
+                sample(scanned_aos_bytes, count * std::min(sizeof(record_t), read * static_cast<size_t>(line_size)));
+                sample(scanned_soa_bytes, count * read_bytes);
+            }
+
+            //! Get the current layout
+            RecordLayout layout() { return this->storage.layout(); }
+
+            //! Get the number of records accessed by key or index sampled since the last decision
+            uint64_t sampled_random_accesses() { return sampled_random.load(std::memory_order_relaxed); }
+
+            //! Get the number of records covered by scans sampled since the last decision
+            uint64_t sampled_scanned_records() { return sampled_scanned.load(std::memory_order_relaxed); }
+
+            //! Get the last decision (see \ref adapt)
+            const Decision &last_decision() { return decision; }
+
+            bool adapt();
+            void switch_layout(RecordLayout target);
+
+        private:
+            //! Helper functor to count the Nth column and its bytes if it is selected
+            template <size_t N>
+            struct ColumnBytesHelper {
+                void operator()(uint64_t columns, size_t &read, size_t &read_bytes) {
+                    if (columns & column(N)) {
+                        read++;
+                        read_bytes += sizeof(typename util::GetMemberType<record_t, N>::type);
+                    }
+                }
+            };
+
+            //! Add to the sample counter
+            static void sample(std::atomic<uint64_t> &counter, uint64_t by) {
+                counter.fetch_add(by, std::memory_order_relaxed);
+            }
+    };
+
+    /**
+     * Decide the layout based on the accesses sampled since the last decision, and switch to it if needed.
+     * Does nothing while the structure is locked, or until enough accesses are sampled (see \ref min_samples).
+     * Has to be called at a quiet point, as switching invalidates all references.
+     *
+     * \return `true` iff the layout was switched
+     */
+    template<typename K, typename R, typename M, typename A>
+    bool TableAdaptive<K, R, M, A>::adapt() {
+        const uint64_t random = sampled_random.load(std::memory_order_relaxed);
+        const uint64_t scanned = sampled_scanned.load(std::memory_order_relaxed);
+        if (this->structure_locked() || random + scanned < min_samples) {
+            return false;
         }
-        return result;
+        const uint64_t aos_bytes = scanned_aos_bytes.load(std::memory_order_relaxed);
+        const uint64_t soa_bytes = scanned_soa_bytes.load(std::memory_order_relaxed);
+        sampled_random.store(0, std::memory_order_relaxed);
+        sampled_scanned.store(0, std::memory_order_relaxed);
+        scanned_aos_bytes.store(0, std::memory_order_relaxed);
+        scanned_soa_bytes.store(0, std::memory_order_relaxed);
+
+        // Estimate cache lines touched by the sampled accesses in each layout
+        const double record_bytes = sizeof(record_t);
+        Decision d;
+        d.made = true;
+        d.from = layout();
+        d.random = random;
+        d.scanned = scanned;
+        d.aos_lines = random * std::ceil(record_bytes / line_size) + aos_bytes / line_size;
+        d.soa_lines = random * static_cast<double>(record_t::count) + soa_bytes / line_size;
+
+        // Switch only when the other layout is clearly better
+        const double current = (d.from == RecordLayout::aos) ? d.aos_lines : d.soa_lines;
+        const double other = (d.from == RecordLayout::aos) ? d.soa_lines : d.aos_lines;
+        d.to = (other * adapt_margin < current) ?
+               ((d.from == RecordLayout::aos) ? RecordLayout::soa : RecordLayout::aos) : d.from;
+
+        if (d.to != d.from) {
+            const auto start = std::chrono::steady_clock::now();
+            switch_layout(d.to);
+            const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            d.milliseconds = elapsed.count();
+            d.bytes_copied = this->n * sizeof(record_t);
+        }
+        decision = d;
+        return d.to != d.from;
     }
 
-    template<typename K, typename R>
-    TableSoA<K, R>::~TableSoA() {
-        // Deallocate data
-        if (data && capacity > 0) {
-            free(data);
+    /**
+     * Switch to the layout, copying all records over to the other layout's storage in the same order
+     * Invalidates all references, but not keys or indices.
+     *
+     * \param target Layout to switch to
+     *
+     * \throws std::logic_error When the structure is locked
+     */
+    template<typename K, typename R, typename M, typename A>
+    void TableAdaptive<K, R, M, A>::switch_layout(RecordLayout target) {
+        this->check_structure();
+        if (target == layout()) {
+            return;
         }
+
+        const size_t copied = this->storage.switch_layout(target, this->n);
+        this->structure_version++;
+        this->tally(TableStats::reallocations);
+        this->tally(TableStats::bytes_copied, copied);
     }
 
+    /** \struct AoSLayout
+     * Layout policy selecting \ref TableAoS
+     */
+    struct AoSLayout {
+        template<typename K, typename R, typename M = HashKeyMap<K>, typename A = HeapAllocation>
+        using table = TableAoS<K, R, M, A>;
+    };
+
+    /** \struct SoALayout
+     * Layout policy selecting \ref TableSoA
+     */
+    struct SoALayout {
+        template<typename K, typename R, typename M = HashKeyMap<K>, typename A = HeapAllocation>
+        using table = TableSoA<K, R, M, A>;
+    };
+
+    /** \struct AdaptiveLayout
+     * Layout policy selecting \ref TableAdaptive
+     */
+    struct AdaptiveLayout {
+        template<typename K, typename R, typename M = HashKeyMap<K>, typename A = HeapAllocation>
+        using table = TableAdaptive<K, R, M, A>;
+    };
+
+    /** \struct ChunkedLayout
+     * Layout policy selecting \ref TableChunked
+     * Chunks are small fixed-size heap allocations, so the allocation policy is accepted but ignored.
+     *
+     * \tparam B Chunk size in bytes
+     */
+    template<size_t B = (1u << 16u)>
+    struct ChunkedLayout {
+        template<typename K, typename R, typename M = HashKeyMap<K>, typename /*A*/ = HeapAllocation>
+        using table = TableChunked<K, R, M, B>;
+    };
+
+    /** \struct AoSoALayout
+     * Layout policy selecting \ref TableAoSoA
+     *
+     * \tparam W Number of records in a block
+     * \tparam G Mask of members stored in blocks
+     */
+    template<size_t W = 8, uint64_t G = ~static_cast<uint64_t>(0)>
+    struct AoSoALayout {
+        template<typename K, typename R, typename M = HashKeyMap<K>, typename A = HeapAllocation>
+        using table = TableAoSoA<K, R, M, W, G, A>;
+    };
+
     /**
      * @}
      */
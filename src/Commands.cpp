@@ -0,0 +1,448 @@
+/** \file Commands.cpp
+ * Deferred structural command implementations
+ *
+ * \author Filip Smola
+ */
+
+#include <open-sea/Commands.h>
+#include <open-sea/Components.h>
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace open_sea::ecs {
+    /**
+     * \brief Move commands from the source list to the end of the destination list
+     *
+     * \tparam T Command type
+     * \param dest Destination list
+     * \param src Source list (left empty)
+     */
+    template<typename T>
+    void take(std::vector<T> &dest, std::vector<T> &src) {
+        dest.insert(dest.end(), src.begin(), src.end());
+        src.clear();
+    }
+
+    /**
+     * \brief Compare entities in the order commands are sorted in
+     *
+     * Entities are ordered by index first, so that the tables' sparse maps are accessed in order.
+     *
+     * \param a First entity
+     * \param b Second entity
+     * \return `true` iff the first entity is ordered before the second one
+     */
+    bool entity_before(const Entity &a, const Entity &b) {
+        if (a.index() != b.index()) {
+            return a.index() < b.index();
+        }
+        return a.id < b.id;
+    }
+
+    /**
+     * \brief Sort commands by entity, keeping only the last recorded command for each entity
+     *
+     * \tparam T Command type
+     * \param commands Commands
+     */
+    template<typename T>
+    void sort_unique(std::vector<T> &commands) {
+        std::sort(commands.begin(), commands.end(), [](const T &a, const T &b) {
+            if (a.entity != b.entity) {
+                return entity_before(a.entity, b.entity);
+            }
+            return a.seq > b.seq;
+        });
+        commands.erase(std::unique(commands.begin(), commands.end(), [](const T &a, const T &b) {
+            return a.entity == b.entity;
+        }), commands.end());
+    }
+
+    /**
+     * \brief Check whether the entity is removed by a command recorded after the provided sequence number
+     *
+     * \tparam T Removal command type
+     * \param removes Removals (sorted, see \ref sort_unique)
+     * \param e Entity
+     * \param seq Sequence number
+     * \return `true` iff the entity's removal was recorded after the sequence number
+     */
+    template<typename T>
+    bool removed_after(const std::vector<T> &removes, const Entity &e, uint64_t seq) {
+        auto r = std::lower_bound(removes.begin(), removes.end(), e, [](const T &c, const Entity &k) {
+            return entity_before(c.entity, k);
+        });
+        return r != removes.end() && r->entity == e && r->seq > seq;
+    }
+
+    /**
+     * \brief Check whether the parent or any further ancestor is removed by a command recorded after the provided
+     *  sequence number
+     *
+     * Ancestors are followed through the table where present, and through their recorded additions otherwise.
+     *
+     * \tparam R Removal command type
+     * \tparam A Transformation addition command type
+     * \tparam T Transformation table type
+     * \param removes Removals (sorted, see \ref sort_unique)
+     * \param adds Additions (sorted, see \ref sort_unique)
+     * \param table Transformation table
+     * \param parent Parent entity
+     * \param seq Sequence number
+     * \return `true` iff the removal of an ancestor was recorded after the sequence number
+     */
+    template<typename R, typename A, typename T>
+    bool ancestor_removed_after(const std::vector<R> &removes, const std::vector<A> &adds, T &table, Entity parent,
+                                uint64_t seq) {
+        // Bound the walk, so that cycles among the recorded additions can't make it loop forever
+        for (size_t steps = 0; steps <= adds.size() + table.size(); steps++) {
+            if (removed_after(removes, parent, seq)) {
+                return true;
+            }
+
+            data::opt_index i = table.lookup(parent);
+            if (i.is_set()) {
+                data::opt_index next = *table.get_reference(i).parent;
+                if (!next.is_set()) {
+                    return false;
+                }
+                parent = table.keys()[next.get()];
+            } else {
+                auto a = std::lower_bound(adds.begin(), adds.end(), parent, [](const A &c, const Entity &k) {
+                    return entity_before(c.entity, k);
+                });
+                if (a == adds.end() || a->entity != parent || !a->has_parent) {
+                    return false;
+                }
+                parent = a->parent;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * \brief Get the entities of the commands
+     *
+     * \tparam T Command type
+     * \param commands Commands
+     * \return Entities in the order of the commands
+     */
+    template<typename T>
+    std::vector<Entity> entities_of(const std::vector<T> &commands) {
+        std::vector<Entity> result;
+        result.reserve(commands.size());
+        for (const T &c : commands) {
+            result.push_back(c.entity);
+        }
+        return result;
+    }
+
+    //--- start CommandBuffer implementation
+    /**
+     * \brief Construct a command buffer for the component managers
+     *
+     * \param models Model component manager
+     * \param transformations Transformation component manager
+     */
+    CommandBuffer::CommandBuffer(std::shared_ptr<ModelTable> models, std::shared_ptr<TransformationTable> transformations)
+            : models(std::move(models)), transformations(std::move(transformations)) {}
+
+    /**
+     * \brief Get the shard the calling thread records into
+     *
+     * \return Shard
+     */
+    CommandBuffer::Shard &CommandBuffer::shard() {
+        return shards[std::hash<std::thread::id>{}(std::this_thread::get_id()) % shard_count];
+    }
+
+    /**
+     * \brief Record adding a model component to the entity
+     *
+     * \param e Entity
+     * \param model Index of the model (see \ref ModelTable::model_to_index)
+     */
+    void CommandBuffer::add_model(const Entity &e, size_t model) {
+        Shard &s = shard();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.model_adds.push_back(ModelAdd{e, model, next_seq++});
+    }
+
+    /**
+     * \brief Record removing the entity's model component
+     *
+     * \param e Entity
+     */
+    void CommandBuffer::remove_model(const Entity &e) {
+        Shard &s = shard();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.model_removes.push_back(Remove{e, next_seq++});
+    }
+
+    /**
+     * \brief Record adding a root transformation component to the entity
+     *
+     * \param e Entity
+     * \param position Position
+     * \param orientation Orientation
+     * \param scale Scale
+     */
+    void CommandBuffer::add_transformation(const Entity &e, const glm::vec3 &position, const glm::quat &orientation, const glm::vec3 &scale) {
+        Shard &s = shard();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.transformation_adds.push_back(TransformationAdd{e, position, orientation, scale, Entity(), false, next_seq++});
+    }
+
+    /**
+     * \brief Record adding a transformation component to the entity, under the parent's transformation
+     *
+     * The parent may itself be added by this buffer.
+     *
+     * \param e Entity
+     * \param position Position
+     * \param orientation Orientation
+     * \param scale Scale
+     * \param parent Parent entity
+     */
+    void CommandBuffer::add_transformation(const Entity &e, const glm::vec3 &position, const glm::quat &orientation, const glm::vec3 &scale, const Entity &parent) {
+        Shard &s = shard();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.transformation_adds.push_back(TransformationAdd{e, position, orientation, scale, parent, true, next_seq++});
+    }
+
+    /**
+     * \brief Record removing the entity's transformation component, along with those of its children
+     *
+     * \param e Entity
+     */
+    void CommandBuffer::remove_transformation(const Entity &e) {
+        Shard &s = shard();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.transformation_removes.push_back(Remove{e, next_seq++});
+    }
+
+    /**
+     * \brief Record making the entity's transformation a root
+     *
+     * \param e Entity
+     */
+    void CommandBuffer::adopt(const Entity &e) {
+        Shard &s = shard();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.adopts.push_back(Adopt{e, Entity(), false, next_seq++});
+    }
+
+    /**
+     * \brief Record moving the entity's transformation under the parent's transformation
+     *
+     * \param e Entity
+     * \param parent Parent entity
+     */
+    void CommandBuffer::adopt(const Entity &e, const Entity &parent) {
+        Shard &s = shard();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.adopts.push_back(Adopt{e, parent, true, next_seq++});
+    }
+
+    /**
+     * \brief Get the number of recorded commands
+     *
+     * \return Number of recorded commands
+     */
+    size_t CommandBuffer::size() {
+        size_t result = 0;
+        for (Shard &s : shards) {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            result += s.model_adds.size() + s.model_removes.size() + s.transformation_adds.size() +
+                      s.transformation_removes.size() + s.adopts.size();
+        }
+        return result;
+    }
+
+    /**
+     * \brief Discard the recorded commands
+     */
+    void CommandBuffer::clear() {
+        for (Shard &s : shards) {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            s.model_adds.clear();
+            s.model_removes.clear();
+            s.transformation_adds.clear();
+            s.transformation_removes.clear();
+            s.adopts.clear();
+        }
+    }
+
+    /**
+     * \brief Apply the recorded commands and discard them
+     *
+     * Has to be called at a sync point, i.e. while no thread is iterating the tables.
+     * Commands recorded during the flush are kept for the next one.
+     *
+     * \throws std::logic_error When the structure of either table is locked
+     */
+    void CommandBuffer::flush() {
+        // Take the commands out of all the shards
+        std::vector<ModelAdd> model_adds;
+        std::vector<Remove> model_removes;
+        std::vector<TransformationAdd> transformation_adds;
+        std::vector<Remove> transformation_removes;
+        std::vector<Adopt> adopts;
+        for (Shard &s : shards) {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            take(model_adds, s.model_adds);
+            take(model_removes, s.model_removes);
+            take(transformation_adds, s.transformation_adds);
+            take(transformation_removes, s.transformation_removes);
+            take(adopts, s.adopts);
+        }
+        TransformationTable::table_t &transformation_table = *transformations->table;
+        sort_unique(transformation_removes);
+        sort_unique(model_removes);
+        sort_unique(transformation_adds);
+        sort_unique(model_adds);
+
+        // Drop additions undone by removals recorded after them (of the entity itself, or of an ancestor's subtree)
+        // Note: removals are applied either way, so that additions recorded after them replace the existing components
+        // Note: the ancestors are walked through the unfiltered additions, so all are marked before any is dropped
+        std::vector<bool> undone;
+        undone.reserve(transformation_adds.size());
+        for (const TransformationAdd &a : transformation_adds) {
+            undone.push_back(removed_after(transformation_removes, a.entity, a.seq) ||
+                             (a.has_parent && ancestor_removed_after(transformation_removes, transformation_adds,
+                                                                    transformation_table, a.parent, a.seq)));
+        }
+        size_t kept = 0;
+        for (size_t i = 0; i < transformation_adds.size(); i++) {
+            if (!undone[i]) {
+                transformation_adds[kept++] = transformation_adds[i];
+            }
+        }
+        transformation_adds.resize(kept);
+        model_adds.erase(std::remove_if(model_adds.begin(), model_adds.end(), [&](const ModelAdd &a) {
+            return removed_after(model_removes, a.entity, a.seq);
+        }), model_adds.end());
+
+        // Remove transformations (with their subtrees), then models
+        std::vector<Entity> keys = entities_of(transformation_removes);
+        transformations->remove(keys.data(), keys.size());
+
+        keys = entities_of(model_removes);
+        models->remove(keys.data(), keys.size());
+
+        // Add transformations, skipping entities that already have one
+        std::vector<TransformationAdd> pending;
+        for (const TransformationAdd &a : transformation_adds) {
+            if (!transformation_table.lookup(a.entity).is_set()) {
+                pending.push_back(a);
+            }
+        }
+        while (!pending.empty()) {
+            // Split off a round of additions whose parents are present, stopping when there are none
+            auto ready_end = std::stable_partition(pending.begin(), pending.end(), [&](const TransformationAdd &a) {
+                return !a.has_parent || transformation_table.lookup(a.parent).is_set();
+            });
+            if (ready_end == pending.begin()) {
+                break;
+            }
+            std::vector<TransformationAdd> round(pending.begin(), ready_end);
+            pending.erase(pending.begin(), ready_end);
+
+            // Group the round by parent (roots first), and add each group in a batch
+            std::stable_sort(round.begin(), round.end(), [](const TransformationAdd &a, const TransformationAdd &b) {
+                if (a.has_parent != b.has_parent) {
+                    return !a.has_parent;
+                }
+                return a.has_parent && a.parent.id < b.parent.id;
+            });
+            std::vector<glm::vec3> positions;
+            std::vector<glm::quat> orientations;
+            std::vector<glm::vec3> scales;
+            for (size_t start = 0; start < round.size();) {
+                size_t end = start + 1;
+                while (end < round.size() && round[end].has_parent == round[start].has_parent &&
+                       (!round[start].has_parent || round[end].parent == round[start].parent)) {
+                    end++;
+                }
+
+                keys.clear();
+                positions.clear();
+                orientations.clear();
+                scales.clear();
+                for (size_t i = start; i < end; i++) {
+                    keys.push_back(round[i].entity);
+                    positions.push_back(round[i].position);
+                    orientations.push_back(round[i].orientation);
+                    scales.push_back(round[i].scale);
+                }
+                data::opt_index parent = round[start].has_parent ?
+                                         transformation_table.lookup(round[start].parent) : data::opt_index();
+                transformations->add(keys.data(), positions.data(), orientations.data(), scales.data(), parent, end - start);
+
+                start = end;
+            }
+        }
+
+        // Keep additions whose parents are not present for one more flush, unless they were already kept once and their
+        //  parents are not waiting for the next flush either
+        std::vector<Entity> waiting;
+        for (const TransformationAdd &a : pending) {
+            if (!a.retried) {
+                waiting.push_back(a.entity);
+            }
+        }
+        std::sort(waiting.begin(), waiting.end(), entity_before);
+        auto retry_end = std::stable_partition(pending.begin(), pending.end(), [&](const TransformationAdd &a) {
+            return !a.retried || std::binary_search(waiting.begin(), waiting.end(), a.parent, entity_before);
+        });
+        if (retry_end != pending.end()) {
+            log::log(lg, log::warning, std::to_string(pending.end() - retry_end) +
+                                       " transformation additions dropped, as their parents are still not present");
+            pending.erase(retry_end, pending.end());
+        }
+        if (!pending.empty()) {
+            log::log(lg, log::warning, std::to_string(pending.size()) +
+                                       " transformation additions kept for the next flush, as their parents are not present");
+            for (TransformationAdd &a : pending) {
+                a.retried = true;
+            }
+            Shard &s = shard();
+            std::lock_guard<std::mutex> lock(s.mutex);
+            take(s.transformation_adds, pending);
+        }
+
+        // Add models in a single batch, skipping entities that already have one
+        keys.clear();
+        std::vector<size_t> model_indices;
+        for (const ModelAdd &a : model_adds) {
+            if (!models->table->lookup(a.entity).is_set()) {
+                keys.push_back(a.entity);
+                model_indices.push_back(a.model);
+            }
+        }
+        if (!keys.empty()) {
+            models->add(keys.data(), model_indices.data(), keys.size());
+        }
+
+        // Adopt, skipping entities without a transformation and parents that are not present
+        sort_unique(adopts);
+        for (const Adopt &a : adopts) {
+            if (!transformation_table.lookup(a.entity).is_set()) {
+                continue;
+            }
+            data::opt_index parent;
+            if (a.has_parent) {
+                parent = transformation_table.lookup(a.parent);
+                if (!parent.is_set()) {
+                    continue;
+                }
+            }
+            transformations->adopt(a.entity, parent);
+        }
+    }
+    //--- end CommandBuffer implementation
+}
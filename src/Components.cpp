@@ -6,6 +6,7 @@
 
 #include <open-sea/Components.h>
 #include <open-sea/Debug.h>
+#include <open-sea/Profiler.h>
 #include <open-sea/Model.h>
 #include <open-sea/GL.h>
 
@@ -14,23 +15,257 @@
 #include <glm/glm.hpp>
 
 #include <stdexcept>
-#include <random>
 #include <algorithm>
+#include <limits>
+#include <type_traits>
 
 namespace open_sea::ecs {
-    //! Number of live entities that need to be seen in row before garbage collection gives up
-    constexpr size_t live_in_row = 4;
+    //! Batch removals of at least this fraction (as its inverse) of a component table's records compact the table
+    // Note: smaller batches move the last record into each removed one instead, which takes time proportional to the
+    //  batch rather than the table
+    constexpr size_t compact_divisor = 16;
+
+    /**
+     * \brief Show ImGui debug information about a component table
+     *
+     * \tparam R Record type
+     * \param table Table to show
+     */
+    template<typename R>
+    void show_table(data::Table<Entity, R> &table) {
+        ImGui::Text("Table type: %s", table.type_name());
+        ImGui::Text("Record size: %lu bytes", sizeof(R));
+        ImGui::Text("Records: %lu (%lu bytes)", table.size(), sizeof(R) * table.size());
+        ImGui::Text("Allocated: %lu (%lu bytes)", table.allocated(), sizeof(R) * table.allocated());
+        ImGui::Text("Pages allocated: %lu", table.pages());
+        if (ImGui::Button("Shrink to fit")) {
+            table.shrink_to_fit();
+        }
+
+        // Operation counts (only counted when enabled)
+        if constexpr (table_stats) {
+            const data::TableStats stats = table.stats();
+            for (size_t c = 0; c < data::TableStats::counter_count; c++) {
+                ImGui::Text("%s: %lu", data::TableStats::names[c], static_cast<unsigned long>(stats.counts[c]));
+            }
+        }
+    }
+
+    /**
+     * \brief Switch the table's layout if its sampled accesses favour the other one
+     *
+     * Does nothing unless the table's layout is adaptive (see \ref data::TableAdaptive::adapt).
+     *
+     * \tparam T Table type
+     * \param table Table
+     */
+    template<typename T>
+    void adapt_layout(T &table) {
+        if constexpr (std::is_same_v<component_layout, data::AdaptiveLayout>) {
+            table.adapt();
+        }
+    }
+
+    /**
+     * \brief Check records of a component manager for dead entities, removing their records
+     *
+     * Checks the records before the cursor, from the last one towards the start, and starts over from the end of the
+     *  table once the start is reached.
+     * Removal only moves records towards the start of the table (compaction), from its end (moving the last record into
+     *  a removed one) or towards the end of the group, so the records not yet checked in a pass are never moved past
+     *  the cursor, and every record present for the whole pass is checked in it.
+     * Records moved by other operations (pulling entities into the group, sorting or permuting) may be skipped until
+     *  the next pass.
+     * The keys are read in place, so nothing is allocated as long as the manager's removal doesn't.
+     *
+     * \tparam C Component manager type
+     * \param components Component manager
+     * \param manager Entity manager to check entities against
+     * \param cursor Number of records before the next one to check
+     * \param budget Number of records to check
+     * \return Cursor for the next call
+     */
+    template<typename C>
+    size_t sweep(C &components, const EntityManager &manager, size_t cursor, size_t budget) {
+        for (size_t checked = 0; checked < budget && components.table->size() > 0; checked++) {
+            // Start over from the end at the start of the table, and stay within it as records are removed
+            const size_t n = components.table->size();
+            if (cursor == 0 || cursor > n) {
+                cursor = n;
+            }
+
+            // Remove the record if dead (the record moved into its place is checked next)
+            const Entity e = components.table->keys()[cursor - 1];
+            if (manager.alive(e)) {
+                cursor--;
+            } else {
+                components.remove(&e, 1);
+            }
+        }
+        return cursor;
+    }
+
+    /**
+     * \brief Show ImGui debug information about a component table's layout decisions
+     *
+     * Does nothing unless the table's layout is adaptive.
+     *
+     * \tparam T Table type
+     * \param table Table
+     */
+    template<typename T>
+    void show_layout(T &table) {
+        if constexpr (std::is_same_v<component_layout, data::AdaptiveLayout>) {
+            ImGui::Text("Sampled random accesses: %lu", static_cast<unsigned long>(table.sampled_random_accesses()));
+            ImGui::Text("Sampled scanned records: %lu", static_cast<unsigned long>(table.sampled_scanned_records()));
+
+            const auto &d = table.last_decision();
+            if (!d.made) {
+                ImGui::TextUnformatted("Layout decision: none yet");
+                return;
+            }
+            const char *from = (d.from == data::RecordLayout::aos) ? "AoS" : "SoA";
+            const char *to = (d.to == data::RecordLayout::aos) ? "AoS" : "SoA";
+            if (d.from == d.to) {
+                ImGui::Text("Layout decision: kept %s", from);
+            } else {
+                ImGui::Text("Layout decision: switched %s to %s", from, to);
+                ImGui::Text("Switch cost: %.3f ms (%lu bytes copied)", d.milliseconds, static_cast<unsigned long>(d.bytes_copied));
+            }
+            ImGui::Text("Estimated cache lines: AoS %.0f, SoA %.0f", d.aos_lines, d.soa_lines);
+            ImGui::Text("From %lu random accesses, %lu scanned records", static_cast<unsigned long>(d.random), static_cast<unsigned long>(d.scanned));
+        }
+    }
+
+    /**
+     * \brief Record counts of a component table's operations since they were last recorded with the profiler
+     *
+     * Does nothing unless table operations are counted (see \ref table_stats).
+     *
+     * \tparam R Record type
+     * \param label Label of the table
+     * \param table Table
+     * \param counted Counts when last recorded (updated to the current counts)
+     */
+    template<typename R>
+    void count_table(const std::string &label, data::Table<Entity, R> &table, data::TableStats &counted) {
+        if constexpr (table_stats) {
+            const data::TableStats current = table.stats();
+            const data::TableStats frame = current - counted;
+            for (size_t c = 0; c < data::TableStats::counter_count; c++) {
+                profiler::count(label + " - " + data::TableStats::names[c], frame.counts[c]);
+            }
+            counted = current;
+        }
+    }
 
     //--- Start ModelTable implementation
     /**
      * \brief Construct a model component manager
      *
      * Construct a model component manager and pre-allocate space for the given number of components.
+     * Sparse key density suits components expected on a small fraction of entities, as the memory and lookup cost of
+     *  the key map then follows the number of components rather than the range of entity indices.
      *
      * \param size Number of components
+     * \param density Density of the entities with the component (see \ref data::KeyDensity)
+     */
+    ModelTable::ModelTable(unsigned size, data::KeyDensity density) {
+        this->table = std::make_unique<table_t>(size, component_key_map(density));
+    }
+
+    /**
+     * \brief Add the component to the entity
+     *
+     * \param key Entity
+     * \param model Index of the model (see \ref model_to_index)
+     * \return `true` iff the structure was modified
      */
-    ModelTable::ModelTable(unsigned size) {
-        this->table = std::make_unique<data::TableSoA<Entity, Data>>(size);
+    bool ModelTable::add(const Entity &key, size_t model) {
+        return add(&key, &model, 1);
+    }
+
+    /**
+     * \brief Add the component to the entities
+     *
+     * Entities that already have the component are skipped.
+     * When grouped, the group is kept up to date.
+     *
+     * \param keys Entities
+     * \param models Indices of the models (see \ref model_to_index)
+     * \param count Number of entities
+     * \return `true` iff the structure was modified
+     */
+    bool ModelTable::add(const Entity *keys, const size_t *models, size_t count) {
+        // Keep only entities without a record, as the table adds a batch only if none of its keys are present
+        added_keys.clear();
+        added_records.clear();
+        evicted.clear();
+        for (size_t i = 0; i < count; i++) {
+            if (table->lookup(keys[i]).is_set()) {
+                continue;
+            }
+            added_keys.push_back(keys[i]);
+            added_records.push_back(Data{models[i]});
+
+            // Note any record the entity would evict, so that it can be removed without disturbing the group
+            data::opt_index conflict = table->conflict(keys[i]);
+            if (conflict.is_set()) {
+                evicted.push_back(table->lookup(conflict));
+            }
+        }
+        if (!evicted.empty()) {
+            remove(evicted.data(), evicted.size());
+        }
+        if (added_keys.empty()) {
+            return false;
+        }
+
+        // Add the records
+        bool result = table->add(added_keys.data(), added_records.data(), added_keys.size());
+
+        // Pull the entities into the group (only those that now have both components are moved)
+        if (group) {
+            for (const Entity &key : added_keys) {
+                group->added(key);
+            }
+        }
+
+        return result;
+    }
+
+    /**
+     * \brief Remove the entities' components
+     *
+     * Small batches move the last record into each removed one, while batches of a large fraction of the records are
+     *  removed in a single pass over the table (keeping the order of the remaining records).
+     * When grouped, the entities are moved out of the group first.
+     * Entities without a record are ignored.
+     *
+     * \param keys Entities
+     * \param count Number of entities
+     * \return Number of removed records
+     */
+    size_t ModelTable::remove(const Entity *keys, size_t count) {
+        // Small batch -> remove records one by one
+        if (count * compact_divisor < table->size()) {
+            size_t removed = 0;
+            for (size_t i = 0; i < count; i++) {
+                if (group) {
+                    group->removing(keys[i]);
+                }
+                removed += table->remove(keys[i]).is_set();
+            }
+            return removed;
+        }
+
+        if (group) {
+            for (size_t i = 0; i < count; i++) {
+                group->removing(keys[i]);
+            }
+        }
+        data::mark_keys(*table, keys, count, marked);
+        return table->remove_marked(marked);
     }
 
     /**
@@ -85,6 +320,7 @@ namespace open_sea::ecs {
      *
      * Remove the model at the provided index from the store.
      * If the model is used by any entities, the relevant records are removed.
+     * Records using models after it in the store are updated to the models' new indices.
      *
      * \param i Index
      * \return \c true if the any records were removed
@@ -99,60 +335,75 @@ namespace open_sea::ecs {
             return false;
         }
 
-        // Iterate through the table, removing records with that model
-        Data::Ptr ref = table->get_reference();
+        // Scan the model indices, collecting entities with that model and shifting indices of later models
+        std::vector<Entity> matches;
+        std::vector<Entity> shifted;
+        const std::vector<Entity> &keys = table->keys();
         size_t n = 0;
-        bool result = false;
-        while (n < table->size()) {
-            if (*ref.model == i) {
-                // Matches -> remove
-                table->remove(data::opt_index(n));
-                result = true;
+        table->view<0>().for_each([&](size_t &model) {
+            if (model == i) {
+                matches.push_back(keys[n]);
+            } else if (model > i) {
+                model--;
+                shifted.push_back(keys[n]);
+            }
+            n++;
+        });
+        // Record the changed model indices
+        for (const Entity &e : shifted) {
+            table->touch(e, data::column(0));
+        }
 
-                // No incrementing, because current got swapped with last and size decremented by removal
-            } else {
-                // Otherwise -> go to next
-                table->increment_reference(ref);
-                n++;
+        // Move the matching entities out of the group, then remove their records at once
+        if (group) {
+            for (const Entity &e : matches) {
+                group->removing(e);
             }
         }
+        table->remove(matches.data(), matches.size());
 
-        return result;
+        return !matches.empty();
     }
 
     /**
      * \brief Collect garbage
      *
      * Destroy records for dead entities.
-     * This is done by checking random records until a certain number of live entities in a row are found.
-     * Therefore with few dead entities not much time is wasted iterating through the array, and with many dead entities
-     * they are destroyed within couple calls.
+     * The records of entities destroyed since the last collection are read from the manager (see
+     *  \ref EntityManager::destroyed_since) and removed in a single batch, so the cost follows the number of deaths.
+     * Then a few more records are checked, continuing from where the previous collection stopped and covering the whole
+     *  table over several collections, so that records of deaths the manager has already dropped (i.e. when too many
+     *  entities died since the last collection) are eventually removed as well.
+     * Buffers used for removal are kept between collections, so collections don't allocate once they have grown.
+     * Once the table is sparse enough, its space is trimmed (see \ref data::Table::trim).
      *
-     * \param manager Entity manager to check entities against
+     * \param manager Entity manager to check entities against (the same one on every call)
+     * \param budget Number of records to check
      */
-    void ModelTable::gc(const EntityManager &manager) {
-        unsigned seen_live_in_row = 0;
-        static std::random_device device;
-        static std::mt19937_64 generator(table->size());
-
-        std::vector<Entity> entities = table->keys();
-        std::uniform_int_distribution<int> distribution(0, entities.size());
-
-        // Keep trying while there are entities and haven't seen too many living
-        while (!entities.empty() && seen_live_in_row < live_in_row) {
-            // Note: modulo required because number of entities can change and this keeps indices in valid range
-            size_t i = distribution(generator) % entities.size();
-
-            if (manager.alive(entities[i])) {
-                // Increment live counter
-                seen_live_in_row++;
-            } else {
-                // Reset live counter and remove record from table and entity list
-                seen_live_in_row = 0;
-                table->remove(entities[i]);
-                entities.erase(entities.begin() + i);
-            }
+    void ModelTable::gc(const EntityManager &manager, size_t budget) {
+        // Remove records of the entities destroyed since the last collection
+        dead.clear();
+        manager.destroyed_since(destroyed_cursor, dead);
+        if (!dead.empty()) {
+            remove(dead.data(), dead.size());
         }
+
+        // Check the next few records for deaths missed by the stream
+        sweep_cursor = sweep(*this, manager, sweep_cursor, budget);
+
+        // Return memory once most of the records are gone, and switch layout if accesses favour the other one
+        table->trim();
+        adapt_layout(*table);
+    }
+
+    /**
+     * \brief Record counts of the table's operations during the frame with the profiler
+     *
+     * Does nothing unless table operations are counted (see \ref table_stats).
+     */
+    void ModelTable::count_stats() {
+        data::TableAdaptor<table_t> adaptor(*table);
+        count_table("Model table", adaptor, counted_stats);
     }
 
     /**
@@ -164,11 +415,9 @@ namespace open_sea::ecs {
      * \brief Show ImGui debug information
      */
     void ModelTable::show_debug() {
-        ImGui::Text("Table type: %s", table->type_name());
-        ImGui::Text("Record size: %lu bytes", sizeof(Data));
-        ImGui::Text("Records: %lu (%lu bytes)", table->size(), sizeof(Data) * table->size());
-        ImGui::Text("Allocated: %lu (%lu bytes)", table->allocated(), sizeof(Data) * table->allocated());
-        ImGui::Text("Pages allocated: %lu", table->pages());
+        data::TableAdaptor<table_t> adaptor(*table);
+        show_table(adaptor);
+        show_layout(*table);
         ImGui::Text("Stored models: %i", static_cast<int>(models.size()));
         if (ImGui::Button("Query")) {
             ImGui::OpenPopup("Component Manager Query");
@@ -234,46 +483,55 @@ namespace open_sea::ecs {
      * \brief Construct a transformation component manager
      *
      * Construct a transformation component manager and pre-allocate space for the given number of components.
+     * Sparse key density suits components expected on a small fraction of entities, as the memory and lookup cost of
+     *  the key map then follows the number of components rather than the range of entity indices.
      *
      * \param size Number of components
+     * \param density Density of the entities with the component (see \ref data::KeyDensity)
      */
-    TransformationTable::TransformationTable(unsigned size) {
-        this->table = std::make_unique<data::TableSoA<Entity, Data>>(size);
+    TransformationTable::TransformationTable(unsigned size, data::KeyDensity density) {
+        this->table = std::make_unique<table_t>(size, component_key_map(density));
     }
 
     /**
      * \brief Collect garbage
      *
      * Destroy records for dead entities.
-     * This is done by checking random records until a certain number of live entities in a row are found.
-     * Therefore with few dead entities not much time is wasted iterating through the array, and with many dead entities
-     * they are destroyed within couple calls.
+     * The records of entities destroyed since the last collection are read from the manager (see
+     *  \ref EntityManager::destroyed_since) and removed in a single batch, so the cost follows the number of deaths.
+     * Then a few more records are checked, continuing from where the previous collection stopped and covering the whole
+     *  table over several collections, so that records of deaths the manager has already dropped (i.e. when too many
+     *  entities died since the last collection) are eventually removed as well.
+     * Buffers used for removal are kept between collections, so collections don't allocate once they have grown.
+     * Once the table is sparse enough, its space is trimmed (see \ref data::Table::trim).
      *
-     * \param manager Entity manager to check entities against
+     * \param manager Entity manager to check entities against (the same one on every call)
+     * \param budget Number of records to check
      */
-    void TransformationTable::gc(const EntityManager &manager) {
-        unsigned seen_live_in_row = 0;
-        static std::random_device device;
-        static std::mt19937_64 generator(table->size());
-
-        std::vector<Entity> entities = table->keys();
-        std::uniform_int_distribution<int> distribution(0, entities.size());
-
-        // Keep trying while there are entities and haven't seen too many living
-        while (!entities.empty() && seen_live_in_row < live_in_row) {
-            // Note: modulo required because number of entities can change and this keeps indices in valid range
-            size_t i = distribution(generator) % entities.size();
-
-            if (manager.alive(entities[i])) {
-                // Increment live counter
-                seen_live_in_row++;
-            } else {
-                // Reset live counter and remove record from table and entity list
-                seen_live_in_row = 0;
-                remove(entities[i]);
-                entities.erase(entities.begin() + i);
-            }
+    void TransformationTable::gc(const EntityManager &manager, size_t budget) {
+        // Remove records of the entities destroyed since the last collection
+        dead.clear();
+        manager.destroyed_since(destroyed_cursor, dead);
+        if (!dead.empty()) {
+            remove(dead.data(), dead.size());
         }
+
+        // Check the next few records for deaths missed by the stream
+        sweep_cursor = sweep(*this, manager, sweep_cursor, budget);
+
+        // Return memory once most of the records are gone, and switch layout if accesses favour the other one
+        table->trim();
+        adapt_layout(*table);
+    }
+
+    /**
+     * \brief Record counts of the table's operations during the frame with the profiler
+     *
+     * Does nothing unless table operations are counted (see \ref table_stats).
+     */
+    void TransformationTable::count_stats() {
+        data::TableAdaptor<table_t> adaptor(*table);
+        count_table("Transformation table", adaptor, counted_stats);
     }
 
     /**
@@ -288,16 +546,25 @@ namespace open_sea::ecs {
      * \param parent Parent (-1 if root)
      * \return `true` iff the structure was modified
      */
-    bool TransformationTable::add(const Entity &key,  const glm::vec3 &position, const glm::quat &orientation, const glm::vec3 &scale, const data::opt_index parent) {
+    bool TransformationTable::add(const Entity &key,  const glm::vec3 &position, const glm::quat &orientation, const glm::vec3 &scale, data::opt_index parent) {
+        // Check the parent exists
+        if (parent.is_set() && parent.get() >= table->size()) {
+            // Not found -> Invalid parent provided
+            throw std::invalid_argument("Adding record to parent that can't be found.");
+        }
+
+        // Remove any record the key would evict, finding the parent again in case it was moved
+        const bool has_parent = parent.is_set();
+        parent = evict_conflicts(&key, 1, parent);
+        if (has_parent && !parent.is_set()) {
+            // Removed with the evicted subtree -> Invalid parent provided
+            throw std::invalid_argument("Adding record to parent that can't be found.");
+        }
+
         // Get parent reference
         Data::Ptr par_ref{};
         if (parent.is_set()) {
-            try {
-                par_ref = table->get_reference(parent);
-            } catch (std::out_of_range &e) {
-                // Not found -> Invalid parent provided
-                throw std::invalid_argument("Adding record to parent that can't be found.");
-            }
+            par_ref = table->get_reference(parent);
         }
 
         // Construct data
@@ -321,7 +588,10 @@ namespace open_sea::ecs {
         }
 
         // Link with sibling and parent
+        // Note: reference obtained again, as adding the record may have reallocated the table
         if (parent.is_set()) {
+            par_ref = table->get_reference(parent);
+
             // Set as previous first child's sibling
             auto sibling = *par_ref.first_child;
             if (sibling.is_set()) {
@@ -347,6 +617,11 @@ namespace open_sea::ecs {
             update_matrix(parent);
         }
 
+        // Pull the entity into the group (only moved if it has both components)
+        if (group) {
+            group->added(key);
+        }
+
         return idx.is_set();
     }
 
@@ -365,16 +640,25 @@ namespace open_sea::ecs {
      */
     // Note: This can't be done in SOA style, because each inserted record needs to know where the previous was inserted
     //          (for prev_sibling, and to set its next_sibling).
-    bool TransformationTable::add(const Entity *keys, const glm::vec3 *position, const glm::quat *orientation, const glm::vec3 *scale, const data::opt_index parent, size_t count) {
+    bool TransformationTable::add(const Entity *keys, const glm::vec3 *position, const glm::quat *orientation, const glm::vec3 *scale, data::opt_index parent, size_t count) {
+        // Check the parent exists
+        if (parent.is_set() && parent.get() >= table->size()) {
+            // Not found -> Invalid parent provided
+            throw std::invalid_argument("Adding records to parent that can't be found.");
+        }
+
+        // Remove any records the keys would evict, finding the parent again in case it was moved
+        const bool has_parent = parent.is_set();
+        parent = evict_conflicts(keys, count, parent);
+        if (has_parent && !parent.is_set()) {
+            // Removed with an evicted subtree -> Invalid parent provided
+            throw std::invalid_argument("Adding records to parent that can't be found.");
+        }
+
         // Get parent reference
         Data::Ptr par_ref{};
         if (parent.is_set()) {
-            try {
-                par_ref = table->get_reference(parent);
-            } catch (std::out_of_range &e) {
-                // Not found -> Invalid parent provided
-                throw std::invalid_argument("Adding records to parent that can't be found.");
-            }
+            par_ref = table->get_reference(parent);
         }
 
         // Perform for each record in sequence
@@ -385,6 +669,11 @@ namespace open_sea::ecs {
         const glm::vec3 *s = scale;
         data::opt_index last_added = parent.is_set() ? *par_ref.first_child : data::opt_index();
         for (size_t i = 0; i < count; i++, k++, p++, o++, s++) {
+            // Skip keys that would evict a record added earlier in the batch (same index, different generation)
+            if (table->conflict(*k).is_set()) {
+                continue;
+            }
+
             // Construct data
             Data data = {
                     *p,
@@ -425,7 +714,9 @@ namespace open_sea::ecs {
         }
 
         // Set parent's first child to the last added record
+        // Note: reference obtained again, as adding the records may have reallocated the table
         if (parent.is_set()) {
+            par_ref = table->get_reference(parent);
             par_ref.first_child->set(last_added);
         }
 
@@ -434,6 +725,13 @@ namespace open_sea::ecs {
             update_matrix(parent);
         }
 
+        // Pull the entities into the group (only those that have both components are moved)
+        if (group) {
+            for (size_t i = 0; i < count; i++) {
+                group->added(keys[i]);
+            }
+        }
+
         return result;
     }
 
@@ -535,6 +833,8 @@ namespace open_sea::ecs {
     /**
      * \brief Update world transformation matrix of a record at the provided index
      *
+     * Also updates the matrices of all descendants, recording the change of each in the table.
+     *
      * \param idx Record index
      * \param siblings Whether to also update following siblings
      */
@@ -574,6 +874,7 @@ namespace open_sea::ecs {
 
         // Update own matrix
         *data.matrix = parent * transformation(*data.position, *data.orientation, *data.scale);
+        table->touch(idx, data::column(3));
 
         // Update the children
         if (data.first_child->is_set()) {
@@ -601,48 +902,94 @@ namespace open_sea::ecs {
     /**
      * \brief Remove record at the provided index and its children
      *
+     * Takes time proportional to the size of the subtree, as the last records are moved into the removed ones (so the
+     *  order of the remaining records is not kept).
+     *
      * \param idx Record index
      * \return `true` iff the structure was modified
      */
     bool TransformationTable::remove(data::opt_index idx) {
-        // Check the index is set
-        if (!idx.is_set()) {
+        // Check the index is set and in range
+        if (!idx.is_set() || idx.get() >= table->size()) {
             // Nothing to remove
             return false;
         }
 
-        // Get the data
-        Data::Ptr data{};
-        try {
-            data = table->get_reference(idx);
-        } catch (std::out_of_range &e) {
-            return false;
+        // Detach the subtree and remove its records one by one, moving the last record into each
+        subtree.clear();
+        take_subtree(idx.get(), subtree);
+        for (const Entity &e : subtree) {
+            erase(e);
         }
+        return true;
+    }
 
-        // Recursively destroy children
-        while (data.first_child->is_set()) {
-            // Remove first child
-            auto first_child = *data.first_child;
-            bool removed = remove(first_child);
+    /**
+     * \brief Remove entity's record and those of its children
+     *
+     * \param key Entity
+     * \return `true` iff the structure was modified
+     */
+    bool TransformationTable::remove(const Entity &key) {
+        // Look up record and pass to index-based overload
+        return remove(table->lookup(key));
+    }
 
-            // Adjust index and data if we got moved by this removal
-            if (removed && idx.get() == table->size()) {
-                // Removal happened and index is now outside the table -> got moved to first_child
-                idx = first_child;
-                try {
-                    data = table->get_reference(idx);
-                } catch (std::out_of_range &e) {
-                    // Previously valid first child index is now outside -> it was last but by above so were we
-                    //  -> somehow we were our first child -> fatal error
-                    throw std::exception();
+    /**
+     * \brief Remove entities' records and those of their children
+     *
+     * Small batches move the last record into each removed one, updating only the links to the moved records (see
+     *  \ref remove(data::opt_index)).
+     * Batches of a large fraction of the records are removed in a single pass over the table (keeping the order of the
+     *  remaining records), followed by a single pass updating the tree links.
+     * Entities without a record are ignored.
+     *
+     * \param keys Entities
+     * \param count Number of entities
+     * \return Number of removed records
+     */
+    size_t TransformationTable::remove(const Entity *keys, size_t count) {
+        // Small batch -> detach all the subtrees, then remove their records one by one
+        if (count * compact_divisor < table->size()) {
+            subtree.clear();
+            for (size_t i = 0; i < count; i++) {
+                data::opt_index idx = table->lookup(keys[i]);
+                if (idx.is_set()) {
+                    take_subtree(idx.get(), subtree);
                 }
-            } else if (!removed) {
-                // Child wasn't removed -> should never happen - break potential infinite loop and note the error
-                //TODO there probably is a better exception for this
-                throw std::invalid_argument("Record child couldn't be removed.");
             }
+
+            // Note: entities in several subtrees are listed more than once, but only removed the first time
+            size_t removed = 0;
+            for (const Entity &e : subtree) {
+                removed += erase(e);
+            }
+            return removed;
         }
 
+        // Detach and mark the subtree of each entity, unless it is already in one
+        marked.assign(table->size(), false);
+        for (size_t i = 0; i < count; i++) {
+            data::opt_index idx = table->lookup(keys[i]);
+            if (idx.is_set() && !marked[idx.get()]) {
+                unlink(idx.get());
+                mark_subtree(idx.get());
+            }
+        }
+
+        return remove_marked();
+    }
+
+    /**
+     * \brief Detach record from its parent and siblings
+     *
+     * The record's own links are left unchanged, so its children stay attached to it.
+     *
+     * \param idx Record index
+     */
+    void TransformationTable::unlink(size_t idx) {
+        Data::Ptr data = table->get_reference(data::opt_index(idx));
+
         // Remove references to this record
         if (data.parent->is_set()) {
             // Get the reference to parent
@@ -655,7 +1002,7 @@ namespace open_sea::ecs {
             }
 
             // Check we are removing the first child
-            if ((*ref.first_child) == idx) {
+            if ((*ref.first_child) == data::opt_index(idx)) {
                 // Replace with next sibling
                 ref.first_child->set(*data.next_sibling);
             }
@@ -686,22 +1033,333 @@ namespace open_sea::ecs {
             // Set previous sibling's next sibling to mine (or lack thereof)
             ref.next_sibling->set(*data.next_sibling);
         }
+    }
 
-        // Remove the record
-        return table->remove(idx).is_set();
+    /**
+     * \brief Detach record's subtree from the rest of the tree and append its entities to the list
+     *
+     * The tree links of all records in the subtree are cleared, so that they can then be removed in any order (see
+     *  \ref erase).
+     * Takes time proportional to the size of the subtree.
+     *
+     * \param idx Record index
+     * \param dest List to append the entities to
+     */
+    void TransformationTable::take_subtree(size_t idx, std::vector<Entity> &dest) {
+        unlink(idx);
+
+        // Walk the subtree breadth first, using the list itself as the queue of records whose children are to be visited
+        const size_t start = dest.size();
+        dest.push_back(table->lookup(data::opt_index(idx)));
+        for (size_t i = start; i < dest.size(); i++) {
+            Data::Ptr ref = table->get_reference(dest[i]);
+            data::opt_index child = *ref.first_child;
+            *ref.parent = *ref.first_child = *ref.next_sibling = *ref.prev_sibling = data::opt_index();
+
+            // Queue all children
+            while (child.is_set()) {
+                if (dest.size() - start > table->size()) {
+                    // More records than the table holds -> tree links are cyclic
+                    throw std::invalid_argument("Record is its own descendant.");
+                }
+                dest.push_back(table->lookup(child));
+                child = *table->get_reference(child).next_sibling;
+            }
+        }
     }
 
     /**
-     * \brief Remove entity's record and those of its children
+     * \brief Remove entity's record by moving the last record into its place
+     *
+     * The record must not be linked with any other (see \ref take_subtree), so that only the links to the moved record
+     *  need updating.
+     * When grouped, the entity is moved out of the group first.
      *
      * \param key Entity
-     * \return `true` iff the structure was modified
+     * \return `true` iff the record was removed
      */
-    bool TransformationTable::remove(const Entity &key) {
-        // Look up record and pass to index-based overload
-        return remove(table->lookup(key));
+    bool TransformationTable::erase(const Entity &key) {
+        if (group) {
+            group->removing(key);
+        }
+
+        data::opt_index idx = table->lookup(key);
+        if (!idx.is_set()) {
+            return false;
+        }
+        data::opt_index last(table->size() - 1);
+        swap(idx, last);
+        table->remove(last);
+        return true;
+    }
+
+    /**
+     * \brief Mark record and all its descendants in the flags of records being removed
+     *
+     * \param idx Record index
+     */
+    void TransformationTable::mark_subtree(size_t idx) {
+        // Walk the subtree depth first, keeping the records whose children are still to be visited
+        pending.clear();
+        pending.push_back(idx);
+        marked[idx] = true;
+        while (!pending.empty()) {
+            data::opt_index child = *table->get_reference(data::opt_index(pending.back())).first_child;
+            pending.pop_back();
+
+            // Mark all children
+            while (child.is_set()) {
+                if (marked[child.get()]) {
+                    // Already marked -> tree links are cyclic
+                    throw std::invalid_argument("Record is its own descendant.");
+                }
+                marked[child.get()] = true;
+                pending.push_back(child.get());
+                child = *table->get_reference(child).next_sibling;
+            }
+        }
+    }
+
+    /**
+     * \brief Remove marked records and update tree links of the remaining ones
+     *
+     * The records are marked in the flags of records being removed, and have to form whole subtrees detached from the
+     *  remaining records.
+     *
+     * \return Number of removed records
+     */
+    size_t TransformationTable::remove_marked() {
+        // Move the marked entities out of the group first, which moves their records, so mark them again afterwards
+        if (group) {
+            subtree.clear();
+            const std::vector<Entity> &keys = table->keys();
+            for (size_t i = 0; i < marked.size(); i++) {
+                if (marked[i]) {
+                    subtree.push_back(keys[i]);
+                }
+            }
+            if (subtree.empty()) {
+                return 0;
+            }
+
+            for (const Entity &e : subtree) {
+                group->removing(e);
+            }
+            data::mark_keys(*table, subtree.data(), subtree.size(), marked);
+        }
+
+        return remove_ungrouped();
+    }
+
+    /**
+     * \brief Remove marked records (none of which are grouped) and update tree links of the remaining ones
+     *
+     * The records are marked in the flags of records being removed.
+     *
+     * \return Number of removed records
+     */
+    size_t TransformationTable::remove_ungrouped() {
+        // Compute new index of each record (the table keeps the order of remaining records)
+        remap.resize(marked.size());
+        size_t next = 0;
+        for (size_t i = 0; i < marked.size(); i++) {
+            remap[i] = next;
+            next += !marked[i];
+        }
+
+        // Remove the records
+        size_t removed = table->remove_marked(marked);
+        if (removed == 0) {
+            return 0;
+        }
+
+        // Update all links at once
+        remap_links(remap);
+
+        return removed;
     }
 
+    /**
+     * \brief Update tree links of all records to new record indices
+     *
+     * \param new_index New index of each record, indexed by its previous index
+     */
+    void TransformationTable::remap_links(const std::vector<size_t> &new_index) {
+        auto update = [&new_index](data::opt_index &link) {
+            if (link.is_set()) {
+                link.set(new_index[link.get()]);
+            }
+        };
+        table->view<4, 5, 6, 7>().for_each([&update](data::opt_index &parent, data::opt_index &first_child,
+                                                     data::opt_index &next_sibling, data::opt_index &prev_sibling) {
+            update(parent);
+            update(first_child);
+            update(next_sibling);
+            update(prev_sibling);
+        });
+    }
+
+    /**
+     * \brief Sort records by their depth in the tree
+     *
+     * Roots come first, followed by their children, then grandchildren, and so on.
+     * Children of the same parent are kept next to each other.
+     * This way a parent's record is always before its children's, and matrix updates walk the table mostly forward.
+     * Reshuffles the data, and therefore invalidates any references to it.
+     */
+    void TransformationTable::sort_by_depth() {
+        const size_t n = table->size();
+
+        // Compute the depth of each record, walking up to the nearest record with known depth
+        constexpr size_t unknown = std::numeric_limits<size_t>::max();
+        std::vector<size_t> depth(n, unknown);
+        std::vector<size_t> path;
+        for (size_t i = 0; i < n; i++) {
+            // Walk up until a root or a record with known depth
+            size_t current = i;
+            while (depth[current] == unknown) {
+                path.push_back(current);
+                data::opt_index parent = *table->get_reference(data::opt_index(current)).parent;
+                if (!parent.is_set()) {
+                    break;
+                }
+                if (path.size() > n) {
+                    throw std::invalid_argument("Record is its own ancestor.");
+                }
+                current = parent.get();
+            }
+
+            // Assign depths down the walked path
+            size_t d = (depth[current] == unknown) ? 0 : depth[current] + 1;
+            for (auto p = path.rbegin(); p != path.rend(); p++) {
+                depth[*p] = d++;
+            }
+            path.clear();
+        }
+
+        // Get the parent of each record (roots keep their relative order, as the sort is stable)
+        std::vector<size_t> parent(n, 0);
+        size_t i = 0;
+        table->view<4>().for_each([&parent, &i](data::opt_index &p) {
+            parent[i++] = p.is_set() ? p.get() : 0;
+        });
+
+        // Sort by depth, then by parent to keep siblings together
+        std::vector<size_t> order(n);
+        for (i = 0; i < n; i++) {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), [&depth, &parent](size_t a, size_t b) {
+            return std::make_pair(depth[a], parent[a]) < std::make_pair(depth[b], parent[b]);
+        });
+
+        // Reorder the records, then move the grouped ones back to the front (keeping their order)
+        permute(order);
+        if (group) {
+            group->rebuild();
+        }
+    }
+
+    /**
+     * \brief Reorder the records, updating the tree links to new indices
+     *
+     * Does not maintain the group, which has to be rebuilt afterwards if grouped.
+     * Reshuffles the data, and therefore invalidates any references to it.
+     *
+     * \param order Permutation of the records (position `i` holds the previous index of the record to move to `i`)
+     *
+     * \throws std::invalid_argument When the order is not a permutation of the records
+     */
+    void TransformationTable::permute(const std::vector<size_t> &order) {
+        table->permute(order);
+        remap_links(data::invert_order(order));
+    }
+
+    /**
+     * \brief Swap two records, updating the tree links to new indices
+     *
+     * Does not maintain the group (it is used by the group to move records).
+     * Invalidates any references to the two records.
+     *
+     * \param a Index of the first record
+     * \param b Index of the second record
+     *
+     * \throws std::invalid_argument When either index is unset
+     * \throws std::out_of_range When either index is outside the table
+     */
+    void TransformationTable::swap(data::opt_index a, data::opt_index b) {
+        Data::Ptr ref_a = table->get_reference(a);
+        Data::Ptr ref_b = table->get_reference(b);
+        if (a == b) {
+            return;
+        }
+
+        // Collect the two records and all records linking to either of them (their parents, siblings and children)
+        affected.clear();
+        affected.push_back(a.get());
+        affected.push_back(b.get());
+        auto collect = [this](const Data::Ptr &ref) {
+            for (data::opt_index link : {*ref.parent, *ref.next_sibling, *ref.prev_sibling}) {
+                if (link.is_set()) {
+                    affected.push_back(link.get());
+                }
+            }
+            for (data::opt_index child = *ref.first_child; child.is_set(); child = *table->get_reference(child).next_sibling) {
+                affected.push_back(child.get());
+            }
+        };
+        collect(ref_a);
+        collect(ref_b);
+        std::sort(affected.begin(), affected.end());
+        affected.erase(std::unique(affected.begin(), affected.end()), affected.end());
+
+        // Exchange the two indices in their links
+        auto exchange = [&a, &b](data::opt_index &link) {
+            if (link == a) {
+                link = b;
+            } else if (link == b) {
+                link = a;
+            }
+        };
+        for (size_t i : affected) {
+            Data::Ptr ref = table->get_reference(data::opt_index(i));
+            exchange(*ref.parent);
+            exchange(*ref.first_child);
+            exchange(*ref.next_sibling);
+            exchange(*ref.prev_sibling);
+        }
+
+        // Swap the records themselves
+        table->swap(a, b);
+    }
+
+    /**
+     * \brief Remove the records that adding the keys would evict from the table, along with their subtrees
+     *
+     * Adding a key evicts the record of a dead entity sharing its index, which the table does without updating the tree
+     *  links or the group.
+     * Removing such records beforehand keeps both intact.
+     * Removing records can move the kept record, so its new index is returned.
+     *
+     * \param keys Keys about to be added
+     * \param count Number of keys
+     * \param keep Index of a record to keep track of (may be unset)
+     * \return New index of the kept record (unset if it was in an evicted subtree)
+     */
+    data::opt_index TransformationTable::evict_conflicts(const Entity *keys, size_t count, data::opt_index keep) {
+        const Entity keep_key = keep.is_set() ? table->lookup(keep) : Entity();
+        bool moved = false;
+        for (size_t i = 0; i < count; i++) {
+            data::opt_index stale = table->conflict(keys[i]);
+            if (stale.is_set()) {
+                remove(stale);
+                moved = true;
+            }
+        }
+        return (moved && keep.is_set()) ? table->lookup(keep_key) : keep;
+    }
+
+
     /**
      * \brief Translate entities
      *
@@ -726,6 +1384,7 @@ namespace open_sea::ecs {
 
             // Set the value
             *ref.position += *delta;
+            table->touch(*e, data::column(0));
 
             // Update matrix
             update_matrix(*e);
@@ -756,6 +1415,7 @@ namespace open_sea::ecs {
 
             // Set the value
             *ref.orientation = *delta * *ref.orientation;
+            table->touch(*e, data::column(1));
 
             // Update matrix
             update_matrix(*e);
@@ -787,6 +1447,7 @@ namespace open_sea::ecs {
 
             // Set the value
             *ref.scale *= *delta;
+            table->touch(*e, data::column(2));
 
             // Update matrix
             update_matrix(*e);
@@ -817,6 +1478,7 @@ namespace open_sea::ecs {
 
             // Set the value
             *ref.position = *position;
+            table->touch(*e, data::column(0));
 
             // Update matrix
             update_matrix(*e);
@@ -847,6 +1509,7 @@ namespace open_sea::ecs {
 
             // Set the value
             *ref.orientation = *orientation;
+            table->touch(*e, data::column(1));
 
             // Update matrix
             update_matrix(*e);
@@ -877,6 +1540,7 @@ namespace open_sea::ecs {
 
             // Set the value
             *ref.scale = *scale;
+            table->touch(*e, data::column(2));
 
             // Update matrix
             update_matrix(*e);
@@ -887,11 +1551,9 @@ namespace open_sea::ecs {
      * \brief Show ImGui debug information
      */
     void TransformationTable::show_debug() {
-        ImGui::Text("Table type: %s", table->type_name());
-        ImGui::Text("Record size: %lu bytes", sizeof(Data));
-        ImGui::Text("Records: %lu (%lu bytes)", table->size(), sizeof(Data) * table->size());
-        ImGui::Text("Allocated: %lu (%lu bytes)", table->allocated(), sizeof(Data) * table->allocated());
-        ImGui::Text("Pages allocated: %lu", table->pages());
+        data::TableAdaptor<table_t> adaptor(*table);
+        show_table(adaptor);
+        show_layout(*table);
         if (ImGui::Button("Query")) {
             ImGui::OpenPopup("Component Manager Query");
         }
@@ -1041,4 +1703,139 @@ namespace open_sea::ecs {
         }
     }
     //--- End TransformationTable implementation
+
+    //--- Start OwningGroup implementation
+    /**
+     * \brief Construct a group over the two component managers
+     *
+     * Registers the group with both managers and packs the records of entities that already have both components.
+     *
+     * \param model_mgr Model component manager
+     * \param transform_mgr Transformation component manager
+     *
+     * \throws std::invalid_argument When either manager is already grouped
+     */
+    OwningGroup::OwningGroup(std::shared_ptr<ModelTable> model_mgr, std::shared_ptr<TransformationTable> transform_mgr)
+            : model_mgr(std::move(model_mgr)), transform_mgr(std::move(transform_mgr)) {
+        if (this->model_mgr->group || this->transform_mgr->group) {
+            throw std::invalid_argument("Component manager is already grouped.");
+        }
+        this->model_mgr->group = this;
+        this->transform_mgr->group = this;
+        rebuild();
+    }
+
+    /**
+     * \brief Check whether the entity is grouped
+     *
+     * \param e Entity
+     * \return `true` iff the entity's records are in the group
+     */
+    bool OwningGroup::contains(const Entity &e) const {
+        data::opt_index idx = model_mgr->table->lookup(e);
+        return idx.is_set() && idx.get() < n;
+    }
+
+    /**
+     * \brief Pull the entity into the group if it has both components
+     *
+     * Swaps its records with the first records after the group in both tables.
+     *
+     * \param e Entity whose record was just added
+     */
+    void OwningGroup::added(const Entity &e) {
+        if (contains(e)) {
+            return;
+        }
+
+        // Check the entity has both components
+        data::opt_index model = model_mgr->table->lookup(e);
+        data::opt_index transform = transform_mgr->table->lookup(e);
+        if (!model.is_set() || !transform.is_set()) {
+            return;
+        }
+
+        // Swap both records to the end of the group and extend it
+        model_mgr->table->swap(model, data::opt_index(n));
+        transform_mgr->swap(transform, data::opt_index(n));
+        n++;
+    }
+
+    /**
+     * \brief Move the entity out of the group (if grouped)
+     *
+     * Swaps its records with the last grouped ones in both tables.
+     * Called before removing any of the entity's records, so that the removal doesn't disturb the group.
+     *
+     * \param e Entity whose record is about to be removed
+     */
+    void OwningGroup::removing(const Entity &e) {
+        if (!contains(e)) {
+            return;
+        }
+
+        // Swap both records with the last grouped ones and shrink the group
+        // Note: grouped records are at the same index in both tables
+        data::opt_index idx = model_mgr->table->lookup(e);
+        data::opt_index last(n - 1);
+        model_mgr->table->swap(idx, last);
+        transform_mgr->swap(idx, last);
+        n--;
+    }
+
+    /**
+     * \brief Pack the records of entities with both components at the front of both tables again
+     *
+     * Grouped records keep the order they have in the transformation table, so that e.g. sorting the transformations
+     *  carries over to the group.
+     * Reshuffles the data, and therefore invalidates any references to it.
+     */
+    void OwningGroup::rebuild() {
+        ModelTable::table_t &models = *model_mgr->table;
+        TransformationTable::table_t &transforms = *transform_mgr->table;
+
+        // Order the transformation records with a model first, keeping the relative order on both sides
+        const std::vector<Entity> &keys = transforms.keys();
+        std::vector<size_t> transform_order;
+        std::vector<size_t> model_order;
+        std::vector<size_t> rest;
+        std::vector<bool> taken(models.size(), false);
+        transform_order.reserve(keys.size());
+        model_order.reserve(models.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            data::opt_index model = models.lookup(keys[i]);
+            if (model.is_set()) {
+                transform_order.push_back(i);
+                model_order.push_back(model.get());
+                taken[model.get()] = true;
+            } else {
+                rest.push_back(i);
+            }
+        }
+        n = transform_order.size();
+        transform_order.insert(transform_order.end(), rest.begin(), rest.end());
+
+        // Order the model records to match, followed by the rest
+        for (size_t i = 0; i < taken.size(); i++) {
+            if (!taken[i]) {
+                model_order.push_back(i);
+            }
+        }
+
+        transform_mgr->permute(transform_order);
+        models.permute(model_order);
+    }
+
+    /**
+     * \brief Destroy the group, unregistering it from the managers
+     */
+    OwningGroup::~OwningGroup() {
+        if (model_mgr->group == this) {
+            model_mgr->group = nullptr;
+        }
+        if (transform_mgr->group == this) {
+            transform_mgr->group = nullptr;
+        }
+    }
+    //--- End OwningGroup implementation
 }
@@ -8,6 +8,7 @@
 #include <open-sea/ImGui.h>
 
 #include <stdexcept>
+#include <algorithm>
 
 namespace open_sea::ecs {
 
@@ -25,57 +26,351 @@ namespace open_sea::ecs {
     //--- end Entity implementation
     //--- start EntityManager implementation
     /**
-     * \brief Create a new entity
+     * \brief Raise the atomic value to at least the candidate
      *
-     * \return Created entity
-     * \throw std::runtime_error when there is no available index for new entity
+     * \tparam T Value type
+     * \param value Atomic value
+     * \param candidate Candidate value
      */
-    Entity EntityManager::create() {
-        unsigned index;
-
-        // Find appropriate index
-        if (freeIndices.size() > minimum_free_indices) {
-            // Reuse a freed index
-            index = freeIndices.front();
-            freeIndices.pop();
-        } else {
-            // Check there is at least one more available index
-            if (generation.size() < (1 << entity_index_bits)) {
-                // Index available -> use the next one
-                generation.push_back(0);
-                index = generation.size() - 1;
-            } else {
-                // Index not available -> attempt to reuse some
-                if (!freeIndices.empty()) {
-                    // Free index available -> reuse it
-                    index = freeIndices.front();
-                    freeIndices.pop();
-                } else {
-                    // No index available at all -> unable to create a new entity
-                    log::log(lg, log::error, "No available index for new entity");
-                    throw std::runtime_error("No available index for new entity");
+    template<typename T>
+    void raise_to(std::atomic<T> &value, T candidate) {
+        T current = value.load(std::memory_order_relaxed);
+        while (candidate > current && !value.compare_exchange_weak(current, candidate, std::memory_order_relaxed)) {}
+    }
+
+    /**
+     * \brief Get the page, allocating it (zero-initialised) if needed
+     *
+     * When several threads allocate the same page at once, one allocation wins and the others are discarded.
+     *
+     * \tparam T Entry type
+     * \param pages Pages
+     * \param i Index of the page
+     * \return Page
+     */
+    template<typename T>
+    T *EntityManager::page(std::array<std::atomic<T *>, page_count> &pages, size_t i) {
+        T *existing = pages[i].load(std::memory_order_acquire);
+        if (existing) {
+            return existing;
+        }
+
+        T *allocated = new T[page_entries]();
+        if (pages[i].compare_exchange_strong(existing, allocated, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            return allocated;
+        }
+        delete[] allocated;
+        return existing;
+    }
+
+    /**
+     * \brief Get the generation at the index
+     *
+     * \param index Index
+     * \return Generation, or `nullptr` if its page has not been allocated (i.e. no entity with the index was created)
+     */
+    std::atomic<uint16_t> *EntityManager::generation_at(unsigned index) const {
+        std::atomic<uint16_t> *p = generation[index / page_entries].load(std::memory_order_acquire);
+        return p ? p + index % page_entries : nullptr;
+    }
+
+    //! Maximum number of indices moved through the free index queue at once
+    constexpr unsigned free_run = 256;
+
+    /**
+     * \brief Get the slot of the free index queue at the position, allocating its page if needed
+     *
+     * \param pos Position in the queue
+     * \return Slot
+     */
+    EntityManager::FreeSlot &EntityManager::free_slot(uint64_t pos) {
+        return page(free_slots, (pos % max_indices) / page_entries)[pos % page_entries];
+    }
+
+    /**
+     * \brief Get the number of indices in the free index queue
+     *
+     * Approximate while other threads are modifying the queue.
+     *
+     * \return Number of free indices
+     */
+    size_t EntityManager::free_size() const {
+        const uint64_t head = free_head.load(std::memory_order_relaxed);
+        const uint64_t tail = free_tail.load(std::memory_order_relaxed);
+        return (tail > head) ? tail - head : 0;
+    }
+
+    /**
+     * \brief Add the indices to the back of the free index queue
+     *
+     * The queue is a bounded multi-producer multi-consumer ring of slots with sequence numbers.
+     * It has a slot for every index and holds each index at most once, so it never fills up.
+     * Runs of consecutive empty slots are claimed with a single compare-and-swap.
+     *
+     * \param indices Indices to free
+     * \param count Number of indices
+     */
+    void EntityManager::push_free(const unsigned *indices, unsigned count) {
+        uint64_t pos = free_tail.load(std::memory_order_relaxed);
+        while (count > 0) {
+            // Find the run of empty slots at the back
+            unsigned run = 0;
+            while (run < count &&
+                   free_slot(pos + run).sequence.load(std::memory_order_acquire) + (pos + run) % max_indices == pos + run) {
+                run++;
+            }
+            if (run == 0) {
+                // Slot claimed by another thread -> retry at the current back
+                pos = free_tail.load(std::memory_order_relaxed);
+                continue;
+            }
+
+            // Claim the run and fill it
+            if (free_tail.compare_exchange_weak(pos, pos + run, std::memory_order_relaxed)) {
+                for (unsigned i = 0; i < run; i++) {
+                    FreeSlot &slot = free_slot(pos + i);
+                    slot.index = indices[i];
+                    slot.sequence.store(pos + i + 1 - (pos + i) % max_indices, std::memory_order_release);
+                }
+                indices += run;
+                count -= run;
+                pos = free_tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * \brief Take indices from the front of the free index queue
+     *
+     * Runs of consecutive filled slots are claimed with a single compare-and-swap.
+     *
+     * \param dest Destination for the indices
+     * \param count Maximum number of indices to take
+     * \return Number of indices taken (0 iff the queue was empty)
+     */
+    unsigned EntityManager::pop_free(unsigned *dest, unsigned count) {
+        uint64_t pos = free_head.load(std::memory_order_relaxed);
+        while (true) {
+            const uint64_t tail = free_tail.load(std::memory_order_relaxed);
+            if (pos >= tail || count == 0) {
+                return 0;
+            }
+
+            // Find the run of filled slots at the front
+            const uint64_t limit = std::min<uint64_t>(count, tail - pos);
+            unsigned run = 0;
+            uint64_t sequence = 0;
+            while (run < limit) {
+                sequence = free_slot(pos + run).sequence.load(std::memory_order_acquire) + (pos + run) % max_indices;
+                if (sequence != pos + run + 1) {
+                    break;
+                }
+                run++;
+            }
+            if (run == 0) {
+                if (sequence < pos + 1) {
+                    // Slot not filled yet -> treat as empty
+                    return 0;
                 }
+                // Slot claimed by another thread -> retry at the current front
+                pos = free_head.load(std::memory_order_relaxed);
+                continue;
+            }
+
+            // Claim the run and empty it
+            if (free_head.compare_exchange_weak(pos, pos + run, std::memory_order_relaxed)) {
+                for (unsigned i = 0; i < run; i++) {
+                    FreeSlot &slot = free_slot(pos + i);
+                    dest[i] = slot.index;
+                    slot.sequence.store(pos + i + max_indices - (pos + i) % max_indices, std::memory_order_release);
+                }
+                return run;
             }
         }
+    }
+
+    /**
+     * \brief Reserve indices for new entities
+     *
+     * Reuses freed indices while there are enough of them (see \ref minimum_free_indices), then takes fresh indices,
+     *  and once those run out reuses any freed indices.
+     * Freed indices are taken in runs, and fresh indices all at once (allocating each page of generations once).
+     *
+     * \tparam F Function type
+     * \param count Number of indices to reserve
+     * \param emit Function taking each reserved index and its generation
+     * \return Number of indices reserved (less than `count` only when no index is available)
+     */
+    template<typename F>
+    unsigned EntityManager::reserve(unsigned count, F emit) {
+        unsigned reserved = 0;
+        unsigned run[free_run];
+
+        // Reuse freed indices while enough are queued
+        while (reserved < count) {
+            const size_t queued = free_size();
+            if (queued <= minimum_free_indices) {
+                break;
+            }
+            const auto wanted = static_cast<unsigned>(std::min<size_t>({count - reserved, queued - minimum_free_indices, free_run}));
+            const unsigned taken = pop_free(run, wanted);
+            if (taken == 0) {
+                break;
+            }
+            for (unsigned i = 0; i < taken; i++) {
+                emit(run[i], generation_at(run[i])->load(std::memory_order_relaxed));
+            }
+            reserved += taken;
+        }
+
+        // Take fresh indices, all at once (their generation is 0)
+        if (reserved < count) {
+            const uint64_t wanted = count - reserved;
+            const uint64_t first = next_index.fetch_add(wanted, std::memory_order_relaxed);
+            const uint64_t available = (first < max_indices) ? std::min<uint64_t>(wanted, max_indices - first) : 0;
+            for (uint64_t i = 0; i < available;) {
+                const uint64_t page_start = first + i;
+                page(generation, page_start / page_entries);
+                const uint64_t page_end = std::min(available, i + page_entries - page_start % page_entries);
+                for (; i < page_end; i++) {
+                    emit(static_cast<unsigned>(first + i), static_cast<uint16_t>(0));
+                }
+            }
+            reserved += available;
+        }
+
+        // Fresh indices ran out -> reuse any freed ones
+        while (reserved < count) {
+            const unsigned taken = pop_free(run, std::min(count - reserved, free_run));
+            if (taken == 0) {
+                break;
+            }
+            for (unsigned i = 0; i < taken; i++) {
+                emit(run[i], generation_at(run[i])->load(std::memory_order_relaxed));
+            }
+            reserved += taken;
+        }
+        return reserved;
+    }
+
+    /**
+     * \brief Make the entity at the reserved index alive
+     *
+     * \param index Reserved index
+     * \return Created entity
+     */
+    Entity EntityManager::activate(unsigned index) {
+        const uint16_t gen = generation_at(index)->load(std::memory_order_relaxed);
 
         // Update debug information
-        living_entities++;
-        max_index = (index > max_index) ? index : max_index;
-        auto gen = generation[index];
-        max_generation = (gen > max_generation) ? gen : max_generation;
+        living_entities.fetch_add(1, std::memory_order_relaxed);
+        raise_to(max_index, index);
+        raise_to(max_generation, gen);
 
         return Entity(index, gen);
     }
 
+    /**
+     * \brief Increase the entity's generation (wrapping within the handle's bits) if it is alive
+     *
+     * \param e Entity
+     * \return `true` iff the entity was alive (i.e. its index now has to be freed)
+     */
+    bool EntityManager::retire(Entity e) {
+        std::atomic<uint16_t> *gen = generation_at(e.index());
+        if (!gen) {
+            return false;
+        }
+        uint16_t expected = e.generation();
+        const auto next = static_cast<uint16_t>((expected + 1) & entity_generation_mask);
+        return gen->compare_exchange_strong(expected, next, std::memory_order_relaxed);
+    }
+
+    /**
+     * \brief Append the entities to the destroyed stream
+     *
+     * \param entities Destroyed entities
+     * \param count Number of entities
+     */
+    void EntityManager::append_destroyed(const Entity *entities, unsigned count) {
+        const uint64_t first = destroyed_tail.fetch_add(count, std::memory_order_relaxed);
+        for (unsigned i = 0; i < count; i++) {
+            const uint64_t pos = first + i;
+            const uint64_t tag = static_cast<uint32_t>(pos + 1);
+            destroyed[pos % destroyed_capacity].store((tag << 32) | entities[i].id, std::memory_order_release);
+        }
+    }
+
+    /**
+     * \brief Free the pages
+     */
+    EntityManager::~EntityManager() {
+        for (auto &p : generation) {
+            delete[] p.load(std::memory_order_relaxed);
+        }
+        for (auto &p : free_slots) {
+            delete[] p.load(std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * \brief Create a new entity
+     *
+     * Thread-safe.
+     *
+     * \return Created entity
+     * \throw std::runtime_error when there is no available index for new entity
+     */
+    Entity EntityManager::create() {
+        unsigned index = 0;
+        if (reserve(1, [&index](unsigned i, uint16_t) { index = i; }) == 0) {
+            // No index available at all -> unable to create a new entity
+            log::log(lg, log::error, "No available index for new entity");
+            throw std::runtime_error("No available index for new entity");
+        }
+        return activate(index);
+    }
+
     /**
      * \brief Create multiple new entities
      *
+     * Reserves all indices at once and writes the handles in a single pass, updating the debug information once.
+     * Thread-safe.
+     *
      * \param dest Destination for created entities
      * \param count Number of entities to create
+     * \throw std::runtime_error when there are not enough available indices (no entities are created then)
      */
     void EntityManager::create(Entity *dest, unsigned count) {
-        for (unsigned i = 0; i < count; i++, dest++) {
-            *dest = create();
+        unsigned top_index = 0;
+        uint16_t top_generation = 0;
+        Entity *next = dest;
+        const unsigned created = reserve(count, [&](unsigned index, uint16_t gen) {
+            *next++ = Entity(index, gen);
+            top_index = std::max(top_index, index);
+            top_generation = std::max(top_generation, gen);
+        });
+
+        if (created < count) {
+            // Not enough indices -> return the reserved ones
+            unsigned run[free_run];
+            for (unsigned done = 0; done < created;) {
+                const unsigned n = std::min(created - done, free_run);
+                for (unsigned i = 0; i < n; i++) {
+                    run[i] = dest[done + i].index();
+                }
+                push_free(run, n);
+                done += n;
+            }
+            log::log(lg, log::error, "No available index for new entity");
+            throw std::runtime_error("No available index for new entity");
+        }
+
+        // Update debug information
+        living_entities.fetch_add(count, std::memory_order_relaxed);
+        if (count > 0) {
+            raise_to(max_index, top_index);
+            raise_to(max_generation, top_generation);
         }
     }
 
@@ -84,36 +379,164 @@ namespace open_sea::ecs {
      *
      * Get whether the entity is alive.
      * An entity is considered alive iff its generation matches the generation at its index.
+     * Thread-safe.
      *
      * \param e Entity to check
      * \return \c true when alive, \c false otherwise
      */
     bool EntityManager::alive(Entity e) const {
-        return generation[e.index()] == e.generation();
+        const std::atomic<uint16_t> *gen = generation_at(e.index());
+        return gen && gen->load(std::memory_order_relaxed) == e.generation();
     }
 
     /**
      * \brief Kill (destroy) an entity
      *
+     * Does nothing when the entity is not alive, so an entity killed from several threads is only freed once.
+     * Thread-safe.
+     *
      * \param e Entity to kill
      */
     void EntityManager::kill(Entity e) {
-        // Increase generation and add to free indices
-        const unsigned index = e.index();
-        generation[index]++;
-        freeIndices.push(index);
-        living_entities--;
+        if (retire(e)) {
+            const unsigned index = e.index();
+            push_free(&index, 1);
+            append_destroyed(&e, 1);
+            living_entities.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * \brief Kill (destroy) multiple entities
+     *
+     * Entities that are not alive are skipped.
+     * The freed indices are queued in runs, and the debug information is updated once.
+     * Thread-safe.
+     *
+     * \param entities Entities to kill
+     * \param count Number of entities
+     */
+    void EntityManager::kill(const Entity *entities, unsigned count) {
+        unsigned run[free_run];
+        Entity retired[free_run];
+        unsigned n = 0;
+        unsigned killed = 0;
+        for (unsigned i = 0; i < count; i++) {
+            if (retire(entities[i])) {
+                run[n] = entities[i].index();
+                retired[n++] = entities[i];
+                if (n == free_run) {
+                    push_free(run, n);
+                    append_destroyed(retired, n);
+                    killed += n;
+                    n = 0;
+                }
+            }
+        }
+        push_free(run, n);
+        append_destroyed(retired, n);
+        killed += n;
+        living_entities.fetch_sub(killed, std::memory_order_relaxed);
+    }
+
+    /**
+     * \brief Get the position at the end of the destroyed stream
+     *
+     * Reading from this position on (see \ref destroyed_since) yields only entities destroyed after this call.
+     *
+     * \return Number of entities ever destroyed
+     */
+    uint64_t EntityManager::destroyed_position() const {
+        return destroyed_tail.load(std::memory_order_acquire);
+    }
+
+    /**
+     * \brief Read the entities destroyed since the cursor, and advance the cursor past them
+     *
+     * Each reader keeps its own cursor (starting at 0, or at \ref destroyed_position).
+     * Only the last \ref destroyed_capacity destroyed entities are kept, so a reader that falls further behind misses
+     *  some of them, in which case it has to check its entities some other way (e.g. with \ref alive).
+     * Entities still being appended by a concurrent kill are left for the next read.
+     * Thread-safe.
+     *
+     * \param cursor Position in the stream (advanced past the read entities)
+     * \param dest Destination the destroyed entities are appended to
+     * \return `false` iff some entities were missed (the cursor is then moved to the end of the stream)
+     */
+    bool EntityManager::destroyed_since(uint64_t &cursor, std::vector<Entity> &dest) const {
+        uint64_t tail = destroyed_tail.load(std::memory_order_acquire);
+        if (tail - cursor > destroyed_capacity) {
+            cursor = tail;
+            return false;
+        }
+
+        for (; cursor < tail; cursor++) {
+            const uint64_t value = destroyed[cursor % destroyed_capacity].load(std::memory_order_acquire);
+            if ((value >> 32) == static_cast<uint32_t>(cursor + 1)) {
+                Entity e;
+                e.id = static_cast<handle>(value);
+                dest.push_back(e);
+                continue;
+            }
+
+            // Slot not written yet, or already overwritten by a later entity
+            tail = destroyed_tail.load(std::memory_order_acquire);
+            if (tail - cursor > destroyed_capacity) {
+                cursor = tail;
+                return false;
+            }
+            break;
+        }
+        return true;
     }
 
     /**
      * \brief Show ImGui debug information
      */
     void EntityManager::show_debug() {
-        ImGui::Text("Living entities: %i", living_entities);
-        ImGui::Text("Maximum generation: %i", max_generation);
-        ImGui::Text("Maximum index: %i", max_index);
-        ImGui::Text("Free indices: %i", static_cast<int>(freeIndices.size()));
+        ImGui::Text("Living entities: %i", living_entities.load());
+        ImGui::Text("Maximum generation: %i", max_generation.load());
+        ImGui::Text("Maximum index: %i", max_index.load());
+        ImGui::Text("Free indices: %i", static_cast<int>(free_size()));
+    }
+
+    //--- start EntityManager::Cache implementation
+    /**
+     * \brief Construct an empty cache
+     *
+     * \param manager Manager to reserve indices from (has to outlive the cache)
+     */
+    EntityManager::Cache::Cache(EntityManager &manager) : manager(manager) {}
+
+    /**
+     * \brief Create a new entity from the cache's reserved indices, reserving another batch when out
+     *
+     * \return Created entity
+     * \throw std::runtime_error when there is no available index for new entity
+     */
+    Entity EntityManager::Cache::create() {
+        if (reserved.empty()) {
+            manager.reserve(batch, [this](unsigned index, uint16_t) { reserved.push_back(index); });
+            if (reserved.empty()) {
+                log::log(manager.lg, log::error, "No available index for new entity");
+                throw std::runtime_error("No available index for new entity");
+            }
+            // Note: reversed, so that indices are used in the order they were reserved
+            std::reverse(reserved.begin(), reserved.end());
+        }
+
+        const unsigned index = reserved.back();
+        reserved.pop_back();
+        return manager.activate(index);
+    }
+
+    /**
+     * \brief Return the unused reserved indices to the manager
+     */
+    EntityManager::Cache::~Cache() {
+        manager.push_free(reserved.data(), static_cast<unsigned>(reserved.size()));
     }
+    //--- end EntityManager::Cache implementation
     //--- end EntityManager implementation
 }
 
@@ -46,6 +46,13 @@ namespace open_sea::profiler {
     //! Pointer to frame track with the maximum recorded root duration
     std::shared_ptr<track> maximum{};
 
+    //! Counts recorded during the frame being built
+    std::vector<Count> counts_in_progress{};
+    //! Counts recorded during the last completed frame
+    std::vector<Count> counts_completed{};
+    //! Counts recorded during the frame with the maximum recorded root duration
+    std::vector<Count> counts_maximum{};
+
     /**
      * \brief Start profiling
      *
@@ -55,6 +62,7 @@ namespace open_sea::profiler {
         // Clear buffer and push root
         in_progress = std::make_shared<track>();
         in_progress->push(Info("Root"));
+        counts_in_progress.clear();
     }
 
     /**
@@ -74,10 +82,13 @@ namespace open_sea::profiler {
         // Copy the frame track into completed and clear in_progress
         in_progress.swap(completed);
         in_progress.reset();
+        counts_in_progress.swap(counts_completed);
+        counts_in_progress.clear();
 
         // Update maximum if relevant
         if (!maximum || (*completed->get_store())[0].content.time > (*maximum->get_store())[0].content.time) {
             maximum = completed;
+            counts_maximum = counts_completed;
         }
     }
 
@@ -110,6 +121,21 @@ namespace open_sea::profiler {
         in_progress->pop();
     }
 
+    /**
+     * \brief Record a named count for the frame
+     *
+     * \param label Label
+     * \param value Counted value
+     */
+    void count(const std::string &label, uint64_t value) {
+        // Skip if not started
+        if (!in_progress) {
+            return;
+        }
+
+        counts_in_progress.push_back(Count{label, value});
+    }
+
     /**
      * \brief Get the last completed frame tree
      *
@@ -124,10 +150,27 @@ namespace open_sea::profiler {
      */
     std::shared_ptr<track> get_maximum() { return maximum; }
 
+    /**
+     * \brief Get the counts recorded during the last completed frame
+     *
+     * \return Counts in the order they were recorded
+     */
+    const std::vector<Count> &get_last_counts() { return counts_completed; }
+
+    /**
+     * \brief Get the counts recorded during the maximum recorded frame
+     *
+     * \return Counts in the order they were recorded
+     */
+    const std::vector<Count> &get_maximum_counts() { return counts_maximum; }
+
     /**
      * \brief Clear the maximum recorded frame tree
      */
-    void clear_maximum() { maximum.reset(); }
+    void clear_maximum() {
+        maximum.reset();
+        counts_maximum.clear();
+    }
 
     //! Whether text should show maximum instead of last
     bool text_show_maximum = false;
@@ -144,6 +187,11 @@ namespace open_sea::profiler {
         ImGui::TextUnformatted(subject ?
                                subject->to_indented_string().data() :
                                "No completed frame track");
+
+        // Selected counts
+        for (const Count &c : text_show_maximum ? counts_maximum : counts_completed) {
+            ImGui::Text("%s: %lu", c.label.data(), static_cast<unsigned long>(c.value));
+        }
     }
 
     // Graphical gui parameters
@@ -10,12 +10,20 @@
 #include <open-sea/Profiler.h>
 #include <open-sea/GL.h>
 #include <open-sea/Components.h>
+#include <open-sea/Query.h>
 
 #include <vector>
 
 namespace open_sea::render {
 
     //--- start UntexturedRenderer implementation
+    //! Query of entities with both model and transformation components
+    struct UntexturedRenderer::Drawable {
+        data::Query<ecs::ModelTable::table_t, ecs::TransformationTable::table_t> query;
+
+        Drawable(ecs::ModelTable &m, ecs::TransformationTable &t) : query(*m.table, *t.table) {}
+    };
+
     /**
      * \brief Construct a renderer
      *
@@ -35,6 +43,9 @@ namespace open_sea::render {
         shader->validate();
         p_mat_location = shader->get_uniform_location("projectionMatrix");
         w_mat_location = shader->get_uniform_location("worldMatrix");
+
+        // Prepare the query of drawable entities
+        drawable = std::make_unique<Drawable>(*model_mgr, *transform_mgr);
     }
 
     /**
@@ -107,6 +118,60 @@ namespace open_sea::render {
         profiler::pop();
     }
 
+    /**
+     * \brief Render all drawable entities through camera
+     *
+     * Render all entities that have both a model and a transformation component through a camera.
+     * When both component managers are in the same \ref ecs::OwningGroup, the entities are streamed from the front of
+     *  both tables.
+     * Otherwise the entities are found by a query over both component managers, which is only matched again when
+     *  either manager's structure changes.
+     *
+     * \param camera Camera
+     */
+    void UntexturedRenderer::render(std::shared_ptr<gl::Camera> camera) {
+        profiler::push("Setup");
+        // Use the shader and set the projection view matrix
+        shader->use();
+        glUniformMatrix4fv(p_mat_location, 1, GL_FALSE, &camera->get_proj_view_matrix()[0][0]);
+        profiler::pop();
+
+        // Render each drawable entity
+        profiler::push("Render");
+        auto draw = [this](const ecs::ModelTable::Data::Ptr &m, const ecs::TransformationTable::Data::Ptr &t) {
+            std::shared_ptr<model::Model> model = model_mgr->get_model(*m.model);
+            glUniformMatrix4fv(w_mat_location, 1, GL_FALSE, &(*t.matrix)[0][0]);
+            glBindVertexArray(model->get_vertex_array());
+            glDrawElements(GL_TRIANGLES, model->get_vertex_count(), GL_UNSIGNED_INT, nullptr);
+        };
+        ecs::OwningGroup *group = model_mgr->group;
+        if (group && group == transform_mgr->group) {
+            // Grouped -> walk the front of both tables
+            group->for_each(draw);
+        } else {
+            // Otherwise -> go through the matched entities in batches
+            drawable->query.for_each_batch([&draw](const ecs::Entity */*keys*/, size_t count,
+                                                   const ecs::ModelTable::Data::Ptr *models,
+                                                   const ecs::TransformationTable::Data::Ptr *transformations) {
+                for (size_t j = 0; j < count; j++) {
+                    draw(models[j], transformations[j]);
+                }
+            });
+        }
+        profiler::pop();
+
+        // Reset state
+        profiler::push("Reset");
+        glBindVertexArray(0);
+        shader->unset();
+        profiler::pop();
+    }
+
+    /**
+     * \brief Destroy the renderer
+     */
+    UntexturedRenderer::~UntexturedRenderer() = default;
+
     /**
      * \brief Show ImGui debug information
      */
@@ -4,6 +4,147 @@
  * \author Filip Smola
  */
 
+#include <open-sea/Systems.h>
+
 namespace open_sea::ecs {
+    //! Whether the current thread is running a task of a thread pool
+    thread_local bool in_task = false;
+
+    //--- start ThreadPool implementation
+    /**
+     * \brief Construct a thread pool
+     *
+     * \param threads Number of worker threads (the calling thread of each batch works as well)
+     */
+    ThreadPool::ThreadPool(unsigned threads) {
+        workers.reserve(threads);
+        for (unsigned i = 0; i < threads; i++) {
+            workers.emplace_back(&ThreadPool::work, this);
+        }
+    }
+
+    /**
+     * \brief Worker loop
+     *
+     * Waits for a batch to start, takes part in it, and reports back when there are no more tasks to take.
+     */
+    void ThreadPool::work() {
+        uint64_t seen = 0;
+        while (true) {
+            // Wait for a new batch
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this, seen]() { return stopping || batch != seen; });
+                if (stopping) {
+                    return;
+                }
+                seen = batch;
+            }
+
+            drain();
+
+            // Report back, waking the caller if last
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--active == 0) {
+                done.notify_one();
+            }
+        }
+    }
+
+    /**
+     * \brief Run tasks of the current batch until none are left
+     *
+     * The first exception thrown by any task is kept to be rethrown by the caller, and the remaining tasks are skipped.
+     */
+    void ThreadPool::drain() {
+        in_task = true;
+        for (size_t i = next++; i < task_count; i = next++) {
+            try {
+                (*task)(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                next = task_count;
+            }
+        }
+        in_task = false;
+    }
+
+    /**
+     * \brief Run a batch of tasks
+     *
+     * Returns once all the tasks are done.
+     * The tasks run concurrently, in no particular order.
+     *
+     * \param count Number of tasks
+     * \param f Function taking the index of the task (from 0 to `count - 1`)
+     *
+     * \throws Exception thrown by any of the tasks (the first one, after all running tasks finish)
+     */
+    void ThreadPool::run(size_t count, const std::function<void(size_t)> &f) {
+        // Run nested batches and batches too small to share on this thread alone
+        if (in_task || workers.empty() || count <= 1) {
+            for (size_t i = 0; i < count; i++) {
+                f(i);
+            }
+            return;
+        }
+
+        // Start the batch (once any batch run from a different thread is done)
+        std::lock_guard<std::mutex> serial(running);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            task = &f;
+            task_count = count;
+            next = 0;
+            active = workers.size();
+            error = nullptr;
+            batch++;
+        }
+        wake.notify_all();
+
+        // Take part, then wait for the workers
+        drain();
+        std::exception_ptr thrown;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [this]() { return active == 0; });
+            task = nullptr;
+            thrown = error;
+            error = nullptr;
+        }
+
+        if (thrown) {
+            std::rethrow_exception(thrown);
+        }
+    }
+
+    /**
+     * \brief Stop and join the worker threads
+     */
+    ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &worker : workers) {
+            worker.join();
+        }
+    }
+    //--- end ThreadPool implementation
 
+    /**
+     * \brief Get the shared thread pool
+     *
+     * The pool is created on first use, with a worker for each hardware thread except the calling one.
+     *
+     * \return Shared thread pool
+     */
+    ThreadPool &thread_pool() {
+        static ThreadPool pool;
+        return pool;
+    }
 }
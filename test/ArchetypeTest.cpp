@@ -0,0 +1,138 @@
+/*
+ * Tests of the archetype storage.
+ *
+ * Each test returns whether it passed, reporting any failed check.
+ *
+ * Author: Filip Smola (smola.filip@hotmail.com)
+ */
+
+#include <open-sea/Archetype.h>
+#include <open-sea/Entity.h>
+#include "Test.h"
+namespace ecs = open_sea::ecs;
+namespace data = open_sea::data;
+
+#include <vector>
+#include <map>
+#include <random>
+#include <cstdlib>
+
+//! Position component used by the archetype tests
+struct Position {
+    static constexpr size_t count = 1;
+    struct Ptr {
+        float *x;
+    };
+
+    float x;
+};
+SOA_MEMBER(Position, 0, float, x)
+
+//! Tag component used by the archetype tests
+struct Tag {
+    static constexpr size_t count = 1;
+    struct Ptr {
+        unsigned *id;
+    };
+
+    unsigned id;
+};
+SOA_MEMBER(Tag, 0, unsigned, id)
+
+typedef data::ArchetypeStorage<ecs::Entity, data::SparseKeyMap<ecs::Entity>, Position, Tag> Storage;
+
+/**
+ * Random additions and removals of components keep each key's records together and match a reference model, with each
+ *  archetype's keys, key map and columns agreeing
+ */
+bool random_changes_match_model() {
+    constexpr unsigned keys = 300;
+    Storage storage;
+    std::map<unsigned, float> positions;
+    std::map<unsigned, unsigned> tags;
+    std::vector<unsigned> generation(keys, 0);
+
+    std::mt19937 generator(19);
+    for (unsigned step = 0; step < 20000; step++) {
+        const unsigned index = generator() % keys;
+        const ecs::Entity key(index, generation[index]);
+        switch (generator() % 6) {
+            case 0:
+                CHECK(storage.add(key, Position{static_cast<float>(step)}) == !positions.count(index));
+                positions.emplace(index, static_cast<float>(step));
+                break;
+            case 1:
+                CHECK(storage.add(key, Tag{step}) == !tags.count(index));
+                tags.emplace(index, step);
+                break;
+            case 2:
+                CHECK(storage.remove<Position>(key) == (positions.erase(index) > 0));
+                break;
+            case 3:
+                CHECK(storage.remove<Tag>(key) == (tags.erase(index) > 0));
+                break;
+            case 4:
+                CHECK(storage.remove(key) == (positions.erase(index) + tags.erase(index) > 0));
+                break;
+            default:
+                // The key's entity dies, and a newer generation takes over its records on the next addition
+                generation[index]++;
+                if (storage.add(ecs::Entity(index, generation[index]), Tag{step})) {
+                    positions.erase(index);
+                    tags[index] = step;
+                }
+                break;
+        }
+    }
+
+    // Each key has the records of the model
+    size_t with_any = 0;
+    for (unsigned index = 0; index < keys; index++) {
+        const ecs::Entity key(index, generation[index]);
+        CHECK(storage.has<Position>(key) == (positions.count(index) > 0));
+        CHECK(storage.has<Tag>(key) == (tags.count(index) > 0));
+        if (positions.count(index)) {
+            CHECK(*storage.get<Position>(key).x == positions[index]);
+        }
+        if (tags.count(index)) {
+            CHECK(*storage.get<Tag>(key).id == tags[index]);
+        }
+        with_any += (positions.count(index) || tags.count(index)) ? 1 : 0;
+    }
+    CHECK(storage.size() == with_any);
+
+    // Each archetype's keys map to their own index
+    size_t total = 0;
+    for (size_t a = 0; a < storage.archetype_count(); a++) {
+        Storage::Archetype &archetype = storage.get_archetype(a);
+        for (size_t i = 0; i < archetype.size(); i++) {
+            CHECK(archetype.lookup(archetype.keys()[i]) == data::opt_index(i));
+            CHECK(storage.components(archetype.keys()[i]) == archetype.mask());
+        }
+        total += archetype.size();
+    }
+    CHECK(total == with_any);
+
+    // Iteration over both components visits exactly the keys that have both
+    size_t visited = 0;
+    bool matches = true;
+    storage.for_each<Position, Tag>([&](const ecs::Entity &key, const Position::Ptr &p, const Tag::Ptr &t) {
+        visited++;
+        matches = matches && *p.x == positions[key.index()] && *t.id == tags[key.index()];
+    });
+    CHECK(matches);
+    size_t both = 0;
+    for (const auto &entry : positions) {
+        both += tags.count(entry.first);
+    }
+    CHECK(visited == both);
+    return true;
+}
+
+int main() {
+    bool passed = true;
+    passed = random_changes_match_model() && passed;
+
+    std::cout << (passed ? "All tests passed" : "Some tests failed") << std::endl;
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,541 @@
+/*
+ * Tests of the component managers.
+ *
+ * Each test returns whether it passed, reporting any failed check.
+ *
+ * Author: Filip Smola (smola.filip@hotmail.com)
+ */
+
+#include <open-sea/Entity.h>
+#include <open-sea/Components.h>
+#include <open-sea/Commands.h>
+#include "Test.h"
+namespace ecs = open_sea::ecs;
+namespace data = open_sea::data;
+
+#include <glm/gtc/quaternion.hpp>
+
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <new>
+#include <cstdlib>
+
+//! Number of allocations made so far (counted to check code that shouldn't allocate)
+size_t allocations = 0;
+
+// Note: not inlined, as GCC otherwise takes the pointers passed to `free` for ones from the built-in `operator new`
+[[gnu::noinline]] void *operator new(size_t size) {
+    allocations++;
+    if (void *p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+[[gnu::noinline]] void *operator new[](size_t size) { return operator new(size); }
+[[gnu::noinline]] void *operator new(size_t size, const std::nothrow_t &) noexcept {
+    allocations++;
+    return std::malloc(size ? size : 1);
+}
+[[gnu::noinline]] void *operator new[](size_t size, const std::nothrow_t &tag) noexcept { return operator new(size, tag); }
+[[gnu::noinline]] void operator delete(void *p) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete(void *p, const std::nothrow_t &) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete[](void *p, const std::nothrow_t &) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete(void *p, size_t) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete[](void *p) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete[](void *p, size_t) noexcept { std::free(p); }
+
+//! Parts of the identity transformation
+const glm::vec3 zero(0.0f), one(1.0f);
+const glm::quat identity(1.0f, 0.0f, 0.0f, 0.0f);
+
+/** \struct World
+ * Entity manager with freshly created entities, and component managers for them
+ */
+struct World {
+    ecs::EntityManager manager;
+    std::vector<ecs::Entity> entities;
+    std::shared_ptr<ecs::ModelTable> models;
+    std::shared_ptr<ecs::TransformationTable> transforms;
+
+    /**
+     * Create the entities and component managers
+     *
+     * \param n Number of entities (and initial capacity of the component managers)
+     */
+    explicit World(unsigned n) : entities(n), models(std::make_shared<ecs::ModelTable>(n)),
+                                 transforms(std::make_shared<ecs::TransformationTable>(n)) {
+        manager.create(entities.data(), n);
+    }
+};
+
+/**
+ * Add an identity transformation to the entity as a root
+ *
+ * \param manager Transformation component manager
+ * \param e Entity
+ */
+void add_root(ecs::TransformationTable &manager, const ecs::Entity &e) {
+    manager.add(e, zero, identity, one, data::opt_index());
+}
+
+/**
+ * Add an identity transformation to the entity under the parent's transformation
+ *
+ * \param manager Transformation component manager
+ * \param e Entity
+ * \param parent Parent entity (has to have a transformation)
+ */
+void add_child(ecs::TransformationTable &manager, const ecs::Entity &e, const ecs::Entity &parent) {
+    manager.add(e, zero, identity, one, manager.table->lookup(parent));
+}
+
+/**
+ * Add identity transformations to the entities in pairs, where every odd entity is a child of the previous one
+ *
+ * \param manager Transformation component manager
+ * \param entities Entities
+ */
+void add_pairs(ecs::TransformationTable &manager, const std::vector<ecs::Entity> &entities) {
+    for (size_t i = 0; i < entities.size(); i++) {
+        if (i % 2) {
+            add_child(manager, entities[i], entities[i - 1]);
+        } else {
+            add_root(manager, entities[i]);
+        }
+    }
+}
+
+/**
+ * Check the tree links of all the records are consistent with each other
+ *
+ * \param manager Transformation component manager
+ * \return `true` iff the links are consistent
+ */
+bool links_consistent(ecs::TransformationTable &manager) {
+    const size_t n = manager.table->size();
+    for (size_t i = 0; i < n; i++) {
+        auto ref = manager.table->get_reference(data::opt_index(i));
+        const data::opt_index idx(i);
+
+        // Each child lists this record as parent, and the siblings are linked both ways
+        size_t steps = 0;
+        data::opt_index prev;
+        for (data::opt_index child = *ref.first_child; child.is_set(); child = *manager.table->get_reference(child).next_sibling) {
+            CHECK(child.get() < n && child != idx && ++steps <= n);
+            auto child_ref = manager.table->get_reference(child);
+            CHECK(*child_ref.parent == idx);
+            CHECK(*child_ref.prev_sibling == prev);
+            prev = child;
+        }
+
+        // Each record with a parent is among its children
+        if (ref.parent->is_set()) {
+            CHECK(ref.parent->get() < n);
+            bool found = false;
+            for (data::opt_index child = *manager.table->get_reference(*ref.parent).first_child; child.is_set() && !found;
+                 child = *manager.table->get_reference(child).next_sibling) {
+                found = (child == idx);
+            }
+            CHECK(found);
+        }
+    }
+    return true;
+}
+
+/**
+ * Re-adding a reused entity index under a parent before garbage collection removes the dead entity's record (with its
+ *  subtree) and links the new one correctly
+ */
+bool reused_index_under_parent() {
+
+    for (bool batch : {false, true}) {
+        ecs::TransformationTable manager(4);
+        const ecs::Entity root(1, 0), old(5, 0), old_child(6, 0), sibling(7, 0), reused(5, 1);
+
+        // Old entity under the root, with a child of its own and a sibling after it
+        add_root(manager, root);
+        add_child(manager, old, root);
+        add_child(manager, old_child, old);
+        add_child(manager, sibling, root);
+
+        // Old entity dies, and its index is reused under the root before any garbage collection
+        if (batch) {
+            manager.add(&reused, &zero, &identity, &one, manager.table->lookup(root), 1);
+        } else {
+            add_child(manager, reused, root);
+        }
+
+        CHECK(manager.table->size() == 3);
+        CHECK(!manager.table->lookup(old).is_set());
+        CHECK(!manager.table->lookup(old_child).is_set());
+        CHECK(manager.table->lookup(reused).is_set());
+        CHECK(*manager.table->get_reference(reused).parent == manager.table->lookup(root));
+        CHECK(links_consistent(manager));
+
+        // Matrices propagate through the tree without looping
+        manager.update_matrix(root);
+    }
+    return true;
+}
+
+/**
+ * Removing a record removes its whole subtree and keeps the links of the remaining records (and the group) consistent
+ */
+bool remove_subtree() {
+
+    for (bool grouped : {false, true}) {
+        World world(6);
+        const std::vector<ecs::Entity> &entities = world.entities;
+        auto &models = world.models;
+        auto &manager = world.transforms;
+
+        // Tree 0 <- 1 <- {2, 3} and roots 4 and 5, with models on the even entities
+        add_root(*manager, entities[0]);
+        add_child(*manager, entities[1], entities[0]);
+        add_child(*manager, entities[2], entities[1]);
+        add_child(*manager, entities[3], entities[1]);
+        add_root(*manager, entities[4]);
+        add_root(*manager, entities[5]);
+        for (unsigned i = 0; i < 6; i += 2) {
+            models->add(entities[i], 0);
+        }
+        std::unique_ptr<ecs::OwningGroup> group;
+        if (grouped) {
+            group = std::make_unique<ecs::OwningGroup>(models, manager);
+        }
+
+        // Remove the middle of the chain
+        CHECK(manager->remove(entities[1]));
+        CHECK(manager->table->size() == 3);
+        for (unsigned i = 1; i < 4; i++) {
+            CHECK(!manager->table->lookup(entities[i]).is_set());
+        }
+        CHECK(!manager->table->get_reference(entities[0]).first_child->is_set());
+        CHECK(links_consistent(*manager));
+
+        // Grouped entities stay at the same index in both tables
+        if (grouped) {
+            CHECK(group->size() == 2);
+            for (unsigned i : {0u, 4u}) {
+                CHECK(group->contains(entities[i]));
+                CHECK(models->table->lookup(entities[i]) == manager->table->lookup(entities[i]));
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Removing a batch of records removes exactly their subtrees, both when removing records one by one (small batches) and
+ *  when compacting the table (large batches)
+ */
+bool remove_batch() {
+    constexpr unsigned n = 256;
+
+    for (unsigned batch : {4u, n / 2}) {
+        ecs::TransformationTable manager(n);
+
+        // Random forest, where each entity's parent is an earlier entity (or none)
+        std::mt19937 generator(batch);
+        std::vector<ecs::Entity> entities;
+        std::vector<int> parent(n, -1);
+        for (unsigned i = 0; i < n; i++) {
+            entities.emplace_back(i, 0);
+            parent[i] = (i == 0) ? -1 : static_cast<int>(generator() % (i + 1)) - 1;
+            if (parent[i] < 0) {
+                add_root(manager, entities[i]);
+            } else {
+                add_child(manager, entities[i], entities[parent[i]]);
+            }
+        }
+
+        // Remove a random batch, which also removes all their descendants
+        std::vector<ecs::Entity> victims;
+        std::vector<bool> removed(n, false);
+        for (unsigned i = 0; i < batch; i++) {
+            const unsigned v = generator() % n;
+            victims.push_back(entities[v]);
+            removed[v] = true;
+        }
+        for (unsigned i = 0; i < n; i++) {
+            removed[i] = removed[i] || (parent[i] >= 0 && removed[parent[i]]);
+        }
+        const size_t expected = std::count(removed.begin(), removed.end(), true);
+
+        CHECK(manager.remove(victims.data(), victims.size()) == expected);
+        CHECK(manager.table->size() == n - expected);
+        for (unsigned i = 0; i < n; i++) {
+            CHECK(manager.table->lookup(entities[i]).is_set() == !removed[i]);
+        }
+        CHECK(links_consistent(manager));
+    }
+    return true;
+}
+
+/**
+ * Garbage collection removes the records of all dead entities within one pass of the sweep, even when the entity
+ *  manager has dropped the deaths (too many died since the last collection)
+ */
+bool gc_sweep_covers_table() {
+    constexpr unsigned n = 80000;
+    constexpr unsigned budget = 256;
+
+    World world(n);
+    ecs::EntityManager &manager = world.manager;
+    const std::vector<ecs::Entity> &entities = world.entities;
+    auto &models = world.models;
+    auto &transforms = world.transforms;
+
+    // Every odd entity is a child of the previous one, and every other entity has a model
+    add_pairs(*transforms, entities);
+    for (unsigned i = 0; i < n; i += 2) {
+        models->add(entities[i], 0);
+    }
+    ecs::OwningGroup group(models, transforms);
+    models->gc(manager, 0);
+    transforms->gc(manager, 0);
+
+    // Kill more entities than the manager keeps track of, leaving only roots alive
+    std::vector<ecs::Entity> victims;
+    for (unsigned i = 0; i < n; i++) {
+        if (i % 8 != 0) {
+            victims.push_back(entities[i]);
+        }
+    }
+    manager.kill(victims.data(), static_cast<unsigned>(victims.size()));
+
+    // Each dead record takes a check, and can move up to two checked records back among those to check
+    const size_t calls = (n + 3 * victims.size()) / budget + 1;
+    for (size_t i = 0; i < calls; i++) {
+        models->gc(manager, budget);
+        transforms->gc(manager, budget);
+    }
+
+    CHECK(transforms->table->size() == n - victims.size());
+    CHECK(models->table->size() == n / 2 - victims.size() / 2 + (n / 8) / 2);
+    for (unsigned i = 0; i < n; i++) {
+        CHECK(transforms->table->lookup(entities[i]).is_set() == (i % 8 == 0));
+    }
+    CHECK(group.size() == n / 8);
+    CHECK(links_consistent(*transforms));
+    return true;
+}
+
+/**
+ * Garbage collection removing a few records per frame doesn't allocate once its buffers have grown
+ */
+bool gc_allocation_free() {
+    constexpr unsigned n = 4096;
+
+    World world(n);
+    ecs::EntityManager &manager = world.manager;
+    const std::vector<ecs::Entity> &entities = world.entities;
+    auto &models = world.models;
+    auto &transforms = world.transforms;
+    add_pairs(*transforms, entities);
+    for (unsigned i = 0; i < n; i++) {
+        models->add(entities[i], 0);
+    }
+    ecs::OwningGroup group(models, transforms);
+
+    // Grow the buffers with a larger round of deaths first
+    constexpr unsigned warm_up = 64;
+    manager.kill(entities.data(), warm_up);
+    models->gc(manager);
+    transforms->gc(manager);
+
+    // Then a few deaths per frame
+    size_t allocated = 0;
+    for (unsigned i = warm_up; i < warm_up + 256; i += 4) {
+        manager.kill(entities.data() + i, 4);
+        const size_t before = allocations;
+        models->gc(manager);
+        transforms->gc(manager);
+        allocated += allocations - before;
+    }
+
+    CHECK(allocated == 0);
+    CHECK(transforms->table->size() == n - warm_up - 256);
+    CHECK(links_consistent(*transforms));
+    return true;
+}
+
+/**
+ * Flushing a command buffer resolves additions and removals of the same entity in the order they were recorded, and
+ *  keeps additions under parents that are not present for the next flush
+ */
+bool flush_resolves_order() {
+
+    World world(6);
+    const std::vector<ecs::Entity> &entities = world.entities;
+    auto &models = world.models;
+    auto &transforms = world.transforms;
+    ecs::CommandBuffer buffer(models, transforms);
+
+    // Existing components of entity 0 (under root 3) are replaced by removal followed by addition
+    add_root(*transforms, entities[3]);
+    add_child(*transforms, entities[0], entities[3]);
+    models->add(entities[0], 1);
+    buffer.remove_model(entities[0]);
+    buffer.add_model(entities[0], 2);
+    buffer.remove_transformation(entities[0]);
+    buffer.add_transformation(entities[0], one, identity, one);
+
+    // Components of entity 1 are not left behind by addition followed by removal
+    buffer.add_model(entities[1], 0);
+    buffer.add_transformation(entities[1], zero, identity, one);
+    buffer.remove_model(entities[1]);
+    buffer.remove_transformation(entities[1]);
+
+    // Entity 2 is removed with the subtree of its parent, removed after it is added
+    buffer.add_transformation(entities[2], zero, identity, one, entities[3]);
+    buffer.remove_transformation(entities[3]);
+
+    // Entity 4 waits for its parent
+    buffer.add_transformation(entities[4], zero, identity, one, entities[5]);
+    buffer.flush();
+
+    CHECK(models->table->get_copy(entities[0]).model == 2);
+    CHECK(!transforms->table->get_reference(entities[0]).parent->is_set());
+    CHECK(!models->table->lookup(entities[1]).is_set());
+    CHECK(!transforms->table->lookup(entities[1]).is_set());
+    CHECK(!transforms->table->lookup(entities[2]).is_set());
+    CHECK(!transforms->table->lookup(entities[3]).is_set());
+    CHECK(!transforms->table->lookup(entities[4]).is_set());
+    CHECK(buffer.size() == 1);
+
+    buffer.add_transformation(entities[5], zero, identity, one);
+    buffer.flush();
+    CHECK(buffer.size() == 0);
+    CHECK(transforms->table->lookup(entities[4]).is_set());
+    CHECK(*transforms->table->get_reference(entities[4]).parent == transforms->table->lookup(entities[5]));
+    CHECK(links_consistent(*transforms));
+    return true;
+}
+
+/**
+ * Flushing a command buffer drops additions under an ancestor whose removal was recorded after them, whether the
+ *  ancestor is reached through the table or through other recorded additions, and drops additions whose parents are
+ *  still not present after being kept once
+ */
+bool flush_drops_orphans() {
+
+    World world(8);
+    const std::vector<ecs::Entity> &entities = world.entities;
+    auto &models = world.models;
+    auto &transforms = world.transforms;
+    ecs::CommandBuffer buffer(models, transforms);
+
+    // Entity 2 is added under entity 1, which is present under root 0, removed after the addition
+    add_root(*transforms, entities[0]);
+    add_child(*transforms, entities[1], entities[0]);
+    buffer.add_transformation(entities[2], zero, identity, one, entities[1]);
+
+    // Entity 4 is added under entity 3, itself added under root 0
+    buffer.add_transformation(entities[3], zero, identity, one, entities[0]);
+    buffer.add_transformation(entities[4], zero, identity, one, entities[3]);
+    buffer.remove_transformation(entities[0]);
+
+    // Entity 5 waits for its parent 6, which is never added
+    buffer.add_transformation(entities[5], zero, identity, one, entities[6]);
+    buffer.flush();
+
+    for (size_t i = 0; i < 6; i++) {
+        CHECK(!transforms->table->lookup(entities[i]).is_set());
+    }
+    CHECK(buffer.size() == 1);
+
+    // Parent 6 is recorded to wait for entity 7, so entity 5 is kept for one more flush along with it
+    buffer.add_transformation(entities[6], zero, identity, one, entities[7]);
+    buffer.flush();
+    CHECK(buffer.size() == 2);
+
+    // Entity 7 is never added, so both additions are dropped
+    buffer.flush();
+    CHECK(buffer.size() == 0);
+    CHECK(transforms->table->size() == 0);
+    return true;
+}
+
+/**
+ * Component tables adapt their layout to the columns their scans read: struct of arrays for views of a few columns,
+ *  array of structs for copies of whole records
+ */
+bool adapt_to_scanned_columns() {
+    constexpr unsigned n = 1024;
+
+    World world(n);
+    for (const ecs::Entity &e : world.entities) {
+        add_root(*world.transforms, e);
+    }
+    auto &table = *world.transforms->table;
+    table.switch_layout(data::RecordLayout::aos);
+
+    // Scans of the positions only
+    for (unsigned k = 0; k < 4; k++) {
+        table.view<0>().for_each([](glm::vec3 &position) { position.x += 1.0f; });
+    }
+    CHECK(table.adapt());
+    CHECK(table.layout() == data::RecordLayout::soa);
+
+    // Copies of whole records
+    for (unsigned i = 0; i < 2 * n; i++) {
+        table.get_copy(data::opt_index(i % n));
+    }
+    CHECK(table.adapt());
+    CHECK(table.layout() == data::RecordLayout::aos);
+    CHECK(table.get_copy(world.entities[0]).position.x == 4.0f);
+    return true;
+}
+
+/**
+ * Adding a batch of models skips the entities that already have one and adds the rest, keeping the group up to date
+ */
+bool model_batch_skips_present() {
+
+    auto models = std::make_shared<ecs::ModelTable>(8);
+    auto transforms = std::make_shared<ecs::TransformationTable>(8);
+    const ecs::Entity present(1, 0), fresh(2, 0), reused(3, 1), dead(3, 0);
+    for (const ecs::Entity &e : {present, fresh, reused}) {
+        add_root(*transforms, e);
+    }
+    models->add(present, 7);
+    models->add(dead, 8);
+    ecs::OwningGroup group(models, transforms);
+
+    const ecs::Entity keys[] = {present, fresh, reused};
+    const size_t indices[] = {1, 2, 3};
+    CHECK(models->add(keys, indices, 3));
+    CHECK(models->table->size() == 3);
+    CHECK(models->table->get_copy(present).model == 7);
+    CHECK(models->table->get_copy(fresh).model == 2);
+    CHECK(models->table->get_copy(reused).model == 3);
+    CHECK(!models->table->lookup(dead).is_set());
+    CHECK(group.size() == 3);
+    for (const ecs::Entity &e : keys) {
+        CHECK(models->table->lookup(e) == transforms->table->lookup(e));
+    }
+
+    // Nothing to add
+    CHECK(!models->add(keys, indices, 3));
+    return true;
+}
+
+int main() {
+    bool passed = true;
+    passed = reused_index_under_parent() && passed;
+    passed = remove_subtree() && passed;
+    passed = remove_batch() && passed;
+    passed = gc_sweep_covers_table() && passed;
+    passed = gc_allocation_free() && passed;
+    passed = flush_resolves_order() && passed;
+    passed = flush_drops_orphans() && passed;
+    passed = adapt_to_scanned_columns() && passed;
+    passed = model_batch_skips_present() && passed;
+
+    std::cout << (passed ? "All tests passed" : "Some tests failed") << std::endl;
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,122 @@
+/*
+ * Tests of the entity manager.
+ *
+ * Each test returns whether it passed, reporting any failed check.
+ *
+ * Author: Filip Smola (smola.filip@hotmail.com)
+ */
+
+#include <open-sea/Entity.h>
+#include "Test.h"
+namespace ecs = open_sea::ecs;
+
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <cstdlib>
+
+/**
+ * Threads creating (one by one, in bulk and through caches) and killing entities at the same time are never handed
+ *  the same index while it is alive, and the manager counts exactly the entities left alive
+ */
+bool concurrent_create_kill() {
+    constexpr unsigned threads = 8;
+    constexpr unsigned steps = 20000;
+    // Bound on the indices used (living entities plus the free indices kept before reuse, with plenty of slack)
+    constexpr size_t index_bound = static_cast<size_t>(1) << 20;
+
+    ecs::EntityManager manager;
+    std::unique_ptr<std::atomic<bool>[]> held(new std::atomic<bool>[index_bound]());
+    std::atomic<unsigned> duplicates{0};
+    std::atomic<unsigned> out_of_bound{0};
+    std::atomic<unsigned> dead_on_arrival{0};
+    std::atomic<unsigned> alive_after_kill{0};
+    std::atomic<unsigned> left_alive{0};
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            std::mt19937 generator(t);
+            ecs::EntityManager::Cache cache(manager);
+            std::vector<ecs::Entity> own;
+            std::vector<ecs::Entity> batch;
+
+            // Claim an entity created by this thread, checking no other holder has its index
+            auto claim = [&](const ecs::Entity &e) {
+                if (e.index() >= index_bound) {
+                    out_of_bound++;
+                    return;
+                }
+                if (held[e.index()].exchange(true)) {
+                    duplicates++;
+                }
+                if (!manager.alive(e)) {
+                    dead_on_arrival++;
+                }
+                own.push_back(e);
+            };
+
+            for (unsigned step = 0; step < steps; step++) {
+                switch (generator() % 5) {
+                    case 0:
+                        claim(manager.create());
+                        break;
+                    case 1:
+                        claim(cache.create());
+                        break;
+                    case 2:
+                        batch.resize(generator() % 16 + 1);
+                        manager.create(batch.data(), static_cast<unsigned>(batch.size()));
+                        for (const ecs::Entity &e : batch) {
+                            claim(e);
+                        }
+                        break;
+                    default: {
+                        // Kill a few held entities, releasing their indices before the manager can reuse them
+                        const size_t count = std::min<size_t>(own.size(), generator() % 16 + 1);
+                        batch.assign(own.end() - count, own.end());
+                        own.resize(own.size() - count);
+                        for (const ecs::Entity &e : batch) {
+                            held[e.index()] = false;
+                        }
+                        if (count == 1) {
+                            manager.kill(batch[0]);
+                        } else {
+                            manager.kill(batch.data(), static_cast<unsigned>(count));
+                        }
+                        for (const ecs::Entity &e : batch) {
+                            if (manager.alive(e)) {
+                                alive_after_kill++;
+                            }
+                        }
+                        break;
+                    }
+                }
+            }
+            left_alive += static_cast<unsigned>(own.size());
+        });
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+
+    CHECK(duplicates == 0);
+    CHECK(out_of_bound == 0);
+    CHECK(dead_on_arrival == 0);
+    CHECK(alive_after_kill == 0);
+    CHECK(manager.living_entities == left_alive);
+    // Indices were reused while other threads were creating entities
+    CHECK(manager.max_generation > 0);
+    return true;
+}
+
+int main() {
+    bool passed = true;
+    passed = concurrent_create_kill() && passed;
+
+    std::cout << (passed ? "All tests passed" : "Some tests failed") << std::endl;
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,156 @@
+/*
+ * Tests of the queries across tables.
+ *
+ * Each test returns whether it passed, reporting any failed check.
+ *
+ * Author: Filip Smola (smola.filip@hotmail.com)
+ */
+
+#include <open-sea/Query.h>
+#include <open-sea/Entity.h>
+#include "Test.h"
+namespace ecs = open_sea::ecs;
+namespace data = open_sea::data;
+
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <random>
+#include <cstdlib>
+
+//! Position record used by the query tests
+struct Position {
+    static constexpr size_t count = 1;
+    struct Ptr {
+        float *x;
+    };
+
+    float x;
+};
+SOA_MEMBER(Position, 0, float, x)
+
+//! Tag record used by the query tests
+struct Tag {
+    static constexpr size_t count = 1;
+    struct Ptr {
+        unsigned *id;
+    };
+
+    unsigned id;
+};
+SOA_MEMBER(Tag, 0, unsigned, id)
+
+typedef data::TableSoA<ecs::Entity, Position, data::SparseKeyMap<ecs::Entity>> Positions;
+typedef data::TableAoS<ecs::Entity, Tag, data::HashKeyMap<ecs::Entity>> Tags;
+typedef data::TableAoS<ecs::Entity, Tag, data::SparseKeyMap<ecs::Entity>> Hidden;
+
+/**
+ * A query matches exactly the keys in all included tables and in no excluded table, passing each key its own records,
+ *  and matches again after any of the tables' structure changes
+ */
+bool query_matches_model() {
+    constexpr unsigned keys = 1000;
+    Positions positions;
+    Tags tags;
+    Hidden hidden;
+    data::Query<Positions, Tags> query(positions, tags);
+    query.without(hidden);
+
+    // Start with every key in the included tables
+    for (unsigned i = 0; i < keys; i++) {
+        positions.add(ecs::Entity(i, 0), Position{static_cast<float>(i)});
+        tags.add(ecs::Entity(i, 0), Tag{i});
+    }
+
+    std::mt19937 generator(25);
+    for (unsigned round = 0; round < 20; round++) {
+        // Random changes to each table
+        for (unsigned step = 0; step < 500; step++) {
+            const ecs::Entity key(generator() % keys, 0);
+            switch (generator() % 6) {
+                case 0:
+                    positions.add(key, Position{static_cast<float>(key.index())});
+                    break;
+                case 1:
+                    tags.add(key, Tag{key.index()});
+                    break;
+                case 2:
+                    hidden.add(key, Tag{key.index()});
+                    break;
+                case 3:
+                    positions.remove(key);
+                    break;
+                case 4:
+                    tags.remove(key);
+                    break;
+                default:
+                    hidden.remove(key);
+                    break;
+            }
+        }
+
+        // Matched keys are exactly those of the model
+        std::set<unsigned> expected;
+        for (const ecs::Entity &key : positions.keys()) {
+            if (tags.lookup(key).is_set() && !hidden.lookup(key).is_set()) {
+                expected.insert(key.index());
+            }
+        }
+        std::set<unsigned> matched;
+        for (const ecs::Entity &key : query.keys()) {
+            matched.insert(key.index());
+        }
+        CHECK(matched == expected);
+        CHECK(query.size() == expected.size());
+
+        // Each key is passed its own records (over more than one batch of lookups)
+        size_t visited = 0;
+        bool own = true;
+        query.for_each([&](const ecs::Entity &key, const Position::Ptr &p, const Tag::Ptr &t) {
+            visited++;
+            own = own && *p.x == static_cast<float>(key.index()) && *t.id == key.index();
+        });
+        CHECK(own);
+        CHECK(visited == expected.size());
+        CHECK(expected.size() > data::lookup_batch);
+    }
+    return true;
+}
+
+/**
+ * Records written through a query are written to the tables, and a key added after the query was last used is matched
+ */
+bool query_writes_through() {
+    Positions positions;
+    Tags tags;
+    for (unsigned i = 0; i < 200; i++) {
+        positions.add(ecs::Entity(i, 0), Position{0.0f});
+        if (i % 2 == 0) {
+            tags.add(ecs::Entity(i, 0), Tag{i});
+        }
+    }
+    data::Query<Positions, Tags> query(positions, tags);
+    CHECK(query.size() == 100);
+
+    query.for_each([](const ecs::Entity &, const Position::Ptr &p, const Tag::Ptr &t) {
+        *p.x = static_cast<float>(*t.id);
+    });
+    for (unsigned i = 0; i < 200; i++) {
+        CHECK(positions.get_copy(ecs::Entity(i, 0)).x == ((i % 2 == 0) ? static_cast<float>(i) : 0.0f));
+    }
+
+    // Adding a record changes the table's structure version, so the keys are matched again
+    tags.add(ecs::Entity(1, 0), Tag{1});
+    CHECK(query.size() == 101);
+    CHECK(std::find(query.keys().begin(), query.keys().end(), ecs::Entity(1, 0)) != query.keys().end());
+    return true;
+}
+
+int main() {
+    bool passed = true;
+    passed = query_matches_model() && passed;
+    passed = query_writes_through() && passed;
+
+    std::cout << (passed ? "All tests passed" : "Some tests failed") << std::endl;
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,176 @@
+/*
+ * Tests of the thread pool and the parallel loops.
+ *
+ * Each test returns whether it passed, reporting any failed check.
+ *
+ * Author: Filip Smola (smola.filip@hotmail.com)
+ */
+
+#include <open-sea/Systems.h>
+#include <open-sea/Entity.h>
+#include "Test.h"
+namespace ecs = open_sea::ecs;
+namespace data = open_sea::data;
+
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <cstdlib>
+
+//! Small record used by the loop tests
+struct Particle {
+    static constexpr size_t count = 2;
+    struct Ptr {
+        float *x;
+        unsigned *id;
+    };
+
+    float x;
+    unsigned id;
+};
+SOA_MEMBER(Particle, 0, float, x)
+SOA_MEMBER(Particle, 1, unsigned, id)
+
+//! Number of records in the loop tests (not a multiple of the chunk granularity)
+constexpr unsigned records = 10007;
+
+/**
+ * Fill the table with records whose IDs are their indices
+ *
+ * \param table Table
+ */
+template<typename T>
+void fill(T &table) {
+    for (unsigned i = 0; i < records; i++) {
+        table.add(ecs::Entity(i, 0), Particle{0.0f, i});
+    }
+}
+
+/**
+ * Check each record was visited exactly once
+ *
+ * \param visits Visit counts by record ID
+ * \return `true` iff all counts are 1
+ */
+bool visited_once(const std::unique_ptr<std::atomic<unsigned>[]> &visits) {
+    for (unsigned i = 0; i < records; i++) {
+        CHECK(visits[i] == 1);
+    }
+    return true;
+}
+
+/**
+ * Running a batch runs each task exactly once, for any number of workers and tasks
+ */
+bool run_covers_tasks() {
+    for (unsigned threads : {0, 1, 3}) {
+        ecs::ThreadPool pool(threads);
+        for (size_t count : {0, 1, 2, 1000}) {
+            std::vector<std::atomic<unsigned>> runs(count);
+            pool.run(count, [&runs](size_t i) { runs[i]++; });
+            for (size_t i = 0; i < count; i++) {
+                CHECK(runs[i] == 1);
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * An exception thrown by a task is rethrown by the caller once the batch is done, and the pool keeps working after it
+ */
+bool run_rethrows() {
+    ecs::ThreadPool pool(3);
+    bool thrown = false;
+    try {
+        pool.run(1000, [](size_t i) {
+            if (i == 500) {
+                throw std::runtime_error("task failed");
+            }
+        });
+    } catch (std::runtime_error &e) {
+        thrown = true;
+    }
+    CHECK(thrown);
+
+    std::atomic<size_t> runs{0};
+    pool.run(1000, [&runs](size_t) { runs++; });
+    CHECK(runs == 1000);
+    return true;
+}
+
+/**
+ * Both parallel loops visit each record exactly once, with the members of its own record
+ */
+template<typename L>
+bool loops_visit_once() {
+    typedef typename L::template table<ecs::Entity, Particle, data::SparseKeyMap<ecs::Entity>> table_t;
+    ecs::ThreadPool pool(3);
+    table_t table;
+    fill(table);
+
+    // Each record is visited once, and its own members are passed together
+    std::unique_ptr<std::atomic<unsigned>[]> visits(new std::atomic<unsigned>[records]());
+    ecs::parallel_for<0, 1>(pool, table, [&visits](float &x, unsigned &id) {
+        visits[id]++;
+        x = static_cast<float>(id);
+    });
+    CHECK(visited_once(visits));
+    for (unsigned i = 0; i < records; i++) {
+        CHECK(table.get_copy(ecs::Entity(i, 0)).x == static_cast<float>(i));
+    }
+
+    // Each record is in exactly one chunk
+    std::unique_ptr<std::atomic<unsigned>[]> chunk_visits(new std::atomic<unsigned>[records]());
+    ecs::parallel_for_chunks<1>(pool, table, [&chunk_visits](size_t count, size_t stride, unsigned *id) {
+        for (size_t i = 0; i < count; i++) {
+            chunk_visits[*reinterpret_cast<unsigned *>(reinterpret_cast<unsigned char *>(id) +
+                                                       i * (stride == 0 ? sizeof(unsigned) : stride))]++;
+        }
+    });
+    CHECK(visited_once(chunk_visits));
+    return true;
+}
+
+/**
+ * Adding a record from within a parallel loop throws out of the loop, leaving the table unchanged and unlocked
+ */
+bool loop_add_throws() {
+    ecs::ThreadPool pool(3);
+    data::TableSoA<ecs::Entity, Particle, data::SparseKeyMap<ecs::Entity>> table;
+    fill(table);
+
+    bool thrown = false;
+    try {
+        ecs::parallel_for<1>(pool, table, [&table](unsigned &id) {
+            if (id == records / 2) {
+                table.add(ecs::Entity(records, 0), Particle{0.0f, records});
+            }
+        });
+    } catch (std::logic_error &e) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    CHECK(table.size() == records);
+    CHECK(!table.lookup(ecs::Entity(records, 0)).is_set());
+
+    // The structure is unlocked again once the loop is left
+    CHECK(table.add(ecs::Entity(records, 0), Particle{0.0f, records}).is_set());
+    return true;
+}
+
+int main() {
+    bool passed = true;
+    passed = run_covers_tasks() && passed;
+    passed = run_rethrows() && passed;
+    passed = loops_visit_once<data::AoSLayout>() && passed;
+    passed = loops_visit_once<data::SoALayout>() && passed;
+    passed = loops_visit_once<data::AdaptiveLayout>() && passed;
+    passed = loops_visit_once<data::ChunkedLayout<>>() && passed;
+    passed = loops_visit_once<data::AoSoALayout<4>>() && passed;
+    passed = loop_add_throws() && passed;
+
+    std::cout << (passed ? "All tests passed" : "Some tests failed") << std::endl;
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
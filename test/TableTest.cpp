@@ -0,0 +1,382 @@
+/*
+ * Tests of the tables and their key maps.
+ *
+ * Each test returns whether it passed, reporting any failed check.
+ *
+ * Author: Filip Smola (smola.filip@hotmail.com)
+ */
+
+#include <open-sea/Table.h>
+#include <open-sea/Entity.h>
+#include "Test.h"
+namespace ecs = open_sea::ecs;
+namespace data = open_sea::data;
+
+#include <vector>
+#include <map>
+#include <random>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdlib>
+
+//! Small record used by the table tests
+struct Particle {
+    static constexpr size_t count = 2;
+    struct Ptr {
+        float *x;
+        unsigned *id;
+    };
+
+    float x;
+    unsigned id;
+};
+SOA_MEMBER(Particle, 0, float, x)
+SOA_MEMBER(Particle, 1, unsigned, id)
+
+/**
+ * Check the table's keys, key map and records agree with each other
+ *
+ * \param table Table
+ * \return `true` iff they agree
+ */
+template<typename T>
+bool consistent(T &table) {
+    const std::vector<ecs::Entity> &keys = table.keys();
+    CHECK(keys.size() == table.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        CHECK(table.lookup(keys[i]) == data::opt_index(i));
+        CHECK(table.get_copy(data::opt_index(i)).id == *table.get_reference(keys[i]).id);
+    }
+    return true;
+}
+
+/**
+ * Of keys within an added batch that share a key map slot, only the last is added, with its own record, in both batch
+ *  forms
+ *
+ * \param batch Keys of the batch, where the first and the third share a slot
+ */
+template<typename T>
+bool batch_keeps_last_of_slot(const std::vector<ecs::Entity> &batch) {
+    for (bool pointers : {false, true}) {
+        T table;
+        const ecs::Entity other(1, 0);
+        table.add(other, Particle{0.0f, 100});
+
+        std::vector<Particle> records;
+        std::vector<float> xs;
+        std::vector<unsigned> ids;
+        for (unsigned i = 0; i < batch.size(); i++) {
+            records.push_back(Particle{static_cast<float>(i), i});
+            xs.push_back(static_cast<float>(i));
+            ids.push_back(i);
+        }
+        if (pointers) {
+            CHECK(table.add(batch.data(), Particle::Ptr{xs.data(), ids.data()}, batch.size()));
+        } else {
+            CHECK(table.add(batch.data(), records.data(), batch.size()));
+        }
+
+        CHECK(table.size() == batch.size());
+        if (!(batch[0] == batch[2])) {
+            CHECK(!table.lookup(batch[0]).is_set());
+        }
+        for (unsigned i = 1; i < batch.size(); i++) {
+            CHECK(table.get_copy(batch[i]).id == i);
+        }
+        CHECK(table.get_copy(other).id == 100);
+        CHECK(consistent(table));
+    }
+    return true;
+}
+
+/**
+ * Batch additions resolve keys sharing a slot in all layouts
+ */
+template<typename L>
+bool layout_batch_conflicts() {
+    const ecs::Entity a(5, 0), b(2, 0), a_next(5, 1), c(7, 0);
+    bool passed = true;
+    passed = batch_keeps_last_of_slot<typename L::template table<ecs::Entity, Particle, data::SparseKeyMap<ecs::Entity>>>(
+            {a, b, a_next, c}) && passed;
+    passed = batch_keeps_last_of_slot<typename L::template table<ecs::Entity, Particle, data::OpenKeyMap<ecs::Entity>>>(
+            {a, b, a_next, c}) && passed;
+    passed = batch_keeps_last_of_slot<typename L::template table<ecs::Entity, Particle, data::HashKeyMap<ecs::Entity>>>(
+            {a, b, a, c}) && passed;
+    return passed;
+}
+
+/**
+ * Get the slot where an open key map with 16 slots starts probing for the key index (see \ref data::OpenKeyMap)
+ *
+ * \param index Key index
+ * \return Home slot
+ */
+size_t open_home(size_t index) {
+    return static_cast<size_t>((static_cast<uint64_t>(index) * 0x9E3779B97F4A7C15ull) >> 60);
+}
+
+/**
+ * Erasing keys from an open key map in any order keeps the rest findable, when the keys form a cluster of colliding
+ *  home slots that wraps around the end of the slots
+ */
+bool open_map_cluster_erase() {
+    // Keys with home slots 14, 15, 15, 15, 0 and 0, taking slots 14 to 3 (too few to grow the map)
+    std::vector<ecs::Entity> keys;
+    for (size_t home : {14, 15, 15, 15, 0, 0}) {
+        size_t index = keys.empty() ? 0 : keys.back().index() + 1;
+        while (open_home(index) != home) {
+            index++;
+        }
+        keys.emplace_back(static_cast<unsigned>(index), 0);
+    }
+
+    // Erase in every order, checking the map after each erasure
+    std::vector<size_t> order{0, 1, 2, 3, 4, 5};
+    do {
+        data::OpenKeyMap<ecs::Entity> map;
+        for (size_t i = 0; i < keys.size(); i++) {
+            map.insert(keys[i], i);
+        }
+        std::vector<bool> erased(keys.size(), false);
+        for (size_t e : order) {
+            map.erase(keys[e]);
+            erased[e] = true;
+            for (size_t i = 0; i < keys.size(); i++) {
+                CHECK(map.find(keys[i]) == (erased[i] ? data::opt_index() : data::opt_index(i)));
+            }
+        }
+    } while (std::next_permutation(order.begin(), order.end()));
+    return true;
+}
+
+/**
+ * Random insertions and erasures of keys in an open key map, growing and shrinking it, match a reference model
+ */
+bool open_map_matches_model() {
+    constexpr unsigned indices = 2000;
+    data::OpenKeyMap<ecs::Entity> map;
+    std::map<unsigned, std::pair<ecs::Entity, size_t>> model;
+    std::mt19937 generator(20);
+    for (unsigned step = 0; step < 100000; step++) {
+        // Alternate phases of mostly insertion and mostly erasure
+        const bool inserting = (step / 10000) % 2 == 0 ? generator() % 4 != 0 : generator() % 4 == 0;
+        const unsigned index = generator() % indices;
+        const ecs::Entity key(index, generator() % 2);
+        if (inserting) {
+            map.insert(key, step);
+            model[index] = {key, step};
+        } else {
+            map.erase(key);
+            auto it = model.find(index);
+            if (it != model.end() && it->second.first == key) {
+                model.erase(it);
+            }
+        }
+
+        if (step % 1000 == 0) {
+            for (unsigned i = 0; i < indices; i++) {
+                auto it = model.find(i);
+                for (unsigned generation = 0; generation < 2; generation++) {
+                    const ecs::Entity k(i, generation);
+                    const bool present = it != model.end() && it->second.first == k;
+                    CHECK(map.find(k) == (present ? data::opt_index(it->second.second) : data::opt_index()));
+                }
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Views visit the viewed members of every record once, in index order, whether through their loop, their iterators or
+ *  their chunks, and through both the concrete table and the table interface
+ */
+template<typename L>
+bool view_visits_in_order() {
+    // Enough records to span several segments of the chunked layouts, with some removed to reorder them
+    constexpr unsigned n = 5000;
+    typename L::template table<ecs::Entity, Particle, data::SparseKeyMap<ecs::Entity>> table;
+    for (unsigned i = 0; i < n; i++) {
+        table.add(ecs::Entity(i, 0), Particle{0.0f, i});
+    }
+    for (unsigned i = 0; i < n; i += 7) {
+        table.remove(ecs::Entity(i, 0));
+    }
+    std::vector<unsigned> expected;
+    for (const ecs::Entity &key : table.keys()) {
+        expected.push_back(key.index());
+    }
+
+    // Loop, writing through the view
+    std::vector<unsigned> visited;
+    table.template view<0, 1>().for_each([&visited](float &x, unsigned &id) {
+        visited.push_back(id);
+        x = static_cast<float>(id) + 0.5f;
+    });
+    CHECK(visited == expected);
+    for (unsigned id : expected) {
+        CHECK(table.get_copy(ecs::Entity(id, 0)).x == static_cast<float>(id) + 0.5f);
+    }
+
+    // Iterators, through the table interface
+    data::TableAdaptor<decltype(table)> adaptor(table);
+    data::Table<ecs::Entity, Particle> &base = adaptor;
+    visited.clear();
+    for (auto [x, id] : base.view<0, 1>()) {
+        CHECK(x == static_cast<float>(id) + 0.5f);
+        visited.push_back(id);
+    }
+    CHECK(visited == expected);
+
+    // Chunks
+    visited.clear();
+    auto collect = [&visited](unsigned &id) { visited.push_back(id); };
+    for (const auto &chunk : table.template view<1>().chunks(100)) {
+        CHECK(chunk.count > 0 && chunk.count <= 100);
+        data::View<decltype(table), 1>::apply(chunk, collect);
+    }
+    CHECK(visited == expected);
+    return true;
+}
+
+/**
+ * Random insertions and erasures of keys of two generations in a key map match a reference model, and batched lookups
+ *  agree with single ones
+ *
+ * \tparam M Key map type
+ * \param map Empty key map
+ * \param per_index Whether the map holds at most one key per key index (evicting other generations)
+ */
+template<typename M>
+bool key_map_matches_model(M map, bool per_index) {
+    constexpr unsigned indices = 500;
+    std::map<std::pair<unsigned, unsigned>, size_t> model;
+    std::mt19937 generator(25);
+    std::vector<ecs::Entity> all;
+    for (unsigned i = 0; i < indices; i++) {
+        all.emplace_back(i, 0);
+        all.emplace_back(i, 1);
+    }
+
+    for (unsigned step = 0; step < 20000; step++) {
+        const ecs::Entity key(generator() % indices, generator() % 2);
+        const ecs::Entity other(key.index(), 1 - key.generation());
+        const bool other_present = model.count({other.index(), other.generation()}) > 0;
+        if (generator() % 3) {
+            // Only maps with one key per index report the other generation as a conflict
+            CHECK(map.conflict(key) == ((per_index && other_present) ?
+                                        data::opt_index(model[{other.index(), other.generation()}]) : data::opt_index()));
+            map.insert(key, step);
+            model[{key.index(), key.generation()}] = step;
+            if (per_index) {
+                model.erase({other.index(), other.generation()});
+            }
+        } else {
+            map.erase(key);
+            model.erase({key.index(), key.generation()});
+        }
+
+        if (step % 1000 == 0) {
+            // Single lookups match the model
+            for (const ecs::Entity &k : all) {
+                auto it = model.find({k.index(), k.generation()});
+                CHECK(map.find(k) == (it == model.end() ? data::opt_index() : data::opt_index(it->second)));
+            }
+
+            // Batched lookups, including a partial batch at the end, match the single ones
+            size_t dest[data::lookup_batch];
+            for (size_t start = 0; start < all.size(); start += data::lookup_batch) {
+                const size_t count = std::min(data::lookup_batch, all.size() - start);
+                const uint64_t misses = map.find(all.data() + start, dest, count);
+                for (size_t i = 0; i < count; i++) {
+                    const data::opt_index single = map.find(all[start + i]);
+                    CHECK(((misses >> i) & 1) == !single.is_set());
+                    CHECK(!single.is_set() || dest[i] == single.get());
+                }
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * All key maps match the reference model
+ */
+bool key_maps_match_model() {
+    bool passed = true;
+    passed = key_map_matches_model(data::HashKeyMap<ecs::Entity>(), false) && passed;
+    passed = key_map_matches_model(data::SparseKeyMap<ecs::Entity>(), true) && passed;
+    passed = key_map_matches_model(data::OpenKeyMap<ecs::Entity>(), true) && passed;
+    passed = key_map_matches_model(data::SelectKeyMap<ecs::Entity>(data::KeyDensity::dense), true) && passed;
+    passed = key_map_matches_model(data::SelectKeyMap<ecs::Entity>(data::KeyDensity::sparse), true) && passed;
+    return passed;
+}
+
+/**
+ * Switching the layout of an adaptive table copies the records over in place, keeping keys, indices, change tracking,
+ *  structure locks and operation counts
+ */
+bool adaptive_switch_keeps_state() {
+    constexpr unsigned n = 1000;
+    data::TableAdaptive<ecs::Entity, Particle, data::SparseKeyMap<ecs::Entity>> table(0, {}, data::RecordLayout::aos);
+    for (unsigned i = 0; i < n; i++) {
+        table.add(ecs::Entity(i, 0), Particle{static_cast<float>(i), i});
+    }
+    table.track_changes(true);
+    table.set<0>(ecs::Entity(3, 0), 0.5f);
+    const std::vector<ecs::Entity> keys = table.keys();
+    const data::TableStats before = table.stats();
+    const uint64_t version = table.version();
+
+    for (data::RecordLayout target : {data::RecordLayout::soa, data::RecordLayout::aos}) {
+        table.switch_layout(target);
+        CHECK(table.layout() == target);
+        CHECK(table.keys() == keys);
+        CHECK(table.get_copy(ecs::Entity(3, 0)).x == 0.5f);
+        for (unsigned i = 0; i < n; i++) {
+            CHECK(table.get_copy(data::opt_index(i)).id == keys[i].index());
+        }
+        CHECK(consistent(table));
+    }
+    CHECK(table.version() > version);
+    CHECK(table.changes(ecs::Entity(3, 0)) == data::column(0));
+    if constexpr (open_sea::table_stats) {
+        CHECK((table.stats() - before)[data::TableStats::bytes_copied] >= 2 * n * sizeof(Particle));
+    }
+
+    // A locked structure can't be switched
+    {
+        data::StructureLock<decltype(table)> lock(table);
+        bool thrown = false;
+        try {
+            table.switch_layout(data::RecordLayout::soa);
+        } catch (std::logic_error &e) {
+            thrown = true;
+        }
+        CHECK(thrown);
+    }
+    CHECK(table.layout() == data::RecordLayout::aos);
+    return true;
+}
+
+int main() {
+    bool passed = true;
+    passed = layout_batch_conflicts<data::AoSLayout>() && passed;
+    passed = layout_batch_conflicts<data::SoALayout>() && passed;
+    passed = layout_batch_conflicts<data::AdaptiveLayout>() && passed;
+    passed = layout_batch_conflicts<data::ChunkedLayout<>>() && passed;
+    passed = layout_batch_conflicts<data::AoSoALayout<4>>() && passed;
+    passed = view_visits_in_order<data::AoSLayout>() && passed;
+    passed = view_visits_in_order<data::SoALayout>() && passed;
+    passed = view_visits_in_order<data::AdaptiveLayout>() && passed;
+    passed = view_visits_in_order<data::ChunkedLayout<4096>>() && passed;
+    passed = view_visits_in_order<data::AoSoALayout<4>>() && passed;
+    passed = adaptive_switch_keeps_state() && passed;
+    passed = key_maps_match_model() && passed;
+    passed = open_map_cluster_erase() && passed;
+    passed = open_map_matches_model() && passed;
+
+    std::cout << (passed ? "All tests passed" : "Some tests failed") << std::endl;
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
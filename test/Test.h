@@ -0,0 +1,20 @@
+/*
+ * Helpers shared by the tests.
+ *
+ * Each test returns whether it passed, reporting any failed check.
+ *
+ * Author: Filip Smola (smola.filip@hotmail.com)
+ */
+#ifndef OPEN_SEA_TEST_H
+#define OPEN_SEA_TEST_H
+
+#include <iostream>
+
+//! Report the check and fail the test if the condition doesn't hold
+#define CHECK(condition) \
+    if (!(condition)) { \
+        std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition "\n"; \
+        return false; \
+    }
+
+#endif //OPEN_SEA_TEST_H